@@ -0,0 +1,167 @@
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+char** hostArgv;
+extern struct rst_info hostResetInfo;
+
+static struct timespec started;
+static uint64_t skippedUs;
+
+static uint64_t elapsedUs() {
+  if (started.tv_sec == 0 && started.tv_nsec == 0) clock_gettime(CLOCK_MONOTONIC, &started);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - started.tv_sec) * 1000000 + (now.tv_nsec - started.tv_nsec) / 1000 + skippedUs;
+}
+
+void hostClockAdvance(uint64_t us) {
+  skippedUs += us;
+}
+
+// Wraps at 2^32 like the device, so overflow handling is exercised too
+unsigned long millis() {
+  return (uint32_t)(elapsedUs() / 1000);
+}
+
+unsigned long micros() {
+  return (uint32_t)elapsedUs();
+}
+
+void delay(unsigned long ms) {
+  struct timespec wait = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+  while (nanosleep(&wait, &wait) != 0) {
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  struct timespec wait = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+  while (nanosleep(&wait, &wait) != 0) {
+  }
+}
+
+void yield() {}
+
+void esp_delay(unsigned long ms) {
+  delay(ms);
+}
+
+void esp_delay(unsigned long ms, const std::function<bool()>& blocked, unsigned long interval) {
+  unsigned long start = millis();
+  while (blocked()) {
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= ms) return;
+    delay(std::min(interval, ms - elapsed));
+  }
+}
+
+static uint8_t pinState[18];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < sizeof(pinState)) pinState[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < sizeof(pinState) ? pinState[pin] : LOW;
+}
+
+void analogWrite(uint8_t pin, int value) {
+  digitalWrite(pin, value > 0);
+}
+
+// The ADC reading: HOST_ADC_FILE is re-read at most every 100 ms
+int analogRead(uint8_t pin) {
+  (void)pin;
+  static int value = -1;
+  static unsigned long readAt;
+  const char* path = getenv("HOST_ADC_FILE");
+  if (value < 0 || (path && millis() - readAt >= 100)) {
+    const char* fixed = getenv("HOST_ADC");
+    value = fixed ? atoi(fixed) : 120;
+    if (path) {
+      FILE* file = fopen(path, "r");
+      if (file) {
+        if (fscanf(file, "%d", &value) != 1) value = 0;
+        fclose(file);
+      }
+      readAt = millis();
+    }
+  }
+  return constrain(value, 0, 1023);
+}
+
+long random(long max) {
+  return max > 0 ? ESP.random() % max : 0;
+}
+
+long random(long min, long max) {
+  return min < max ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
+
+// Unit tests bring their own main() and call into the firmware directly
+#ifndef PIO_UNIT_TESTING
+static volatile sig_atomic_t stopRequested;
+
+static void requestStop(int signal) {
+  (void)signal;
+  stopRequested = 1;
+}
+
+// Picks up the RTC memory a restart() handed over
+static void restoreRtcMemory() {
+  const char* saved = getenv("HOST_RTC_MEMORY");
+  if (!saved || strlen(saved) != sizeof(hostRtcMemory) * 2) return;
+  for (size_t i = 0; i < sizeof(hostRtcMemory) / 4; i++) {
+    char word[9] = {};
+    memcpy(word, saved + i * 8, 8);
+    hostRtcMemory[i] = strtoul(word, nullptr, 16);
+  }
+  hostResetInfo.reason = REASON_SOFT_RESTART;
+  unsetenv("HOST_RTC_MEMORY");
+}
+
+// Runs setup(), then loop() until SIGINT/SIGTERM or HOST_LOOP_LIMIT passes,
+// and reports the pass rate on stderr for benchmarking
+int main(int argc, char** argv) {
+  (void)argc;
+  hostArgv = argv;
+  elapsedUs();  // Starts the clock
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  srandom((unsigned)time(nullptr) ^ (unsigned)getpid());
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+  restoreRtcMemory();
+  ESP.getFreeHeap();  // Heap baseline, before the firmware allocates
+
+  const char* limitText = getenv("HOST_LOOP_LIMIT");
+  unsigned long long limit = limitText ? strtoull(limitText, nullptr, 10) : 0;
+
+  setup();
+  WiFi.serviceEvents();
+  uint64_t loopStart = elapsedUs();
+  unsigned long long passes = 0;
+  while (!stopRequested && (limit == 0 || passes < limit)) {
+    WiFi.serviceEvents();  // Where the SDK would run between passes
+    loop();
+    passes++;
+  }
+  double seconds = (elapsedUs() - loopStart) / 1e6;
+  fflush(stdout);
+  fprintf(stderr, "host: %llu loop() passes in %.3f s, %.0f passes/s, %.2f us/pass\n", passes, seconds,
+          seconds > 0 ? passes / seconds : 0.0, passes ? seconds * 1e6 / passes : 0.0);
+  return 0;
+}
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+// Arduino core API for the native (Linux) build. Time comes from the
+// monotonic clock, pins are plain state, and analogRead() returns HOST_ADC
+// or the number in the file named by HOST_ADC_FILE, so a test can move the
+// "sensor" while the firmware runs.
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+
+#include "pgmspace.h"
+#include "WString.h"
+#include "Print.h"
+#include "Printable.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+#include "IPAddress.h"
+#include "Esp.h"
+
+using std::max;
+using std::min;
+
+template <typename T, typename L, typename H>
+auto constrain(const T& value, const L& low, const H& high) -> decltype(value < low ? low : (value > high ? high : value)) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT 0x01
+
+// NodeMCU pin names
+#define A0 17
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+#ifndef F_CPU
+#define F_CPU 80000000L
+#endif
+
+unsigned long millis();
+unsigned long micros();
+// Moves millis() and micros() forward, so a test can run hours in seconds
+void hostClockAdvance(uint64_t us);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// Sleeps in interval steps until the timeout, or sooner once blocked() is false
+void esp_delay(unsigned long ms);
+void esp_delay(unsigned long ms, const std::function<bool()>& blocked, unsigned long interval);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// No interrupts on the host: the critical sections are no-ops
+#define interrupts()
+#define noInterrupts()
+inline uint32_t xt_rsil(uint32_t level) {
+  (void)level;
+  return 0;
+}
+inline void xt_wsr_ps(uint32_t state) { (void)state; }
+
+// timer1 never fires on the host, so the software watchdog and the sampling
+// profiler stay idle; use perf instead
+#define TIM_DIV1 0
+#define TIM_DIV16 1
+#define TIM_DIV256 3
+#define TIM_EDGE 0
+#define TIM_LEVEL 1
+#define TIM_SINGLE 0
+#define TIM_LOOP 1
+inline void timer1_attachInterrupt(void (*isr)()) { (void)isr; }
+inline void timer1_detachInterrupt() {}
+inline void timer1_enable(uint8_t divider, uint8_t type, uint8_t reload) {
+  (void)divider;
+  (void)type;
+  (void)reload;
+}
+inline void timer1_disable() {}
+inline void timer1_write(uint32_t ticks) { (void)ticks; }
+
+// RTC user memory, shared by ESP.rtcUserMemory*() and direct access
+extern uint32_t hostRtcMemory[128];
+#define RTC_USER_MEM ((volatile uint32_t*)hostRtcMemory)
+
+void setup();
+void loop();
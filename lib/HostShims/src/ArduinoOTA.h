@@ -0,0 +1,29 @@
+#pragma once
+#include <functional>
+#include "ESP8266WiFi.h"
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+// Network updates are not emulated on the host; the callbacks never run.
+// The /update upload path still works against the Update shim.
+class ArduinoOTAClass {
+public:
+  void setHostname(const char* hostname) { (void)hostname; }
+  void setPort(uint16_t port) { (void)port; }
+  void setPassword(const char* password) { (void)password; }
+  void onStart(std::function<void()> handler) { (void)handler; }
+  void onEnd(std::function<void()> handler) { (void)handler; }
+  void onProgress(std::function<void(unsigned int, unsigned int)> handler) { (void)handler; }
+  void onError(std::function<void(ota_error_t)> handler) { (void)handler; }
+  void begin(bool useMDNS = true) { (void)useMDNS; }
+  void handle() {}
+  int getCommand() const { return U_FLASH; }
+};
+
+extern ArduinoOTAClass ArduinoOTA;
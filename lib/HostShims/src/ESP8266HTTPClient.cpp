@@ -0,0 +1,129 @@
+#include "ESP8266HTTPClient.h"
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+  end();
+  if (!url.startsWith(F("http://"))) return false;
+  String rest = url.substring(7);
+  int slash = rest.indexOf('/');
+  String authority = slash < 0 ? rest : rest.substring(0, slash);
+  path_ = slash < 0 ? String(F("/")) : rest.substring(slash);
+  int colon = authority.indexOf(':');
+  host_ = colon < 0 ? authority : authority.substring(0, colon);
+  port_ = colon < 0 ? 80 : authority.substring(colon + 1).toInt();
+  client_ = &client;
+  return host_.length() > 0;
+}
+
+void HTTPClient::end() {
+  if (client_) client_->stop();
+  client_ = nullptr;
+  headers_ = String();
+  body_ = String();
+}
+
+void HTTPClient::addHeader(const String& name, const String& value) {
+  headers_ += name + F(": ") + value + F("\r\n");
+}
+
+int HTTPClient::GET() {
+  return sendRequest("GET");
+}
+
+int HTTPClient::POST(const uint8_t* payload, size_t size) {
+  return sendRequest("POST", payload, size);
+}
+
+int HTTPClient::PUT(const uint8_t* payload, size_t size) {
+  return sendRequest("PUT", payload, size);
+}
+
+bool HTTPClient::readLine(String& line, unsigned long start) {
+  line = String();
+  while (millis() - start < timeout_) {
+    int c = client_->read();
+    if (c < 0) {
+      if (!client_->connected()) return false;
+      delay(1);
+    } else if (c == '\n') {
+      line.trim();
+      return true;
+    } else {
+      line.concat((char)c);
+    }
+  }
+  return false;
+}
+
+int HTTPClient::sendRequest(const char* method, const uint8_t* payload, size_t size) {
+  if (!client_) return HTTPC_ERROR_NOT_CONNECTED;
+  body_ = String();
+  if (!client_->connect(host_.c_str(), port_)) return HTTPC_ERROR_CONNECTION_FAILED;
+
+  String head = String(method) + ' ' + path_ + F(" HTTP/1.1\r\nHost: ") + host_;
+  if (port_ != 80) {
+    head += ':';
+    head += String(port_);
+  }
+  head += F("\r\nUser-Agent: ") + userAgent_ + F("\r\nConnection: close\r\n");
+  if (payload || strcmp(method, "GET") != 0) head += F("Content-Length: ") + String((unsigned long)size) + F("\r\n");
+  head += headers_ + F("\r\n");
+  client_->setTimeout(timeout_);
+  if (client_->write((const uint8_t*)head.c_str(), head.length()) != head.length()) {
+    return HTTPC_ERROR_SEND_HEADER_FAILED;
+  }
+  if (size && client_->write(payload, size) != size) return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+
+  unsigned long start = millis();
+  String line;
+  if (!readLine(line, start)) return HTTPC_ERROR_READ_TIMEOUT;
+  if (!line.startsWith(F("HTTP/1."))) return HTTPC_ERROR_NO_HTTP_SERVER;
+  int code = line.substring(9, 12).toInt();
+
+  long length = -1;
+  bool chunked = false;
+  while (readLine(line, start) && line.length()) {
+    String lower = line;
+    lower.toLowerCase();
+    if (lower.startsWith(F("content-length:"))) length = lower.substring(15).toInt();
+    if (lower.startsWith(F("transfer-encoding:")) && lower.indexOf(F("chunked")) >= 0) chunked = true;
+  }
+
+  // The body is read in full so the connection closes cleanly
+  long remaining = length;
+  while (millis() - start < timeout_) {
+    if (chunked && remaining <= 0) {
+      if (remaining == 0 && !readLine(line, start)) break;  // CRLF after a chunk
+      if (!readLine(line, start)) break;
+      remaining = strtol(line.c_str(), nullptr, 16);
+      if (remaining == 0) break;
+    }
+    if (!chunked && length >= 0 && remaining <= 0) break;
+    int c = client_->read();
+    if (c < 0) {
+      if (!client_->connected()) break;
+      delay(1);
+      continue;
+    }
+    body_.concat((char)c);
+    remaining--;
+  }
+  client_->stop();
+  return code;
+}
+
+String HTTPClient::errorToString(int error) {
+  switch (error) {
+    case HTTPC_ERROR_CONNECTION_FAILED: return F("connection failed");
+    case HTTPC_ERROR_SEND_HEADER_FAILED: return F("send header failed");
+    case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return F("send payload failed");
+    case HTTPC_ERROR_NOT_CONNECTED: return F("not connected");
+    case HTTPC_ERROR_CONNECTION_LOST: return F("connection lost");
+    case HTTPC_ERROR_NO_STREAM: return F("no stream");
+    case HTTPC_ERROR_NO_HTTP_SERVER: return F("no HTTP server");
+    case HTTPC_ERROR_TOO_LESS_RAM: return F("too less ram");
+    case HTTPC_ERROR_ENCODING: return F("Transfer-Encoding not supported");
+    case HTTPC_ERROR_STREAM_WRITE: return F("Stream write error");
+    case HTTPC_ERROR_READ_TIMEOUT: return F("read Timeout");
+    default: return String();
+  }
+}
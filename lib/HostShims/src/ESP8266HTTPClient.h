@@ -0,0 +1,52 @@
+#pragma once
+// Plain HTTP/1.1 client with the core HTTPClient interface, one request per
+// connection. https:// URLs are refused; point HOST_RESOLVE at a local
+// http endpoint instead.
+#include <vector>
+#include "ESP8266WiFi.h"
+
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTP_CODE_OK 200
+
+class HTTPClient {
+public:
+  bool begin(WiFiClient& client, const String& url);
+  void end();
+  void setTimeout(uint16_t timeout) { timeout_ = timeout; }
+  void setUserAgent(const String& userAgent) { userAgent_ = userAgent; }
+  void addHeader(const String& name, const String& value);
+
+  int GET();
+  int POST(const uint8_t* payload, size_t size);
+  int POST(const String& payload) { return POST((const uint8_t*)payload.c_str(), payload.length()); }
+  int PUT(const uint8_t* payload, size_t size);
+  int PUT(const String& payload) { return PUT((const uint8_t*)payload.c_str(), payload.length()); }
+  int sendRequest(const char* method, const uint8_t* payload = nullptr, size_t size = 0);
+
+  int getSize() const { return body_.length(); }
+  const String& getString() const { return body_; }
+  static String errorToString(int error);
+
+private:
+  bool readLine(String& line, unsigned long start);
+
+  WiFiClient* client_ = nullptr;
+  String host_;
+  uint16_t port_ = 80;
+  String path_;
+  String headers_;
+  String userAgent_ = "ESP8266HTTPClient";
+  String body_;
+  uint16_t timeout_ = 5000;
+};
@@ -0,0 +1,315 @@
+#include "ESP8266WebServer.h"
+
+static const unsigned long HTTP_MAX_DATA_WAIT = 5000;
+static const size_t HTTP_MAX_HEAD = 8192;
+
+static String urlDecode(const char* text, size_t length) {
+  String out;
+  out.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    char c = text[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < length && isxdigit((unsigned char)text[i + 1]) &&
+               isxdigit((unsigned char)text[i + 2])) {
+      char hex[3] = { text[i + 1], text[i + 2], 0 };
+      c = (char)strtol(hex, nullptr, 16);
+      i += 2;
+    }
+    out.concat(c);
+  }
+  return out;
+}
+
+static const char* statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "";
+  }
+}
+
+// Reads the body, giving up after HTTP_MAX_DATA_WAIT without new data
+static bool readFully(WiFiClient& client, std::string& out, size_t length) {
+  char buf[2048];
+  unsigned long lastData = millis();
+  while (out.size() < length) {
+    int n = client.read((uint8_t*)buf, std::min(sizeof(buf), length - out.size()));
+    if (n > 0) {
+      out.append(buf, n);
+      lastData = millis();
+      continue;
+    }
+    if (!client.connected() || millis() - lastData >= HTTP_MAX_DATA_WAIT) return false;
+    delay(1);
+  }
+  return true;
+}
+
+void ESP8266WebServer::on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload) {
+  routes_.push_back(Route{ uri, method, handler, upload });
+}
+
+bool ESP8266WebServer::readRequest() {
+  // Request line and headers
+  std::string head;
+  unsigned long start = millis();
+  while (head.find("\r\n\r\n") == std::string::npos) {
+    int c = client_.read();
+    if (c < 0) {
+      if (!client_.connected() || millis() - start >= HTTP_MAX_DATA_WAIT) return false;
+      delay(1);
+      continue;
+    }
+    head += (char)c;
+    if (head.size() > HTTP_MAX_HEAD) return false;
+  }
+
+  size_t lineEnd = head.find("\r\n");
+  std::string requestLine = head.substr(0, lineEnd);
+  size_t space1 = requestLine.find(' ');
+  size_t space2 = requestLine.find(' ', space1 + 1);
+  if (space1 == std::string::npos || space2 == std::string::npos) return false;
+  std::string method = requestLine.substr(0, space1);
+  std::string target = requestLine.substr(space1 + 1, space2 - space1 - 1);
+
+  static const char* const methods[] = { "", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS" };
+  method_ = HTTP_ANY;
+  for (int i = 1; i < 8; i++) {
+    if (method == methods[i]) method_ = (HTTPMethod)i;
+  }
+
+  args_.clear();
+  headers_.clear();
+  size_t query = target.find('?');
+  uri_ = urlDecode(target.data(), query == std::string::npos ? target.size() : query);
+  if (query != std::string::npos) parseArgs(String(target.c_str() + query + 1));
+
+  size_t at = lineEnd + 2;
+  while (at < head.size()) {
+    size_t end = head.find("\r\n", at);
+    if (end == at || end == std::string::npos) break;
+    std::string line = head.substr(at, end - at);
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+      size_t value = line.find_first_not_of(' ', colon + 1);
+      headers_.push_back(Pair(String(line.c_str(), colon),
+                              String(value == std::string::npos ? "" : line.c_str() + value)));
+    }
+    at = end + 2;
+  }
+
+  body_.clear();
+  size_t length = header(F("Content-Length")).toInt();
+  if (length && !readFully(client_, body_, length)) return false;
+  return true;
+}
+
+void ESP8266WebServer::parseArgs(const String& text) {
+  const char* p = text.c_str();
+  while (*p) {
+    const char* end = strchr(p, '&');
+    size_t length = end ? end - p : strlen(p);
+    const char* equals = (const char*)memchr(p, '=', length);
+    if (length) {
+      if (equals) {
+        args_.push_back(Pair(urlDecode(p, equals - p), urlDecode(equals + 1, p + length - equals - 1)));
+      } else {
+        args_.push_back(Pair(urlDecode(p, length), String()));
+      }
+    }
+    p += length + (end ? 1 : 0);
+  }
+}
+
+// Form fields become arguments; a file part is fed to the upload handler in
+// HTTP_UPLOAD_BUFLEN pieces, as the core does while it reads
+void ESP8266WebServer::handleMultipart(const std::string& body, const String& boundary, const Route* route) {
+  std::string delimiter = std::string("--") + boundary.c_str();
+  size_t at = body.find(delimiter);
+  while (at != std::string::npos) {
+    at += delimiter.size();
+    if (body.compare(at, 2, "--") == 0) break;
+    size_t headEnd = body.find("\r\n\r\n", at);
+    if (headEnd == std::string::npos) break;
+    std::string partHead = body.substr(at, headEnd - at);
+    size_t dataStart = headEnd + 4;
+    size_t next = body.find("\r\n" + delimiter, dataStart);
+    if (next == std::string::npos) break;
+
+    auto field = [&](const char* key) {
+      std::string pattern = std::string(key) + "=\"";
+      size_t start = partHead.find(pattern);
+      if (start == std::string::npos) return String();
+      start += pattern.size();
+      size_t end = partHead.find('"', start);
+      return String(partHead.c_str() + start, end - start);
+    };
+    String name = field("name");
+    bool isFile = partHead.find("filename=\"") != std::string::npos;
+    if (!isFile) {
+      args_.push_back(Pair(name, String(body.c_str() + dataStart, next - dataStart)));
+    } else if (route && route->upload) {
+      upload_.status = UPLOAD_FILE_START;
+      upload_.name = name;
+      upload_.filename = field("filename");
+      size_t typeAt = partHead.find("Content-Type:");
+      upload_.type = typeAt == std::string::npos ? String() : String(partHead.c_str() + typeAt + 14);
+      upload_.type.trim();
+      upload_.totalSize = 0;
+      upload_.currentSize = 0;
+      route->upload();
+      for (size_t offset = dataStart; offset < next; offset += HTTP_UPLOAD_BUFLEN) {
+        upload_.status = UPLOAD_FILE_WRITE;
+        upload_.currentSize = std::min((size_t)HTTP_UPLOAD_BUFLEN, next - offset);
+        memcpy(upload_.buf, body.data() + offset, upload_.currentSize);
+        upload_.totalSize += upload_.currentSize;
+        route->upload();
+      }
+      upload_.status = UPLOAD_FILE_END;
+      upload_.currentSize = 0;
+      route->upload();
+    }
+    at = next + 2;
+  }
+}
+
+void ESP8266WebServer::handleClient() {
+  if (!server_.hasClient()) return;
+  client_ = server_.accept();
+  if (!client_.connected()) return;
+
+  responseHeaders_ = String();
+  contentLength_ = CONTENT_LENGTH_NOT_SET;
+  chunked_ = false;
+  responded_ = false;
+  if (!readRequest()) {
+    client_.stop();
+    return;
+  }
+
+  const Route* route = nullptr;
+  for (const Route& candidate : routes_) {
+    if (candidate.uri == uri_ && (candidate.method == HTTP_ANY || candidate.method == method_)) {
+      route = &candidate;
+      break;
+    }
+  }
+
+  String contentType = header(F("Content-Type"));
+  if (contentType.startsWith(F("application/x-www-form-urlencoded"))) {
+    parseArgs(String(body_.data(), body_.size()));
+  } else if (contentType.startsWith(F("multipart/form-data"))) {
+    int boundary = contentType.indexOf(F("boundary="));
+    if (boundary >= 0) {
+      String value = contentType.substring(boundary + 9);
+      value.replace(String("\""), String());
+      handleMultipart(body_, value, route);
+    }
+  } else if (!body_.empty()) {
+    args_.push_back(Pair(String(F("plain")), String(body_.data(), body_.size())));
+  }
+
+  if (route) {
+    route->handler();
+  } else if (notFound_) {
+    notFound_();
+  } else {
+    send(404, F("text/plain"), String(F("Not found: ")) + uri_);
+  }
+  if (!responded_) send(500, F("text/plain"), F("No response\n"));
+  if (chunked_) sendContent("", 0);
+  client_.stop();
+  body_.clear();
+}
+
+String ESP8266WebServer::arg(const String& name) const {
+  for (const Pair& pair : args_) {
+    if (pair.first == name) return pair.second;
+  }
+  return String();
+}
+
+String ESP8266WebServer::arg(int index) const {
+  return index >= 0 && index < (int)args_.size() ? args_[index].second : String();
+}
+
+String ESP8266WebServer::argName(int index) const {
+  return index >= 0 && index < (int)args_.size() ? args_[index].first : String();
+}
+
+bool ESP8266WebServer::hasArg(const String& name) const {
+  for (const Pair& pair : args_) {
+    if (pair.first == name) return true;
+  }
+  return false;
+}
+
+String ESP8266WebServer::header(const String& name) const {
+  for (const Pair& pair : headers_) {
+    if (pair.first.equalsIgnoreCase(name)) return pair.second;
+  }
+  return String();
+}
+
+bool ESP8266WebServer::hasHeader(const String& name) const {
+  for (const Pair& pair : headers_) {
+    if (pair.first.equalsIgnoreCase(name)) return true;
+  }
+  return false;
+}
+
+void ESP8266WebServer::sendHeader(const String& name, const String& value, bool first) {
+  String line = name + F(": ") + value + F("\r\n");
+  responseHeaders_ = first ? line + responseHeaders_ : responseHeaders_ + line;
+}
+
+void ESP8266WebServer::writeHead(int code, const String& contentType, size_t length) {
+  String head = String(F("HTTP/1.1 ")) + String(code) + ' ' + statusText(code) + F("\r\n");
+  head += F("Content-Type: ");
+  head += contentType.length() ? contentType : String(F("text/html"));
+  head += F("\r\n");
+  if (contentLength_ == CONTENT_LENGTH_UNKNOWN) {
+    chunked_ = true;
+    head += F("Transfer-Encoding: chunked\r\n");
+  } else {
+    head += F("Content-Length: ");
+    head += String((unsigned long)(contentLength_ == CONTENT_LENGTH_NOT_SET ? length : contentLength_));
+    head += F("\r\n");
+  }
+  head += responseHeaders_;
+  head += F("Connection: close\r\n\r\n");
+  client_.write((const uint8_t*)head.c_str(), head.length());
+  responded_ = true;
+}
+
+void ESP8266WebServer::send(int code, const String& contentType, const String& content) {
+  send(code, contentType.c_str(), content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const char* content, size_t length) {
+  writeHead(code, String(contentType), length);
+  if (length && method_ != HTTP_HEAD) sendContent(content, length);
+}
+
+void ESP8266WebServer::sendContent(const char* content, size_t length) {
+  if (!chunked_) {
+    client_.write((const uint8_t*)content, length);
+    return;
+  }
+  char size[12];
+  snprintf(size, sizeof(size), "%zx\r\n", length);
+  client_.write(size);
+  client_.write((const uint8_t*)content, length);
+  client_.write("\r\n");
+  if (length == 0) chunked_ = false;  // The terminating chunk
+}
@@ -0,0 +1,93 @@
+#pragma once
+// A small HTTP/1.1 server with the core ESP8266WebServer interface: one
+// request per connection, query and form arguments, multipart uploads and
+// chunked responses when the length is unknown
+#include <functional>
+#include <vector>
+#include "ESP8266WiFi.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 2048
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+class ESP8266WebServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit ESP8266WebServer(int port = 80) : server_(port) {}
+
+  void begin() { server_.begin(); }
+  void close() { server_.close(); }
+  void stop() { close(); }
+  void handleClient();
+
+  void on(const String& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+  void on(const String& uri, HTTPMethod method, THandlerFunction handler) { on(uri, method, handler, nullptr); }
+  void on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload);
+  void onNotFound(THandlerFunction handler) { notFound_ = handler; }
+
+  String uri() const { return uri_; }
+  HTTPMethod method() const { return method_; }
+  WiFiClient& client() { return client_; }
+  HTTPUpload& upload() { return upload_; }
+
+  String arg(const String& name) const;
+  String arg(int index) const;
+  String argName(int index) const;
+  int args() const { return args_.size(); }
+  bool hasArg(const String& name) const;
+  String header(const String& name) const;
+  bool hasHeader(const String& name) const;
+
+  void sendHeader(const String& name, const String& value, bool first = false);
+  void setContentLength(size_t length) { contentLength_ = length; }
+  void send(int code, const String& contentType = String(), const String& content = String());
+  void send(int code, const char* contentType, const char* content, size_t length);
+  void send_P(int code, PGM_P contentType, PGM_P content) { send(code, contentType, content, strlen(content)); }
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length) { send(code, contentType, content, length); }
+  void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char* content, size_t length);
+  void sendContent_P(PGM_P content) { sendContent(content, strlen(content)); }
+
+private:
+  struct Route {
+    String uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    THandlerFunction upload;
+  };
+  typedef std::pair<String, String> Pair;
+
+  bool readRequest();
+  void parseArgs(const String& text);
+  void handleMultipart(const std::string& body, const String& boundary, const Route* route);
+  void writeHead(int code, const String& contentType, size_t length);
+
+  WiFiServer server_;
+  WiFiClient client_;
+  std::vector<Route> routes_;
+  THandlerFunction notFound_;
+  String uri_;
+  HTTPMethod method_ = HTTP_ANY;
+  std::vector<Pair> args_;
+  std::vector<Pair> headers_;
+  String responseHeaders_;
+  size_t contentLength_ = CONTENT_LENGTH_NOT_SET;
+  bool chunked_ = false;
+  bool responded_ = false;
+  std::string body_;
+  HTTPUpload upload_;
+};
@@ -0,0 +1,460 @@
+#include "ESP8266WiFi.h"
+#include "WiFiUdp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+ESP8266WiFiClass WiFi;
+
+// lwIP's TCP_SND_BUF on the ESP8266 (two segments); availableForWrite()
+// never reports more, so backpressure shows up at the same point
+static const int HOST_TCP_SND_BUF = 2 * 1460;
+static const unsigned long HOST_CONNECT_TIMEOUT = 5000;
+
+namespace {
+
+template <typename Event>
+struct Handler : WiFiEventHandlerOpaque {
+  explicit Handler(std::function<void(const Event&)> callback) : callback(callback) {}
+  std::function<void(const Event&)> callback;
+};
+
+template <typename Event>
+std::vector<std::weak_ptr<Handler<Event>>>& handlers() {
+  static std::vector<std::weak_ptr<Handler<Event>>> list;
+  return list;
+}
+
+template <typename Event>
+WiFiEventHandler addHandler(std::function<void(const Event&)> callback) {
+  auto handler = std::make_shared<Handler<Event>>(callback);
+  handlers<Event>().push_back(handler);
+  return handler;
+}
+
+template <typename Event>
+void fire(const Event& event) {
+  auto& list = handlers<Event>();
+  for (size_t i = 0; i < list.size();) {
+    if (auto handler = list[i].lock()) {
+      handler->callback(event);
+      i++;
+    } else {
+      list.erase(list.begin() + i);
+    }
+  }
+}
+
+volatile sig_atomic_t linkToggleRequested;
+
+void requestLinkToggle(int signal) {
+  (void)signal;
+  linkToggleRequested = 1;
+}
+
+const uint8_t HOST_BSSID[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+}  // namespace
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+  static bool signalInstalled = false;
+  if (!signalInstalled) {
+    signal(SIGUSR1, requestLinkToggle);
+    signalInstalled = true;
+  }
+  mode_ = mode;
+  if (mode == WIFI_OFF) status_ = WL_DISCONNECTED;
+  return true;
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* psk, int32_t channel, const uint8_t* bssid,
+                                    bool connect) {
+  (void)ssid;
+  (void)channel;
+  (void)bssid;
+  psk_ = psk ? psk : "";
+  cleared_ = false;
+  if (mode_ == WIFI_OFF) mode(WIFI_STA);
+  // Like the SDK, a new begin() leaves the current network first
+  if (status_ == WL_CONNECTED) pendingLeave_ = true;
+  status_ = WL_DISCONNECTED;
+  pendingConnect_ = connect;
+  return status_;
+}
+
+wl_status_t ESP8266WiFiClass::begin() {
+  String ssid = SSID();
+  return begin(ssid.c_str(), psk_.c_str());
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  (void)local;
+  (void)gateway;
+  (void)subnet;
+  (void)dns1;
+  (void)dns2;
+  return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifiOff) {
+  bool wasConnected = status_ == WL_CONNECTED;
+  status_ = WL_DISCONNECTED;
+  pendingConnect_ = false;
+  if (wifiOff) cleared_ = true;  // The SDK forgets the stored network too
+  if (wasConnected) {
+    WiFiEventStationModeDisconnected event{ SSID(), {}, WIFI_DISCONNECT_REASON_ASSOC_LEAVE };
+    memcpy(event.bssid, HOST_BSSID, sizeof(event.bssid));
+    fire(event);
+  }
+  return true;
+}
+
+String ESP8266WiFiClass::SSID() const {
+  if (cleared_) return String();
+  const char* ssid = getenv("HOST_WIFI_SSID");
+  return String(ssid ? ssid : "host-native");
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+  static uint8_t bssid[6];
+  memcpy(bssid, HOST_BSSID, sizeof(bssid));
+  return bssid;
+}
+
+String ESP8266WiFiClass::BSSIDstr() {
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", HOST_BSSID[0], HOST_BSSID[1], HOST_BSSID[2],
+           HOST_BSSID[3], HOST_BSSID[4], HOST_BSSID[5]);
+  return String(text);
+}
+
+// A locally administered MAC derived from the chip ID
+uint8_t* ESP8266WiFiClass::macAddress(uint8_t* mac) {
+  uint32_t id = ESP.getChipId();
+  mac[0] = 0x5E;
+  mac[1] = 0xCF;
+  mac[2] = 0x7F;
+  mac[3] = id >> 16;
+  mac[4] = id >> 8;
+  mac[5] = id;
+  return mac;
+}
+
+String ESP8266WiFiClass::macAddress() {
+  uint8_t mac[6];
+  macAddress(mac);
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(text);
+}
+
+bool ESP8266WiFiClass::hostname(const char* name) {
+  hostname_ = name;
+  return true;
+}
+
+IPAddress ESP8266WiFiClass::localIP() const {
+  return status_ == WL_CONNECTED ? IPAddress(127, 0, 0, 1) : IPAddress();
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> handler) {
+  return addHandler<WiFiEventStationModeGotIP>(handler);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDisconnected(
+    std::function<void(const WiFiEventStationModeDisconnected&)> handler) {
+  return addHandler<WiFiEventStationModeDisconnected>(handler);
+}
+
+void ESP8266WiFiClass::serviceEvents() {
+  WiFiEventStationModeDisconnected lost{ SSID(), {}, WIFI_DISCONNECT_REASON_ASSOC_LEAVE };
+  memcpy(lost.bssid, HOST_BSSID, sizeof(lost.bssid));
+
+  if (linkToggleRequested) {
+    linkToggleRequested = 0;
+    linkDown_ = !linkDown_;
+    fprintf(stderr, "host: WiFi link %s\n", linkDown_ ? "down" : "up");
+    if (linkDown_ && status_ == WL_CONNECTED) {
+      status_ = WL_CONNECTION_LOST;
+      lost.reason = WIFI_DISCONNECT_REASON_BEACON_TIMEOUT;
+      fire(lost);
+    } else if (!linkDown_ && mode_ != WIFI_OFF && !cleared_) {
+      pendingConnect_ = true;  // The SDK's auto-reconnect
+    }
+  }
+
+  if (pendingLeave_) {
+    pendingLeave_ = false;
+    lost.reason = WIFI_DISCONNECT_REASON_ASSOC_LEAVE;
+    fire(lost);
+  }
+  if (pendingConnect_) {
+    pendingConnect_ = false;
+    if (linkDown_ || cleared_) {
+      status_ = WL_NO_SSID_AVAIL;
+      lost.reason = WIFI_DISCONNECT_REASON_NO_AP_FOUND;
+      fire(lost);
+    } else {
+      status_ = WL_CONNECTED;
+      fire(WiFiEventStationModeGotIP{ localIP(), subnetMask(), gatewayIP() });
+    }
+  }
+}
+
+uint16_t hostPort(uint16_t port) {
+  const char* offset = getenv("HOST_PORT_OFFSET");
+  long shifted = port + (offset ? atol(offset) : 8000);
+  return shifted > 0 && shifted < 65536 ? shifted : port;
+}
+
+// Applies HOST_RESOLVE, then resolves the name; fills in an IPv4 address
+static bool resolve(const char* host, uint16_t port, struct sockaddr_in& address) {
+  std::string target = host;
+  const char* rules = getenv("HOST_RESOLVE");
+  if (rules) {
+    std::string list = rules;
+    size_t start = 0;
+    while (start < list.size()) {
+      size_t end = list.find(',', start);
+      if (end == std::string::npos) end = list.size();
+      std::string rule = list.substr(start, end - start);
+      size_t equals = rule.find('=');
+      if (equals != std::string::npos && rule.compare(0, equals, host) == 0 && equals == strlen(host)) {
+        target = rule.substr(equals + 1);
+        size_t colon = target.rfind(':');
+        if (colon != std::string::npos) {
+          port = atoi(target.c_str() + colon + 1);
+          target.resize(colon);
+        }
+        break;
+      }
+      start = end + 1;
+    }
+  }
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* found = nullptr;
+  if (getaddrinfo(target.c_str(), nullptr, &hints, &found) != 0 || !found) return false;
+  address = *(struct sockaddr_in*)found->ai_addr;
+  address.sin_port = htons(port);
+  freeaddrinfo(found);
+  return true;
+}
+
+WiFiClient::Socket::~Socket() {
+  if (fd >= 0) ::close(fd);
+}
+
+WiFiClient::WiFiClient(int fd) : socket_(std::make_shared<Socket>(fd)) {
+  timeout_ = 5000;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  return connect(ip.toString().c_str(), port);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  stop();
+  timeout_ = 5000;
+  struct sockaddr_in address;
+  if (WiFi.status() != WL_CONNECTED || !resolve(host, port, address)) return 0;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return 0;
+  auto socket = std::make_shared<Socket>(fd);
+  if (::connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    if (errno != EINPROGRESS) return 0;
+    struct pollfd wait = { fd, POLLOUT, 0 };
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (poll(&wait, 1, HOST_CONNECT_TIMEOUT) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 ||
+        error != 0) {
+      return 0;
+    }
+  }
+  socket_ = socket;
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  if (fd() < 0) return 0;
+  size_t sent = 0;
+  unsigned long start = millis();
+  while (sent < size) {
+    ssize_t n = send(fd(), buffer + sent, size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+    unsigned long waited = millis() - start;
+    if (waited >= timeout_) break;
+    struct pollfd wait = { fd(), POLLOUT, 0 };
+    poll(&wait, 1, timeout_ - waited);
+  }
+  return sent;
+}
+
+int WiFiClient::availableForWrite() {
+  if (fd() < 0) return 0;
+  int size = 0;
+  int queued = 0;
+  socklen_t length = sizeof(size);
+  if (getsockopt(fd(), SOL_SOCKET, SO_SNDBUF, &size, &length) != 0 || ioctl(fd(), SIOCOUTQ, &queued) != 0) return 0;
+  // The kernel reports twice the usable size
+  int room = size / 2 - queued;
+  return room <= 0 ? 0 : std::min(room, HOST_TCP_SND_BUF);
+}
+
+int WiFiClient::available() {
+  int pending = 0;
+  if (fd() < 0 || ioctl(fd(), FIONREAD, &pending) != 0) return 0;
+  return pending;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  if (fd() < 0) return -1;
+  ssize_t n = recv(fd(), buffer, size, MSG_DONTWAIT);
+  return n > 0 ? (int)n : (n == 0 ? 0 : -1);
+}
+
+int WiFiClient::peek() {
+  uint8_t c;
+  return fd() >= 0 && recv(fd(), &c, 1, MSG_DONTWAIT | MSG_PEEK) == 1 ? c : -1;
+}
+
+void WiFiClient::stop() {
+  if (socket_ && socket_->fd >= 0) {
+    ::close(socket_->fd);
+    socket_->fd = -1;
+  }
+  socket_.reset();
+}
+
+// Like lwIP, a closed connection still counts as connected while unread
+// data is left
+uint8_t WiFiClient::connected() {
+  if (fd() < 0) return 0;
+  uint8_t c;
+  ssize_t n = recv(fd(), &c, 1, MSG_DONTWAIT | MSG_PEEK);
+  if (n > 0) return 1;
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+IPAddress WiFiClient::remoteIP() {
+  struct sockaddr_in address = {};
+  socklen_t length = sizeof(address);
+  if (fd() < 0 || getpeername(fd(), (struct sockaddr*)&address, &length) != 0) return IPAddress();
+  return IPAddress((uint32_t)address.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::remotePort() {
+  struct sockaddr_in address = {};
+  socklen_t length = sizeof(address);
+  if (fd() < 0 || getpeername(fd(), (struct sockaddr*)&address, &length) != 0) return 0;
+  return ntohs(address.sin_port);
+}
+
+IPAddress WiFiClient::localIP() {
+  return WiFi.localIP();
+}
+
+void WiFiClient::setNoDelay(bool noDelay) {
+  int value = noDelay;
+  if (fd() >= 0) setsockopt(fd(), IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+}
+
+void WiFiServer::begin() {
+  close();
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return;
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(hostPort(port_));
+  const char* bind = getenv("HOST_BIND");
+  if (inet_pton(AF_INET, bind ? bind : "127.0.0.1", &address.sin_addr) != 1 ||
+      ::bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 4) != 0) {
+    fprintf(stderr, "host: cannot listen on port %u: %s\n", hostPort(port_), strerror(errno));
+    ::close(fd);
+    return;
+  }
+  fprintf(stderr, "host: port %u listening on %u\n", port_, hostPort(port_));
+  fd_ = fd;
+}
+
+void WiFiServer::close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+bool WiFiServer::hasClient() {
+  struct pollfd wait = { fd_, POLLIN, 0 };
+  return fd_ >= 0 && poll(&wait, 1, 0) == 1 && (wait.revents & POLLIN);
+}
+
+WiFiClient WiFiServer::accept() {
+  if (fd_ < 0) return WiFiClient();
+  int fd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return WiFiClient();
+  WiFiClient client(fd);
+  if (noDelay_) client.setNoDelay(true);
+  return client;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  if (fd_ < 0) fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 || !ip.isSet()) return 0;
+  ip_ = ip;
+  port_ = port;
+  packet_.clear();
+  return 1;
+}
+
+int WiFiUDP::beginPacket(const char* host, uint16_t port) {
+  struct sockaddr_in address;
+  if (!resolve(host, port, address)) return 0;
+  return beginPacket(IPAddress((uint32_t)address.sin_addr.s_addr), ntohs(address.sin_port));
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+  if (!port_) return 0;
+  packet_.append((const char*)buffer, size);
+  return size;
+}
+
+int WiFiUDP::endPacket() {
+  if (fd_ < 0 || !port_) return 0;
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = (uint32_t)ip_;
+  address.sin_port = htons(port_);
+  ssize_t n = sendto(fd_, packet_.data(), packet_.size(), MSG_DONTWAIT, (struct sockaddr*)&address, sizeof(address));
+  port_ = 0;
+  packet_.clear();
+  return n >= 0;
+}
+
+void WiFiUDP::stop() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
@@ -0,0 +1,111 @@
+#pragma once
+// The station is always up on the host's loopback: begin() "connects" on the
+// next loop() pass. SIGUSR1 drops or restores the link, to exercise the
+// reconnect path. HOST_WIFI_SSID sets the stored network name.
+#include <functional>
+#include <memory>
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+enum wl_status_t {
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_WRONG_PASSWORD = 6,
+  WL_DISCONNECTED = 7
+};
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 };
+
+enum WiFiDisconnectReason {
+  WIFI_DISCONNECT_REASON_UNSPECIFIED = 1,
+  WIFI_DISCONNECT_REASON_ASSOC_LEAVE = 8,
+  WIFI_DISCONNECT_REASON_BEACON_TIMEOUT = 200,
+  WIFI_DISCONNECT_REASON_NO_AP_FOUND = 201
+};
+
+struct WiFiEventStationModeGotIP {
+  IPAddress ip;
+  IPAddress mask;
+  IPAddress gw;
+};
+
+struct WiFiEventStationModeDisconnected {
+  String ssid;
+  uint8_t bssid[6];
+  WiFiDisconnectReason reason;
+};
+
+// Handlers stay registered while the returned handle is held
+struct WiFiEventHandlerOpaque {
+  virtual ~WiFiEventHandlerOpaque() {}
+};
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+class ESP8266WiFiClass {
+public:
+  bool mode(WiFiMode_t mode);
+  WiFiMode_t getMode() const { return mode_; }
+  void persistent(bool persistent) { (void)persistent; }
+  bool setSleepMode(WiFiSleepType_t type) {
+    sleepType_ = type;
+    return true;
+  }
+  WiFiSleepType_t getSleepMode() const { return sleepType_; }
+
+  wl_status_t begin(const char* ssid, const char* psk = nullptr, int32_t channel = 0, const uint8_t* bssid = nullptr,
+                    bool connect = true);
+  wl_status_t begin();
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0,
+              IPAddress dns2 = (uint32_t)0);
+  bool disconnect(bool wifiOff = false);
+  wl_status_t status() const { return status_; }
+  bool isConnected() const { return status_ == WL_CONNECTED; }
+
+  String SSID() const;
+  String psk() const { return psk_; }
+  uint8_t* BSSID();
+  String BSSIDstr();
+  int32_t channel() const { return 6; }
+  int32_t RSSI() const { return status_ == WL_CONNECTED ? -50 : 31; }
+  String macAddress();
+  uint8_t* macAddress(uint8_t* mac);
+  bool hostname(const char* name);
+  bool hostname(const String& name) { return hostname(name.c_str()); }
+  String hostname() const { return hostname_; }
+
+  IPAddress localIP() const;
+  IPAddress subnetMask() const { return IPAddress(255, 0, 0, 0); }
+  IPAddress gatewayIP() const { return IPAddress(127, 0, 0, 1); }
+  IPAddress dnsIP(uint8_t index = 0) const {
+    (void)index;
+    return IPAddress(127, 0, 0, 53);
+  }
+  IPAddress softAPIP() const { return IPAddress(192, 168, 4, 1); }
+
+  WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> handler);
+  WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> handler);
+
+  // Delivers queued events; called by the host main() between loop() passes
+  void serviceEvents();
+
+private:
+  WiFiMode_t mode_ = WIFI_OFF;
+  WiFiSleepType_t sleepType_ = WIFI_MODEM_SLEEP;
+  wl_status_t status_ = WL_DISCONNECTED;
+  bool cleared_ = false;
+  bool pendingConnect_ = false;
+  bool pendingLeave_ = false;
+  bool linkDown_ = false;
+  String psk_;
+  String hostname_;
+};
+
+extern ESP8266WiFiClass WiFi;
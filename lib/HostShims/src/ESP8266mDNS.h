@@ -0,0 +1,22 @@
+#pragma once
+#include "ESP8266WiFi.h"
+
+// The responder is not emulated; use the forwarded ports on localhost
+class MDNSResponder {
+public:
+  bool begin(const char* hostname) {
+    (void)hostname;
+    return true;
+  }
+  bool begin(const String& hostname) { return begin(hostname.c_str()); }
+  bool addService(const String& service, const String& protocol, uint16_t port) {
+    (void)service;
+    (void)protocol;
+    (void)port;
+    return true;
+  }
+  void update() {}
+  void end() {}
+};
+
+extern MDNSResponder MDNS;
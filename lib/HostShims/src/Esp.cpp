@@ -0,0 +1,213 @@
+#include "Arduino.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+EspClass ESP;
+UpdaterClass Update;
+uint32_t hostRtcMemory[128];
+struct rst_info hostResetInfo = { REASON_DEFAULT_RST, 0, 0, 0, 0, 0, 0 };
+extern char** hostArgv;  // Saved by main() for restart()
+
+// The ESP8266 has about 50 KB of heap for the sketch. Report that, less
+// whatever the firmware has allocated since the first call, so leaks show up
+// in the heap metrics the same way.
+static const uint32_t HOST_HEAP_SIZE = 50000;
+
+uint32_t EspClass::getFreeHeap() {
+  static size_t baseline = mallinfo2().uordblks;
+  size_t used = mallinfo2().uordblks;
+  size_t grown = used > baseline ? used - baseline : 0;
+  return grown >= HOST_HEAP_SIZE ? 0 : HOST_HEAP_SIZE - grown;
+}
+
+// Free chunks glibc holds between live allocations can't serve a request
+// bigger than themselves, like the holes in the ESP's heap. Treat the holes
+// added since the first call as that share of the free heap, so the largest
+// block shrinks as they grow; the top of the heap isn't counted as a hole.
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+  static size_t baseline = mallinfo2().fordblks - mallinfo2().keepcost;
+  struct mallinfo2 info = mallinfo2();
+  size_t holes = info.fordblks - info.keepcost;
+  uint64_t grown = holes > baseline ? holes - baseline : 0;
+  uint64_t free = getFreeHeap();
+  return free ? free * free / (free + grown) : 0;
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+  uint32_t free = getFreeHeap();
+  return free ? 100 - (uint64_t)getMaxFreeBlockSize() * 100 / free : 0;
+}
+
+uint32_t EspClass::getChipId() {
+  return (uint32_t)gethostid() & 0xFFFFFF;
+}
+
+// CCOUNT at 80 MHz: 80 cycles per microsecond
+uint32_t EspClass::getCycleCount() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)((uint64_t)now.tv_sec * 80000000u + now.tv_nsec * 2 / 25);
+}
+
+uint32_t EspClass::random() {
+  return ((uint32_t)::random() << 16) ^ (uint32_t)::random();
+}
+
+static uint8_t* flash;
+static long powerBudget = -1;
+static unsigned long eraseUs;
+static unsigned long pageUs;
+
+void hostFlashPowerCut(long budget) {
+  powerBudget = budget;
+}
+
+const uint8_t* hostFlash() {
+  if (flash) return flash;
+  const char* latency = getenv("HOST_FLASH_ERASE_US");
+  eraseUs = latency ? strtoul(latency, nullptr, 10) : 0;
+  latency = getenv("HOST_FLASH_PAGE_US");
+  pageUs = latency ? strtoul(latency, nullptr, 10) : 0;
+  const char* path = getenv("HOST_FLASH_FILE");
+  if (path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+      off_t size = lseek(fd, 0, SEEK_END);
+      if (size < HOST_FLASH_SIZE) {
+        // A new file starts erased
+        uint8_t sector[FLASH_SECTOR_SIZE];
+        memset(sector, 0xFF, sizeof(sector));
+        for (off_t at = size - size % FLASH_SECTOR_SIZE; at < HOST_FLASH_SIZE; at += FLASH_SECTOR_SIZE) {
+          if (pwrite(fd, sector, sizeof(sector), at) != (ssize_t)sizeof(sector)) break;
+        }
+      }
+      void* mapped = mmap(nullptr, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (mapped != MAP_FAILED) return flash = (uint8_t*)mapped;
+    }
+    fprintf(stderr, "host: cannot map HOST_FLASH_FILE %s, using RAM\n", path);
+  }
+  flash = (uint8_t*)malloc(HOST_FLASH_SIZE);
+  memset(flash, 0xFF, HOST_FLASH_SIZE);
+  return flash;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  if ((sector + 1) * FLASH_SECTOR_SIZE > HOST_FLASH_SIZE) return false;
+  hostFlash();
+  if (powerBudget == 0) return true;
+  if (powerBudget > 0) powerBudget--;
+  memset(flash + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+  if (eraseUs) delayMicroseconds(eraseUs);
+  return true;
+}
+
+bool EspClass::flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+  if (address % 4 || size % 4 || address + size > HOST_FLASH_SIZE) return false;
+  hostFlash();
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size && powerBudget != 0; i++) {
+    flash[address + i] &= bytes[i];
+    if (powerBudget > 0) powerBudget--;
+  }
+  if (pageUs && size) delayMicroseconds(pageUs * ((address + size - 1) / 256 - address / 256 + 1));
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t* data, size_t size) {
+  if (address % 4 || address + size > HOST_FLASH_SIZE) return false;
+  memcpy(data, hostFlash() + address, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset * 4 + size > sizeof(hostRtcMemory) || size % 4) return false;
+  memcpy(data, hostRtcMemory + offset, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset * 4 + size > sizeof(hostRtcMemory) || size % 4) return false;
+  memcpy(hostRtcMemory + offset, data, size);
+  return true;
+}
+
+String EspClass::getResetReason() {
+  return String(hostResetInfo.reason == REASON_SOFT_RESTART ? F("Software/System restart") : F("Power On"));
+}
+
+String EspClass::getResetInfo() {
+  return String(F("Fatal exception:0 flag:")) + String(hostResetInfo.reason) + F(" (") + getResetReason() +
+         F(") epc1:0x00000000 epc2:0x00000000 epc3:0x00000000 excvaddr:0x00000000 depc:0x00000000");
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  char path[4096];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (length > 0) {
+    path[length] = '\0';
+    // RTC memory survives a soft restart; hand it to the new process
+    std::string rtc;
+    for (uint32_t word : hostRtcMemory) {
+      char hex[9];
+      snprintf(hex, sizeof(hex), "%08x", word);
+      rtc += hex;
+    }
+    setenv("HOST_RTC_MEMORY", rtc.c_str(), 1);
+    // Sockets are close-on-exec, so the listening ports are free again
+    execv(path, hostArgv);
+  }
+  perror("host: restart");
+  exit(1);
+}
+
+struct rst_info* system_get_rst_info() {
+  return &hostResetInfo;
+}
+
+// Ticks of 23552/4096 = 5.75 us
+uint32_t system_get_rtc_time() {
+  return (uint32_t)((uint64_t)micros() * 4096 / 23552);
+}
+
+uint32_t system_rtc_clock_cali_proc() {
+  return 23552;
+}
+
+bool UpdaterClass::begin(size_t size, int command) {
+  (void)command;
+  size_ = size;
+  progress_ = 0;
+  error_ = size == 0 ? 1 : 0;
+  running_ = !error_;
+  return running_;
+}
+
+size_t UpdaterClass::write(uint8_t* data, size_t length) {
+  (void)data;
+  if (!running_) return 0;
+  if (progress_ + length > size_) {
+    error_ = 2;
+    return 0;
+  }
+  progress_ += length;
+  return length;
+}
+
+bool UpdaterClass::end(bool evenIfRemaining) {
+  (void)evenIfRemaining;
+  running_ = false;
+  if (progress_ == 0) error_ = 3;
+  return !error_;
+}
+
+void UpdaterClass::printError(Print& out) {
+  static const char* const errors[] = { "No Error", "Bad Size Given", "Space Error", "No Data" };
+  out.println(errors[error_ < 4 ? error_ : 0]);
+}
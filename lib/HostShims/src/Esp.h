@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+#include "user_interface.h"
+
+class Print;
+
+// Emulated 4 MB flash chip. HOST_FLASH_FILE names a file it is mapped from,
+// so the KV store survives a restart; otherwise it is erased on every run.
+// Writes can only clear bits, as on NOR flash. HOST_FLASH_ERASE_US and
+// HOST_FLASH_PAGE_US add a latency per sector erase and per 256-byte page
+// programmed, to time flash-bound code against a given chip.
+#define HOST_FLASH_SIZE (4 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE 4096
+// Flash layout of the 4M2M board: filesystem, then the EEPROM sector
+#define FLASH_FS_END 0x3FA000u
+#define FLASH_EEPROM_START 0x3FB000u
+#define FLASH_MAPPED ((const volatile uint32_t*)hostFlash())
+const uint8_t* hostFlash();
+// Power-cut injection for tests: once budget more bytes have been programmed
+// (an erase counts as one), writes and erases are dropped as if the chip had
+// lost power mid-operation. A negative budget restores power.
+void hostFlashPowerCut(long budget);
+
+class EspClass {
+public:
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+  uint32_t getFreeSketchSpace() { return 1024 * 1024; }
+  uint32_t getFlashChipSize() { return HOST_FLASH_SIZE; }
+  uint32_t getChipId();
+  uint8_t getCpuFreqMHz() { return 80; }
+  uint32_t getCycleCount();
+  uint32_t random();
+
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t address, const uint32_t* data, size_t size);
+  bool flashRead(uint32_t address, uint32_t* data, size_t size);
+
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+
+  String getResetReason();
+  String getResetInfo();
+  struct rst_info* getResetInfoPtr() { return system_get_rst_info(); }
+
+  bool eraseConfig() { return true; }
+  // Re-executes the program, so a restart keeps the HOST_* settings and the
+  // flash file but loses everything in RAM, like the real one
+  [[noreturn]] void restart();
+  [[noreturn]] void reset() { restart(); }
+};
+
+extern EspClass ESP;
+
+#define U_FLASH 0
+#define U_FS 100
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+// Accepts and discards an image, so the OTA upload path can be exercised
+class UpdaterClass {
+public:
+  bool begin(size_t size, int command = U_FLASH);
+  size_t write(uint8_t* data, size_t length);
+  bool end(bool evenIfRemaining = false);
+  bool hasError() const { return error_ != 0; }
+  void printError(Print& out);
+  size_t progress() const { return progress_; }
+
+private:
+  size_t size_ = 0;
+  size_t progress_ = 0;
+  bool running_ = false;
+  uint8_t error_ = 0;
+};
+
+extern UpdaterClass Update;
@@ -0,0 +1,193 @@
+#include "FS.h"
+#include "LittleFS.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <unistd.h>
+
+fs::FS LittleFS;
+
+namespace fs {
+
+// The 2 MB filesystem of a 4M2M layout, in 4 KB blocks; LittleFS keeps
+// two blocks for itself and rounds every file up to whole blocks
+static const size_t FS_TOTAL = 2 * 1024 * 1024;
+static const size_t FS_BLOCK = 4096;
+
+static std::string hostPath(const std::string& path) {
+  const char* dir = getenv("HOST_FS_DIR");
+  return dir ? std::string(dir) + path : std::string();
+}
+
+bool FS::begin() {
+  if (mounted_) return true;
+  if (getenv("HOST_FS_FAIL")) return false;
+  const char* dir = getenv("HOST_FS_DIR");
+  if (dir) {
+    DIR* listing = opendir(dir);
+    if (listing) {
+      while (struct dirent* entry = readdir(listing)) {
+        if (entry->d_name[0] == '.') continue;
+        std::string path = std::string("/") + entry->d_name;
+        FILE* file = fopen(hostPath(path).c_str(), "rb");
+        if (!file) continue;
+        auto data = std::make_shared<std::string>();
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) data->append(buf, n);
+        fclose(file);
+        files_[path] = data;
+      }
+      closedir(listing);
+    }
+  }
+  mounted_ = true;
+  return true;
+}
+
+bool FS::format() {
+  for (auto& file : files_) {
+    std::string path = hostPath(file.first);
+    if (!path.empty()) unlink(path.c_str());
+  }
+  files_.clear();
+  return true;
+}
+
+size_t FS::usedBytes() const {
+  size_t used = 2 * FS_BLOCK;
+  for (auto& file : files_) used += (file.second->size() + FS_BLOCK - 1) / FS_BLOCK * FS_BLOCK;
+  return used;
+}
+
+bool FS::info(FSInfo& info) {
+  if (!mounted_) return false;
+  info.totalBytes = FS_TOTAL;
+  info.usedBytes = usedBytes();
+  info.blockSize = FS_BLOCK;
+  info.pageSize = 256;
+  info.maxOpenFiles = 5;
+  info.maxPathLength = 32;
+  return true;
+}
+
+File FS::open(const char* path, const char* mode) {
+  if (!mounted_ || !path || path[0] != '/') return File();
+  auto found = files_.find(path);
+  bool write = mode[0] == 'w' || mode[0] == 'a' || strchr(mode, '+');
+  if (found == files_.end()) {
+    if (mode[0] == 'r') return File();
+    found = files_.emplace(path, std::make_shared<std::string>()).first;
+  } else if (mode[0] == 'w') {
+    found->second->clear();
+  }
+  auto handle = std::make_shared<File::Handle>();
+  handle->fs = this;
+  handle->path = path;
+  handle->data = found->second;
+  handle->readable = mode[0] == 'r' || strchr(mode, '+');
+  handle->writable = write;
+  handle->append = mode[0] == 'a';
+  handle->position = handle->append ? found->second->size() : 0;
+  handle->dirty = mode[0] == 'w';
+  return File(handle);
+}
+
+bool FS::exists(const char* path) {
+  return mounted_ && files_.count(path);
+}
+
+bool FS::remove(const char* path) {
+  if (!mounted_ || !files_.erase(path)) return false;
+  std::string file = hostPath(path);
+  if (!file.empty()) unlink(file.c_str());
+  return true;
+}
+
+bool FS::rename(const char* from, const char* to) {
+  auto found = files_.find(from);
+  if (!mounted_ || found == files_.end()) return false;
+  auto data = found->second;
+  files_.erase(found);
+  files_[to] = data;
+  std::string source = hostPath(from);
+  if (!source.empty()) ::rename(source.c_str(), hostPath(to).c_str());
+  return true;
+}
+
+void FS::store(const std::string& path, const std::string& data) {
+  std::string file = hostPath(path);
+  if (file.empty()) return;
+  std::string temporary = file + ".tmp";
+  FILE* out = fopen(temporary.c_str(), "wb");
+  if (!out) return;
+  bool written = fwrite(data.data(), 1, data.size(), out) == data.size();
+  if (fclose(out) == 0 && written) ::rename(temporary.c_str(), file.c_str());
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+  if (!handle_ || !handle_->writable) return 0;
+  std::string& data = *handle_->data;
+  if (handle_->append) handle_->position = data.size();
+  if (handle_->position > data.size()) data.resize(handle_->position);
+  data.replace(handle_->position, std::min(size, data.size() - handle_->position), (const char*)buffer, size);
+  handle_->position += size;
+  handle_->dirty = true;
+  return size;
+}
+
+int File::available() {
+  if (!handle_ || !handle_->readable) return 0;
+  size_t length = handle_->data->size();
+  return handle_->position < length ? length - handle_->position : 0;
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+  size_t n = std::min(size, (size_t)available());
+  if (!n) return 0;
+  memcpy(buffer, handle_->data->data() + handle_->position, n);
+  handle_->position += n;
+  return n;
+}
+
+int File::peek() {
+  return available() ? (uint8_t)(*handle_->data)[handle_->position] : -1;
+}
+
+bool File::seek(uint32_t position, SeekMode mode) {
+  if (!handle_) return false;
+  long base = mode == SeekSet ? 0 : mode == SeekCur ? (long)handle_->position : (long)handle_->data->size();
+  long target = base + (long)position;
+  if (target < 0 || (size_t)target > handle_->data->size()) return false;
+  handle_->position = target;
+  return true;
+}
+
+void File::Handle::sync() {
+  if (!dirty) return;
+  // Only while the file is still the one at that path
+  auto found = fs->files_.find(path);
+  if (found != fs->files_.end() && found->second == data) fs->store(path, *data);
+  dirty = false;
+}
+
+void File::flush() {
+  if (handle_) handle_->sync();
+}
+
+void File::close() {
+  handle_.reset();
+}
+
+const char* File::name() const {
+  if (!handle_) return "";
+  size_t slash = handle_->path.rfind('/');
+  return handle_->path.c_str() + slash + 1;
+}
+
+}  // namespace fs
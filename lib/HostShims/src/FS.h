@@ -0,0 +1,100 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include "Arduino.h"
+
+namespace fs {
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FS;
+
+class File : public Stream {
+public:
+  File() {}
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override { return handle_ && handle_->writable ? 4096 : 0; }
+  int available() override;
+  int read() override;
+  size_t read(uint8_t* buffer, size_t size);
+  int peek() override;
+  void flush() override;
+  bool seek(uint32_t position, SeekMode mode = SeekSet);
+  size_t position() const { return handle_ ? handle_->position : 0; }
+  size_t size() const { return handle_ ? handle_->data->size() : 0; }
+  void close();
+  const char* name() const;
+  const char* fullName() const { return handle_ ? handle_->path.c_str() : ""; }
+  bool isFile() const { return (bool)handle_; }
+  bool isDirectory() const { return false; }
+  operator bool() const { return (bool)handle_; }
+
+private:
+  friend class FS;
+  // Written back when the last copy of the File is closed or destroyed
+  struct Handle {
+    ~Handle() { sync(); }
+    void sync();
+    FS* fs;
+    std::string path;
+    std::shared_ptr<std::string> data;
+    size_t position;
+    bool readable;
+    bool writable;
+    bool append;
+    bool dirty;
+  };
+  explicit File(std::shared_ptr<Handle> handle) : handle_(handle) {}
+  std::shared_ptr<Handle> handle_;
+};
+
+// Files live in memory. With HOST_FS_DIR set, begin() loads that directory
+// and every close() writes the file back, so the filesystem survives a
+// restart; without it, each run starts with an empty filesystem, as after
+// flashing a blank image. With HOST_FS_FAIL set, begin() fails, as on a
+// corrupt partition.
+class FS {
+public:
+  bool begin();
+  void end() { mounted_ = false; }
+  bool format();
+  bool info(FSInfo& info);
+
+  File open(const char* path, const char* mode);
+  File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+  bool exists(const char* path);
+  bool exists(const String& path) { return exists(path.c_str()); }
+  bool remove(const char* path);
+  bool remove(const String& path) { return remove(path.c_str()); }
+  bool rename(const char* from, const char* to);
+  bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+
+private:
+  friend class File;
+  void store(const std::string& path, const std::string& data);
+  size_t usedBytes() const;
+
+  bool mounted_ = false;
+  std::map<std::string, std::shared_ptr<std::string>> files_;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FSInfo;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
@@ -0,0 +1,45 @@
+#include "HardwareSerial.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c) {
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+// stdin is non-blocking so the firmware can poll it like the UART
+static int readStdin() {
+  static bool configured = false;
+  if (!configured) {
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    configured = true;
+  }
+  uint8_t c;
+  return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int HardwareSerial::peek() {
+  if (peeked_ < 0) peeked_ = readStdin();
+  return peeked_;
+}
+
+int HardwareSerial::available() {
+  return peek() >= 0 ? 1 : 0;
+}
+
+int HardwareSerial::read() {
+  int c = peek();
+  peeked_ = -1;
+  return c;
+}
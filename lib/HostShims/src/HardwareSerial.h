@@ -0,0 +1,24 @@
+#pragma once
+#include "Stream.h"
+
+// Serial is the process's stdin and stdout
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  void setDebugOutput(bool enabled) { (void)enabled; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override { return 4096; }
+  void flush() override;
+  int available() override;
+  int read() override;
+  int peek() override;
+  explicit operator bool() const { return true; }
+
+private:
+  int peeked_ = -1;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,29 @@
+#include "IPAddress.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  uint8_t* p = (uint8_t*)&address_;
+  p[0] = a;
+  p[1] = b;
+  p[2] = c;
+  p[3] = d;
+}
+
+IPAddress::IPAddress(const uint8_t* address) {
+  memcpy(&address_, address, sizeof(address_));
+}
+
+bool IPAddress::fromString(const char* text) {
+  struct in_addr parsed;
+  if (!text || inet_pton(AF_INET, text, &parsed) != 1) return false;
+  address_ = parsed.s_addr;
+  return true;
+}
+
+String IPAddress::toString() const {
+  char text[16];
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes()[0], bytes()[1], bytes()[2], bytes()[3]);
+  return String(text);
+}
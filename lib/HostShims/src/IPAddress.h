@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include "WString.h"
+
+class IPAddress {
+public:
+  IPAddress() : address_(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+  IPAddress(uint32_t address) : address_(address) {}  // Network byte order, as in the core
+  IPAddress(const uint8_t* address);
+
+  operator uint32_t() const { return address_; }
+  bool operator==(const IPAddress& other) const { return address_ == other.address_; }
+  bool operator!=(const IPAddress& other) const { return address_ != other.address_; }
+  uint8_t operator[](int index) const { return bytes()[index]; }
+  uint8_t& operator[](int index) { return ((uint8_t*)&address_)[index]; }
+
+  bool isSet() const { return address_ != 0; }
+  bool fromString(const char* text);
+  bool fromString(const String& text) { return fromString(text.c_str()); }
+  String toString() const;
+
+private:
+  const uint8_t* bytes() const { return (const uint8_t*)&address_; }
+  uint32_t address_;
+};
+
+#define INADDR_NONE IPAddress(0u)
@@ -0,0 +1,40 @@
+#include "Print.h"
+
+#include <stdio.h>
+#include <vector>
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (n < size && write(buffer[n])) n++;
+  return n;
+}
+
+// Formats into a stack buffer, or the heap for long output, then writes once
+static size_t printFormatted(Print& out, const char* fmt, va_list args, bool flash) {
+  char buf[256];
+  va_list copy;
+  va_copy(copy, args);
+  int length = flash ? vsnprintf_P(buf, sizeof(buf), fmt, copy) : vsnprintf(buf, sizeof(buf), fmt, copy);
+  va_end(copy);
+  if (length < 0) return 0;
+  if ((size_t)length < sizeof(buf)) return out.write((const uint8_t*)buf, length);
+  std::vector<char> big(length + 1);
+  flash ? vsnprintf_P(big.data(), big.size(), fmt, args) : vsnprintf(big.data(), big.size(), fmt, args);
+  return out.write((const uint8_t*)big.data(), length);
+}
+
+size_t Print::printf(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  size_t n = printFormatted(*this, fmt, args, false);
+  va_end(args);
+  return n;
+}
+
+size_t Print::printf_P(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  size_t n = printFormatted(*this, fmt, args, true);
+  va_end(args);
+  return n;
+}
@@ -0,0 +1,37 @@
+#include "ArduinoOTA.h"
+#include "ESP8266mDNS.h"
+#include "WiFiManager.h"
+
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+
+bool WiFiManager::startConfigPortal(const char* apName, const char* apPassword) {
+  (void)apPassword;
+  ssid_ = apName ? apName : "";
+  active_ = true;
+  connecting_ = false;
+  if (apCallback_) apCallback_(this);
+  return false;
+}
+
+bool WiFiManager::autoConnect(const char* apName, const char* apPassword) {
+  if (WiFi.SSID().length() == 0) {
+    startConfigPortal(apName, apPassword);
+  } else {
+    WiFi.begin();
+  }
+  for (int pass = 0; pass < 2 && !WiFi.isConnected(); pass++) WiFi.serviceEvents();
+  return WiFi.isConnected();
+}
+
+bool WiFiManager::process() {
+  if (!active_) return false;
+  if (!connecting_) {
+    WiFi.begin();  // Takes effect at the next event service
+    connecting_ = true;
+    return false;
+  }
+  if (!WiFi.isConnected()) return false;
+  active_ = false;
+  return true;
+}
@@ -0,0 +1,56 @@
+#include "Stream.h"
+#include "Arduino.h"
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    delay(1);
+  } while (millis() - start < timeout_);
+  return -1;
+}
+
+int Stream::timedPeek() {
+  unsigned long start = millis();
+  do {
+    int c = peek();
+    if (c >= 0) return c;
+    delay(1);
+  } while (millis() - start < timeout_);
+  return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t n = 0;
+  while (n < length) {
+    int c = timedRead();
+    if (c < 0) break;
+    buffer[n++] = (char)c;
+  }
+  return n;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length) {
+  size_t n = 0;
+  while (n < length) {
+    int c = timedRead();
+    if (c < 0 || c == terminator) break;
+    buffer[n++] = (char)c;
+  }
+  return n;
+}
+
+String Stream::readString() {
+  String text;
+  int c;
+  while ((c = timedRead()) >= 0) text.concat((char)c);
+  return text;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String text;
+  int c;
+  while ((c = timedRead()) >= 0 && c != terminator) text.concat((char)c);
+  return text;
+}
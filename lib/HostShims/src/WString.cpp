@@ -0,0 +1,229 @@
+#include "WString.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static std::string formatInteger(unsigned long long value, bool negative, unsigned char base) {
+  if (base < 2 || base > 36) base = 10;
+  char buf[72];
+  char* p = buf + sizeof(buf);
+  *--p = '\0';
+  do {
+    unsigned digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value);
+  if (negative) *--p = '-';
+  return p;
+}
+
+static std::string formatSigned(long long value, unsigned char base) {
+  // Like the core: only base 10 shows a sign
+  if (base == 10 && value < 0) return formatInteger(0ULL - (unsigned long long)value, true, base);
+  return formatInteger((unsigned long long)value, false, base);
+}
+
+static std::string formatFloat(double value, unsigned char decimals) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+  return buf;
+}
+
+String::String(unsigned char value, unsigned char base) : data_(formatInteger(value, false, base)) {}
+String::String(int value, unsigned char base) : data_(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : data_(formatInteger(value, false, base)) {}
+String::String(long value, unsigned char base) : data_(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : data_(formatInteger(value, false, base)) {}
+String::String(long long value, unsigned char base) : data_(formatSigned(value, base)) {}
+String::String(unsigned long long value, unsigned char base) : data_(formatInteger(value, false, base)) {}
+String::String(float value, unsigned char decimals) : data_(formatFloat(value, decimals)) {}
+String::String(double value, unsigned char decimals) : data_(formatFloat(value, decimals)) {}
+
+String& String::operator=(const char* text) {
+  data_ = text ? text : "";
+  return *this;
+}
+
+String& String::operator=(const __FlashStringHelper* text) {
+  return *this = reinterpret_cast<const char*>(text);
+}
+
+bool String::reserve(unsigned int size) {
+  data_.reserve(size);
+  return true;
+}
+
+bool String::concat(const String& other) {
+  data_ += other.data_;
+  return true;
+}
+
+bool String::concat(const char* text) {
+  if (!text) return false;
+  data_ += text;
+  return true;
+}
+
+bool String::concat(const char* text, unsigned int length) {
+  if (!text) return false;
+  data_.append(text, length);
+  return true;
+}
+
+bool String::concat(const __FlashStringHelper* text) { return concat(reinterpret_cast<const char*>(text)); }
+bool String::concat(char c) {
+  data_ += c;
+  return true;
+}
+bool String::concat(unsigned char value) { return concat(String(value)); }
+bool String::concat(int value) { return concat(String(value)); }
+bool String::concat(unsigned int value) { return concat(String(value)); }
+bool String::concat(long value) { return concat(String(value)); }
+bool String::concat(unsigned long value) { return concat(String(value)); }
+bool String::concat(long long value) { return concat(String(value)); }
+bool String::concat(unsigned long long value) { return concat(String(value)); }
+bool String::concat(float value) { return concat(String(value)); }
+bool String::concat(double value) { return concat(String(value)); }
+
+bool String::equalsIgnoreCase(const String& other) const {
+  return data_.size() == other.data_.size() && strcasecmp(c_str(), other.c_str()) == 0;
+}
+
+bool String::startsWith(const String& prefix) const { return startsWith(prefix, 0); }
+
+bool String::startsWith(const String& prefix, unsigned int offset) const {
+  return offset <= data_.size() && data_.compare(offset, prefix.data_.size(), prefix.data_) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+  return suffix.data_.size() <= data_.size() &&
+         data_.compare(data_.size() - suffix.data_.size(), suffix.data_.size(), suffix.data_) == 0;
+}
+
+void String::setCharAt(unsigned int index, char c) {
+  if (index < data_.size()) data_[index] = c;
+}
+
+char& String::operator[](unsigned int index) {
+  static char dummy;
+  if (index >= data_.size()) {
+    dummy = 0;
+    return dummy;
+  }
+  return data_[index];
+}
+
+void String::getBytes(unsigned char* buf, unsigned int size, unsigned int index) const {
+  if (!size || !buf) return;
+  if (index >= data_.size()) {
+    buf[0] = 0;
+    return;
+  }
+  size_t n = std::min((size_t)size - 1, data_.size() - index);
+  memcpy(buf, data_.data() + index, n);
+  buf[n] = 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t at = data_.find(c, from);
+  return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::indexOf(const String& text, unsigned int from) const {
+  size_t at = data_.find(text.data_, from);
+  return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::lastIndexOf(char c) const {
+  size_t at = data_.rfind(c);
+  return at == std::string::npos ? -1 : (int)at;
+}
+
+int String::lastIndexOf(const String& text) const {
+  size_t at = data_.rfind(text.data_);
+  return at == std::string::npos ? -1 : (int)at;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) std::swap(from, to);
+  if (from >= data_.size()) return String();
+  to = std::min((size_t)to, data_.size());
+  return String(data_.data() + from, to - from);
+}
+
+void String::replace(char find, char with) {
+  for (char& c : data_) {
+    if (c == find) c = with;
+  }
+}
+
+void String::replace(const String& find, const String& with) {
+  if (find.data_.empty()) return;
+  size_t at = 0;
+  while ((at = data_.find(find.data_, at)) != std::string::npos) {
+    data_.replace(at, find.data_.size(), with.data_);
+    at += with.data_.size();
+  }
+}
+
+void String::remove(unsigned int index) {
+  if (index < data_.size()) data_.erase(index);
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if (index < data_.size()) data_.erase(index, count);
+}
+
+void String::toLowerCase() {
+  for (char& c : data_) c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char& c : data_) c = toupper((unsigned char)c);
+}
+
+void String::trim() {
+  size_t first = 0;
+  while (first < data_.size() && isspace((unsigned char)data_[first])) first++;
+  size_t last = data_.size();
+  while (last > first && isspace((unsigned char)data_[last - 1])) last--;
+  data_ = data_.substr(first, last - first);
+}
+
+String operator+(const String& a, const String& b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
+
+String operator+(const String& a, const char* b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
+
+String operator+(const char* a, const String& b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
+
+String operator+(const String& a, const __FlashStringHelper* b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
+
+String operator+(const __FlashStringHelper* a, const String& b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
+
+String operator+(const String& a, char b) {
+  String sum(a);
+  sum.concat(b);
+  return sum;
+}
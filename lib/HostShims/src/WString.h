@@ -0,0 +1,110 @@
+#pragma once
+// Arduino String on top of std::string
+#include <stdlib.h>
+#include <string>
+#include "pgmspace.h"
+
+class String {
+public:
+  String() {}
+  String(const char* text) : data_(text ? text : "") {}
+  String(const char* text, size_t length) : data_(text ? text : "", text ? length : 0) {}
+  String(const __FlashStringHelper* text) : String(reinterpret_cast<const char*>(text)) {}
+  String(const String& other) = default;
+  String(String&& other) = default;
+  explicit String(char c) : data_(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(long long value, unsigned char base = 10);
+  explicit String(unsigned long long value, unsigned char base = 10);
+  explicit String(float value, unsigned char decimals = 2);
+  explicit String(double value, unsigned char decimals = 2);
+
+  String& operator=(const String& other) = default;
+  String& operator=(String&& other) = default;
+  String& operator=(const char* text);
+  String& operator=(const __FlashStringHelper* text);
+
+  bool reserve(unsigned int size);
+  unsigned int length() const { return data_.size(); }
+  bool isEmpty() const { return data_.empty(); }
+  const char* c_str() const { return data_.c_str(); }
+  char* begin() { return &data_[0]; }
+  char* end() { return begin() + data_.size(); }
+  const char* begin() const { return data_.data(); }
+  const char* end() const { return data_.data() + data_.size(); }
+
+  bool concat(const String& other);
+  bool concat(const char* text);
+  bool concat(const char* text, unsigned int length);
+  bool concat(const __FlashStringHelper* text);
+  bool concat(char c);
+  bool concat(unsigned char value);
+  bool concat(int value);
+  bool concat(unsigned int value);
+  bool concat(long value);
+  bool concat(unsigned long value);
+  bool concat(long long value);
+  bool concat(unsigned long long value);
+  bool concat(float value);
+  bool concat(double value);
+  template <typename T>
+  String& operator+=(const T& value) {
+    concat(value);
+    return *this;
+  }
+
+  int compareTo(const String& other) const { return data_.compare(other.data_); }
+  bool equals(const String& other) const { return data_ == other.data_; }
+  bool equals(const char* text) const { return data_ == (text ? text : ""); }
+  bool equalsIgnoreCase(const String& other) const;
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator==(const char* text) const { return equals(text); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool operator!=(const char* text) const { return !equals(text); }
+  bool operator<(const String& other) const { return compareTo(other) < 0; }
+  bool startsWith(const String& prefix) const;
+  bool startsWith(const String& prefix, unsigned int offset) const;
+  bool endsWith(const String& suffix) const;
+
+  char charAt(unsigned int index) const { return index < data_.size() ? data_[index] : 0; }
+  void setCharAt(unsigned int index, char c);
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index);
+  void getBytes(unsigned char* buf, unsigned int size, unsigned int index = 0) const;
+  void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const {
+    getBytes((unsigned char*)buf, size, index);
+  }
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String& text, unsigned int from = 0) const;
+  int lastIndexOf(char c) const;
+  int lastIndexOf(const String& text) const;
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const;
+
+  void replace(char find, char with);
+  void replace(const String& find, const String& with);
+  void remove(unsigned int index);
+  void remove(unsigned int index, unsigned int count);
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return atof(c_str()); }
+  double toDouble() const { return atof(c_str()); }
+
+private:
+  std::string data_;
+};
+
+String operator+(const String& a, const String& b);
+String operator+(const String& a, const char* b);
+String operator+(const char* a, const String& b);
+String operator+(const String& a, const __FlashStringHelper* b);
+String operator+(const __FlashStringHelper* a, const String& b);
+String operator+(const String& a, char b);
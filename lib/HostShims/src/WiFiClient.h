@@ -0,0 +1,47 @@
+#pragma once
+#include <memory>
+#include "Client.h"
+
+// A TCP connection on a real socket. Copies share the connection, which is
+// closed by stop() or when the last copy goes away, as with the core's
+// reference-counted ClientContext.
+//
+// HOST_RESOLVE redirects connections by name or address, so the firmware's
+// fixed endpoints can point at local services:
+//   HOST_RESOLVE=ntfy.sh=127.0.0.1:8081,192.168.1.10=127.0.0.1:1883
+class WiFiClient : public Client {
+public:
+  WiFiClient() { timeout_ = 5000; }
+  explicit WiFiClient(int fd);
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  int connect(const String& host, uint16_t port) { return connect(host.c_str(), port); }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buffer, size_t size) override;
+  int read(char* buffer, size_t size) { return read((uint8_t*)buffer, size); }
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+  IPAddress remoteIP();
+  uint16_t remotePort();
+  IPAddress localIP();
+  void setNoDelay(bool noDelay);
+
+private:
+  struct Socket {
+    explicit Socket(int fd) : fd(fd) {}
+    ~Socket();
+    int fd;
+  };
+  int fd() const { return socket_ ? socket_->fd : -1; }
+  std::shared_ptr<Socket> socket_;
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include "WiFiClient.h"
+
+// No TLS on the host: connections are plain TCP, so point HOST_RESOLVE at a
+// local plain-text endpoint
+namespace BearSSL {
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setInsecure() {}
+  void setBufferSizes(int receive, int transmit) {
+    (void)receive;
+    (void)transmit;
+  }
+};
+
+}  // namespace BearSSL
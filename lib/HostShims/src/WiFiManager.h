@@ -0,0 +1,27 @@
+#pragma once
+#include <functional>
+#include "ESP8266WiFi.h"
+
+// The config portal closes as soon as it is serviced, connected to the
+// host network, as if the user had submitted the stored credentials
+class WiFiManager {
+public:
+  void setAPCallback(std::function<void(WiFiManager*)> callback) { apCallback_ = callback; }
+  void setSaveConfigCallback(std::function<void()> callback) { (void)callback; }
+  void setConnectTimeout(unsigned long seconds) { (void)seconds; }
+  void setConfigPortalTimeout(unsigned long seconds) { (void)seconds; }
+  void setConfigPortalBlocking(bool blocking) { (void)blocking; }
+
+  bool startConfigPortal(const char* apName, const char* apPassword = nullptr);
+  bool autoConnect(const char* apName = nullptr, const char* apPassword = nullptr);
+  bool process();
+  bool getConfigPortalActive() const { return active_; }
+  String getConfigPortalSSID() const { return ssid_; }
+  void resetSettings() { WiFi.disconnect(true); }
+
+private:
+  std::function<void(WiFiManager*)> apCallback_;
+  String ssid_;
+  bool active_ = false;
+  bool connecting_ = false;
+};
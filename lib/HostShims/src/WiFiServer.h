@@ -0,0 +1,31 @@
+#pragma once
+#include "WiFiClient.h"
+
+// Listens on 127.0.0.1 (or HOST_BIND) at the firmware's port plus
+// HOST_PORT_OFFSET, 8000 by default: port 80 is 8080 and telnet is 8023
+class WiFiServer {
+public:
+  explicit WiFiServer(uint16_t port) : port_(port) {}
+  ~WiFiServer() { close(); }
+
+  void begin();
+  void begin(uint16_t port) {
+    port_ = port;
+    begin();
+  }
+  void close();
+  void stop() { close(); }
+  bool hasClient();
+  WiFiClient accept();
+  WiFiClient available() { return accept(); }
+  void setNoDelay(bool noDelay) { noDelay_ = noDelay; }
+  uint8_t status() const { return fd_ >= 0 ? 1 : 0; }
+  uint16_t port() const { return port_; }
+
+private:
+  uint16_t port_;
+  int fd_ = -1;
+  bool noDelay_ = false;
+};
+
+uint16_t hostPort(uint16_t port);
@@ -0,0 +1,21 @@
+#pragma once
+#include "Arduino.h"
+
+// Send side of the core's WiFiUDP: one datagram per beginPacket()/endPacket()
+class WiFiUDP : public Print {
+public:
+  ~WiFiUDP() { stop(); }
+  int beginPacket(IPAddress ip, uint16_t port);
+  int beginPacket(const char* host, uint16_t port);
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int endPacket();
+  void stop();
+
+private:
+  int fd_ = -1;
+  IPAddress ip_;
+  uint16_t port_ = 0;
+  std::string packet_;
+};
@@ -0,0 +1,63 @@
+#include "pgmspace.h"
+
+#include <stdio.h>
+#include <string>
+
+// Copies fmt with every %S conversion turned into %s
+static std::string flashFormat(const char* fmt) {
+  std::string out(fmt);
+  for (size_t i = 0; i < out.size(); i++) {
+    if (out[i] != '%') continue;
+    size_t j = i + 1;
+    while (j < out.size() && strchr("-+ #0123456789.*hlLqjzt", out[j])) j++;
+    if (j < out.size() && out[j] == 'S') out[j] = 's';
+    i = j;
+  }
+  return out;
+}
+
+int vsnprintf_P(char* out, size_t size, const char* fmt, va_list args) {
+  return vsnprintf(out, size, flashFormat(fmt).c_str(), args);
+}
+
+int snprintf_P(char* out, size_t size, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int length = vsnprintf_P(out, size, fmt, args);
+  va_end(args);
+  return length;
+}
+
+int sprintf_P(char* out, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int length = vsprintf(out, flashFormat(fmt).c_str(), args);
+  va_end(args);
+  return length;
+}
+
+int printf_P(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int length = vprintf(flashFormat(fmt).c_str(), args);
+  va_end(args);
+  return length;
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* dst, const char* src, size_t size) {
+  size_t length = strlen(src);
+  if (size) {
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return length;
+}
+
+size_t strlcat(char* dst, const char* src, size_t size) {
+  size_t used = strnlen(dst, size);
+  if (used == size) return size + strlen(src);
+  return used + strlcpy(dst + used, src, size - used);
+}
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+// Flash access on the host: PROGMEM data is ordinary memory, so the _P
+// functions are the plain ones. The printf family rewrites %S (a flash
+// string on the ESP8266, a wide string in glibc) to %s first.
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PGM_VOID_P const void*
+#define PSTR(s) (s)
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_float(addr) (*(const float*)(addr))
+#define pgm_read_ptr(addr) (*(const void* const*)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word_near(addr) pgm_read_word(addr)
+#define pgm_read_dword_near(addr) pgm_read_dword(addr)
+
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strnlen_P strnlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcat_P strcat
+#define strncat_P strncat
+#define strstr_P strstr
+#define strchr_P strchr
+#define strrchr_P strrchr
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* dst, const char* src, size_t size);
+size_t strlcat(char* dst, const char* src, size_t size);
+#endif
+#define strlcpy_P strlcpy
+#define strlcat_P strlcat
+
+int vsnprintf_P(char* out, size_t size, const char* fmt, va_list args);
+int snprintf_P(char* out, size_t size, const char* fmt, ...);
+int sprintf_P(char* out, const char* fmt, ...);
+int printf_P(const char* fmt, ...);
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+enum rst_reason {
+  REASON_DEFAULT_RST = 0,
+  REASON_WDT_RST = 1,
+  REASON_EXCEPTION_RST = 2,
+  REASON_SOFT_WDT_RST = 3,
+  REASON_SOFT_RESTART = 4,
+  REASON_DEEP_SLEEP_AWAKE = 5,
+  REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info {
+  uint32_t reason;
+  uint32_t exccause;
+  uint32_t epc1;
+  uint32_t epc2;
+  uint32_t epc3;
+  uint32_t excvaddr;
+  uint32_t depc;
+};
+
+// RTC clock: ticks of about 5.75 us; calibration is us per tick in Q12
+uint32_t system_get_rtc_time();
+uint32_t system_rtc_clock_cali_proc();
+struct rst_info* system_get_rst_info();
@@ -8,11 +8,16 @@
 #include <ArduinoJson.h>
 #include <WiFiManager.h>
 #include <algorithm>
+#include <type_traits>
 #include <ESP8266HTTPClient.h>  // for ntfy notifications
 #include <WiFiClientSecureBearSSL.h>
+#include <user_interface.h>  // RTC clock for warm-start detection
+#include <WiFiUdp.h>          // syslog
 
-// Forward declaration for printBoth
-void printBoth(const String& msg);
+// Override with -DFIRMWARE_VERSION=\"x.y.z\" in build_flags for releases
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION __DATE__ " " __TIME__
+#endif
 
 // Forward declaration for publishDiscoveryConfig
 void publishDiscoveryConfig();
@@ -21,7 +26,6 @@ void publishDiscoveryConfig();
 void publishMQTTData(float gasValue);
 
 WiFiServer telnetServer(23);
-WiFiClient telnetClient;
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
 ESP8266WebServer server(80);
@@ -36,88 +40,567 @@ struct Config {
   char deviceName[40];
   int mqttPort;
   bool mqttEnabled;
-  int thresholdLimit = 200;       // ppm
-  int thresholdDuration = 10;    // seconds
+  int thresholdLimit;       // ppm
+  int thresholdDuration;    // seconds
   char topicName[16];       // ntfy topic (6 alphanumeric chars)
   bool ntfyEnabled;         // Enable/disable ntfy notifications
-  int baseGasValue = -1;    // Base gas value for calibration, -1 means not set
-  int restartCounter = 0;   // Counter for quick restarts
+  int baseGasValue;         // Base gas value for calibration, -1 means not set
+  int powerMode;            // PowerMode
+  char syslogServer[40];    // Collector IP address, empty to disable
+  int syslogPort;
+  int syslogLevel;          // Highest log level sent to syslog
 };
 
-struct MQTTConfig {
-    char mqtt_server[40] = "";
-    int mqtt_port = 1883;
-    char mqtt_user[32] = "";
-    char mqtt_password[32] = "";
-    bool isEmpty() const { return mqtt_server[0] == '\0' || mqtt_port == 0; }
+Config config;
+
+// Config schema: one row per setting. Defaults, JSON load/save, the settings
+// form, form argument parsing and range validation are all generated from
+// this table, so adding a setting means adding a Config member and a row here.
+enum ConfigFieldType : uint8_t { CFG_STR, CFG_INT, CFG_BOOL };
+
+enum ConfigFieldFlags : uint8_t {
+  CFG_PERSIST  = 1 << 0,  // Stored in /config.json
+  CFG_FORM     = 1 << 1,  // Shown on the settings form
+  CFG_READONLY = 1 << 2,  // Shown on the form but not editable
+  CFG_SECRET   = 1 << 3,  // Password input, masked in logs
+  CFG_MQTT     = 1 << 4,  // Inside the collapsible MQTT settings block
+  CFG_TOGGLE   = 1 << 5   // Checkbox that shows/hides the MQTT settings block
 };
-MQTTConfig mqttConfig;
 
-Config config;
+struct ConfigField {
+  const char* name;     // JSON key and form field name (PROGMEM)
+  const char* label;    // Form label (PROGMEM)
+  uint16_t offset;      // Offset of the member in Config
+  uint8_t size;         // Size of the member in Config
+  ConfigFieldType type;
+  uint8_t flags;        // ConfigFieldFlags
+  int32_t minValue;     // Valid range for CFG_INT fields
+  int32_t maxValue;
+  int32_t defaultValue; // Default for CFG_INT/CFG_BOOL fields, strings default to ""
+};
 
-void setDefaultMQTTConfig() {
-    memset(&mqttConfig, 0, sizeof(MQTTConfig));
-    mqttConfig.mqtt_port = 1883;
+//     name               label                        type      flags                                   min  max    default
+#define CONFIG_FIELDS(X) \
+  X(deviceName,        "Device Name",               CFG_STR,  CFG_PERSIST | CFG_FORM,                 0,  0,     0)    \
+  X(mqttEnabled,       "Enable MQTT",               CFG_BOOL, CFG_PERSIST | CFG_FORM | CFG_TOGGLE,    0,  1,     0)    \
+  X(mqttServer,        "MQTT Server",               CFG_STR,  CFG_PERSIST | CFG_FORM | CFG_MQTT,      0,  0,     0)    \
+  X(mqttUser,          "MQTT User",                 CFG_STR,  CFG_PERSIST | CFG_FORM | CFG_MQTT,      0,  0,     0)    \
+  X(mqttPassword,      "MQTT Password",             CFG_STR,  CFG_PERSIST | CFG_FORM | CFG_MQTT | CFG_SECRET, 0, 0, 0) \
+  X(mqttPort,          "MQTT Port",                 CFG_INT,  CFG_PERSIST | CFG_FORM | CFG_MQTT,      1,  65535, 1883) \
+  X(thresholdLimit,    "Gas Threshold (ppm)",       CFG_INT,  CFG_PERSIST | CFG_FORM,                 0,  1023,  200)  \
+  X(thresholdDuration, "Duration (s)",              CFG_INT,  CFG_PERSIST | CFG_FORM,                 1,  3600,  10)   \
+  X(ntfyEnabled,       "Enable NTFY Notifications", CFG_BOOL, CFG_PERSIST | CFG_FORM,                 0,  1,     1)    \
+  X(topicName,         "Notification Topic",        CFG_STR,  CFG_FORM | CFG_READONLY,                0,  0,     0)    \
+  X(baseGasValue,      "Base Gas Value",            CFG_INT,  CFG_PERSIST,                            -1, 1023,  -1)    \
+  X(powerMode,         "Power Mode (0=Off, 1=Modem Sleep, 2=Light Sleep)", CFG_INT, CFG_PERSIST | CFG_FORM, 0, 2, 0) \
+  X(syslogServer,      "Syslog Server (IP)",        CFG_STR,  CFG_PERSIST | CFG_FORM,                 0,  0,     0)    \
+  X(syslogPort,        "Syslog Port",               CFG_INT,  CFG_PERSIST | CFG_FORM,                 1,  65535, 514)  \
+  X(syslogLevel,       "Syslog Level (1=Error, 2=Warn, 3=Info, 4=Debug)", CFG_INT, CFG_PERSIST | CFG_FORM, 0, 4, 3)
+
+#define CONFIG_FIELD_STRINGS(name, label, ...) \
+  static const char CFG_NAME_##name[] PROGMEM = #name; \
+  static const char CFG_LABEL_##name[] PROGMEM = label;
+CONFIG_FIELDS(CONFIG_FIELD_STRINGS)
+
+#define CONFIG_FIELD_ROW(name, label, type, flags, minValue, maxValue, defaultValue) \
+  { CFG_NAME_##name, CFG_LABEL_##name, offsetof(Config, name), sizeof(Config::name), \
+    type, (uint8_t)(flags), minValue, maxValue, defaultValue },
+static constexpr ConfigField CONFIG_SCHEMA[] PROGMEM = { CONFIG_FIELDS(CONFIG_FIELD_ROW) };
+const size_t CONFIG_SCHEMA_SIZE = sizeof(CONFIG_SCHEMA) / sizeof(CONFIG_SCHEMA[0]);
+
+// Schema rows live in flash, which only supports aligned 32-bit reads
+ConfigField readConfigField(size_t index) {
+  ConfigField field;
+  memcpy_P(&field, &CONFIG_SCHEMA[index], sizeof(field));
+  return field;
 }
 
-void loadMQTTConfig() {
-    if (!LittleFS.begin()) {
-        printBoth(F("Failed to mount file system"));
-        setDefaultMQTTConfig();
-        return;
-    }
-    if (!LittleFS.exists("/mqtt_config.json")) {
-        printBoth(F("No MQTT config file found"));
-        setDefaultMQTTConfig();
-        return;
-    }
-    File configFile = LittleFS.open("/mqtt_config.json", "r");
-    if (!configFile) {
-        printBoth(F("Failed to open MQTT config file"));
-        setDefaultMQTTConfig();
-        return;
-    }
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, configFile);
-    configFile.close();
-    if (error) {
-        printBoth(F("Failed to parse MQTT config file"));
-        setDefaultMQTTConfig();
-        return;
-    }
-    if (doc.containsKey(F("server")) && doc.containsKey(F("port"))) {
-        strncpy(mqttConfig.mqtt_server, doc[F("server")], sizeof(mqttConfig.mqtt_server) - 1);
-        mqttConfig.mqtt_port = doc[F("port")].as<int>();
-        if (doc.containsKey(F("user"))) {
-            strncpy(mqttConfig.mqtt_user, doc[F("user")], sizeof(mqttConfig.mqtt_user) - 1);
-        }
-        if (doc.containsKey(F("password"))) {
-            strncpy(mqttConfig.mqtt_password, doc[F("password")], sizeof(mqttConfig.mqtt_password) - 1);
-        }
-    } else {
-        setDefaultMQTTConfig();
+void* configFieldPtr(Config& cfg, const ConfigField& field) {
+  return (uint8_t*)&cfg + field.offset;
+}
+
+bool mqttConfigMissing() {
+  return config.mqttServer[0] == '\0' || config.mqttPort == 0;
+}
+
+// RTC user memory layout, in 4-byte blocks. RTC memory survives resets but
+// not power loss. The first 32 blocks are used by the OTA bootloader (eboot
+// command), so our records start after them.
+#define RTC_BOOT_STATE_OFFSET 32
+#define RTC_WARM_STATE_OFFSET 36
+#define RTC_WIFI_CACHE_OFFSET 57
+#define RTC_CRUMB_OFFSET 65
+#define RTC_STALL_OFFSET 66
+
+#define RTC_BOOT_STATE_MAGIC 0x47444253 // "GDBS"
+
+// Transient boot flags kept alongside the quick-restart counter
+enum BootFlags : uint16_t {
+  BOOT_FLAG_CALIBRATION_RESET = 1 << 0  // 3x restart recalibration already done
+};
+
+struct RtcBootState {
+  uint32_t magic;
+  uint32_t crc;             // CRC32 of the fields below
+  uint16_t restartCounter;  // Counter for quick restarts
+  uint16_t flags;           // BootFlags
+};
+RtcBootState rtcBootState;
+
+// Standard CRC-32. Pass the previous result as crc to checksum data in pieces.
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc = ~crc;
+  while (length--) {
+    crc ^= *bytes++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
     }
+  }
+  return ~crc;
 }
 
-void saveMQTTConfig() {
-    if (!LittleFS.begin()) {
-        printBoth(F("Failed to mount file system"));
-        return;
+uint32_t rtcBootStateCrc() {
+  return crc32(&rtcBootState.restartCounter, sizeof(RtcBootState) - offsetof(RtcBootState, restartCounter));
+}
+
+// Event tracer. While armed, begin/end/instant records with a 16-bit event
+// ID and the CPU cycle counter go into a RAM ring, oldest overwritten first.
+// Task runs, crumb sections and a few marked calls are traced; GET /trace
+// downloads the ring and tools/trace_to_chrome.py turns it into Chrome trace
+// JSON for Perfetto or chrome://tracing. Main context only, not ISR safe.
+#define TRACE_RECORDS 1024          // 8 KB, allocated on the first run
+const uint32_t TRACE_MIN_RUN_US = 1000; // Shorter runs of fast tasks aren't traced
+
+enum TraceEventBase : uint16_t {
+  TRACE_TASK = 0x0000,    // + task id
+  TRACE_SECTION = 0x0100, // + CrumbSection
+  TRACE_MARK = 0x0200     // + TraceMark
+};
+
+enum TraceMark : uint8_t {
+  MARK_HTTP_POST,
+  MARK_ADC_READ,
+  MARK_BUZZER,            // arg: new buzzer level
+  MARK_COUNT
+};
+
+enum TracePhase : uint8_t { TRACE_BEGIN = 'B', TRACE_END = 'E', TRACE_INSTANT = 'I' };
+
+struct TraceRecord {
+  uint32_t cycles;
+  uint16_t id;
+  uint8_t phase;
+  uint8_t arg;
+};
+
+struct Tracer {
+  TraceRecord* ring;
+  bool active;
+  uint32_t written;       // Total records; the ring holds the last TRACE_RECORDS
+  unsigned long stopAt;
+  unsigned long seconds;
+};
+
+Tracer tracer = {};
+
+inline void traceRecord(uint16_t id, uint8_t phase, uint8_t arg = 0, uint32_t cycles = ESP.getCycleCount()) {
+  if (!tracer.active) return;
+  TraceRecord& record = tracer.ring[tracer.written % TRACE_RECORDS];
+  record.cycles = cycles;
+  record.id = id;
+  record.phase = phase;
+  record.arg = arg;
+  tracer.written++;
+}
+
+inline void traceBegin(uint16_t id) { traceRecord(id, TRACE_BEGIN); }
+inline void traceEnd(uint16_t id) { traceRecord(id, TRACE_END); }
+inline void traceMark(TraceMark mark, uint8_t arg = 0) { traceRecord(TRACE_MARK + mark, TRACE_INSTANT, arg); }
+
+// Software watchdog. Every task run leaves a breadcrumb in RTC memory, and a
+// timer1 interrupt tracks how long the current one has been running. A run
+// over its budget is recorded in RTC memory from the ISR, with the
+// interrupted PC and the ISR's own stack pointer, so it survives the reset
+// that usually follows and can be reported on the next boot. That SP sits
+// below the interrupted code's by the interrupt frame and the handler
+// frames, so it only locates the stack approximately. The ISR writes RTC memory
+// directly (user block n is at 0x60001200 + 4n); the SDK calls are not IRAM
+// safe.
+#ifndef RTC_USER_MEM
+#define RTC_USER_MEM ((volatile uint32_t*)0x60001200)
+#endif
+#define CRUMB_MAGIC 0xC7B0
+#define CRUMB_SCHEDULER 0xFE // Between tasks
+#define CRUMB_SETUP 0xFF
+#define RTC_STALL_MAGIC 0x47445354 // "GDST"
+const uint32_t WDT_TICK_MS = 100;
+
+// Finer-grained marks inside a task, for the calls most likely to hang
+enum CrumbSection : uint8_t {
+  SECTION_NONE,
+  SECTION_MQTT_CONNECT,
+  SECTION_NOTIFY,
+  SECTION_COUNT
+};
+
+struct RtcStallRecord {
+  uint32_t magic;
+  uint32_t crumb;       // Breadcrumb of the stalled run
+  uint32_t durationMs;  // Grows until the run ends or the chip resets
+  uint32_t isrSp;       // SP inside the ISR at the last tick (approximate)
+  uint32_t pc;          // Interrupted PC at the last tick
+};
+
+volatile uint32_t wdtCrumb = ((uint32_t)CRUMB_MAGIC << 16) | CRUMB_SETUP;
+volatile uint32_t wdtElapsedMs = 0;
+volatile uint32_t wdtBudgetMs = 0; // 0 disables the check for this run
+volatile bool wdtStalled = false;
+
+// What the previous run left behind, reported once after boot
+struct PostMortem {
+  uint32_t resetReason;
+  uint32_t crumb;         // Breadcrumb at reset, 0 if unknown
+  RtcStallRecord stall;   // magic is 0 if no stall was recorded
+};
+PostMortem postMortem;
+bool postMortemPending = false; // Not yet published over MQTT
+
+void setCrumb(uint8_t task, uint32_t budgetMs) {
+  uint32_t crumb = ((uint32_t)CRUMB_MAGIC << 16) | task;
+  wdtBudgetMs = 0;
+  wdtElapsedMs = 0;
+  wdtStalled = false;
+  wdtCrumb = crumb;
+  wdtBudgetMs = budgetMs;
+  RTC_USER_MEM[RTC_CRUMB_OFFSET] = crumb;
+}
+
+void setCrumbSection(CrumbSection section) {
+  uint8_t previous = (wdtCrumb >> 8) & 0xFF;
+  if (previous != SECTION_NONE) traceEnd(TRACE_SECTION + previous);
+  if (section != SECTION_NONE) traceBegin(TRACE_SECTION + section);
+  uint32_t crumb = (wdtCrumb & 0xFFFF00FF) | ((uint32_t)section << 8);
+  wdtCrumb = crumb;
+  RTC_USER_MEM[RTC_CRUMB_OFFSET] = crumb;
+}
+
+// For long operations that are expected, like a firmware upload
+void suspendWatchdog() {
+  wdtBudgetMs = 0;
+}
+
+// Sampling profiler. While armed, timer1 runs at about 1 kHz and each tick
+// counts the interrupted PC, tagged with the running task, in an
+// open-addressing hash table. tools/profile_symbolize.py turns a dump into
+// a flat profile and folded stacks. Code running with interrupts disabled
+// is not sampled.
+#define PROFILE_SLOTS 512         // 4 KB, allocated on the first run
+#define PROFILE_PERIOD_US 997     // Prime, so it doesn't alias with 1 ms work
+#define PROFILE_MAX_PROBES 8
+#define PROFILE_COUNT_MASK 0x00FFFFFF
+
+struct ProfileSlot {
+  uint32_t pc;
+  uint32_t taskAndCount;  // Breadcrumb task in the top 8 bits
+};
+
+struct Profiler {
+  ProfileSlot* table;
+  volatile bool active;
+  volatile uint32_t samples;
+  volatile uint32_t dropped;  // Table full around this PC
+  unsigned long stopAt;
+  unsigned long seconds;
+};
+
+Profiler profiler = {};
+volatile uint32_t timerPeriodUs = WDT_TICK_MS * 1000;
+uint32_t timerAccumUs = 0;
+
+void IRAM_ATTR profilerRecord(uint32_t pc) {
+  uint32_t task = wdtCrumb & 0xFF;
+  uint32_t slot = ((pc >> 2) * 2654435761u ^ task) % PROFILE_SLOTS;
+  profiler.samples++;
+  for (uint8_t probe = 0; probe < PROFILE_MAX_PROBES; probe++) {
+    ProfileSlot& entry = profiler.table[slot];
+    if (entry.pc == 0) {
+      entry.pc = pc;
+      entry.taskAndCount = (task << 24) | 1;
+      return;
     }
-    StaticJsonDocument<200> doc;
-    doc[F("server")] = mqttConfig.mqtt_server;
-    doc[F("port")] = mqttConfig.mqtt_port;
-    doc[F("user")] = mqttConfig.mqtt_user;
-    doc[F("password")] = mqttConfig.mqtt_password;
-    File configFile = LittleFS.open("/mqtt_config.json", "w");
-    if (!configFile) {
-        printBoth(F("Failed to open MQTT config file for writing"));
-        return;
+    if (entry.pc == pc && (entry.taskAndCount >> 24) == task) {
+      if ((entry.taskAndCount & PROFILE_COUNT_MASK) != PROFILE_COUNT_MASK) entry.taskAndCount++;
+      return;
     }
-    if (serializeJson(doc, configFile) == 0) {
-        printBoth(F("Failed to write MQTT config file"));
+    slot = (slot + 1) % PROFILE_SLOTS;
+  }
+  profiler.dropped++;
+}
+
+void IRAM_ATTR watchdogTick(uint32_t pc) {
+  uint32_t elapsed = wdtElapsedMs + WDT_TICK_MS;
+  wdtElapsedMs = elapsed;
+  if (wdtBudgetMs == 0 || elapsed <= wdtBudgetMs) return;
+
+  uint32_t isrSp;
+#ifdef __XTENSA__
+  __asm__ __volatile__("mov %0, a1" : "=r"(isrSp));
+#else
+  isrSp = (uint32_t)(uintptr_t)__builtin_frame_address(0);
+#endif
+  volatile uint32_t* record = RTC_USER_MEM + RTC_STALL_OFFSET;
+  if (!wdtStalled) {
+    wdtStalled = true;
+    record[offsetof(RtcStallRecord, crumb) / 4] = wdtCrumb;
+    record[offsetof(RtcStallRecord, magic) / 4] = RTC_STALL_MAGIC;
+  }
+  record[offsetof(RtcStallRecord, durationMs) / 4] = elapsed;
+  record[offsetof(RtcStallRecord, isrSp) / 4] = isrSp;
+  record[offsetof(RtcStallRecord, pc) / 4] = pc;
+}
+
+// Shared by the watchdog and the profiler. EPC1 holds the PC the level 1
+// interrupt was taken at.
+void IRAM_ATTR timer1Isr() {
+  uint32_t pc;
+#ifdef __XTENSA__
+  __asm__ __volatile__("rsr %0, epc1" : "=r"(pc));
+#else
+  pc = (uint32_t)(uintptr_t)__builtin_return_address(0);
+#endif
+  if (profiler.active) profilerRecord(pc);
+  timerAccumUs += timerPeriodUs;
+  if (timerAccumUs >= WDT_TICK_MS * 1000) {
+    timerAccumUs -= WDT_TICK_MS * 1000;
+    watchdogTick(pc);
+  }
+}
+
+void setTimerPeriod(uint32_t periodUs) {
+  timerPeriodUs = periodUs;
+  timer1_write(periodUs * 5);  // 5 MHz after the /16 prescaler
+}
+
+void startWatchdog() {
+  setCrumb(CRUMB_SETUP, 0);
+  timer1_attachInterrupt(timer1Isr);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  setTimerPeriod(WDT_TICK_MS * 1000);
+}
+
+// Starts a fresh profile; taskProfiler() stops it after the given time
+bool startProfiler(unsigned long seconds) {
+  if (profiler.active) return false;
+  if (!profiler.table) {
+    profiler.table = (ProfileSlot*)malloc(sizeof(ProfileSlot) * PROFILE_SLOTS);
+    if (!profiler.table) return false;
+  }
+  memset(profiler.table, 0, sizeof(ProfileSlot) * PROFILE_SLOTS);
+  profiler.samples = 0;
+  profiler.dropped = 0;
+  profiler.seconds = seconds;
+  profiler.stopAt = millis() + seconds * 1000;
+  profiler.active = true;
+  setTimerPeriod(PROFILE_PERIOD_US);
+  return true;
+}
+
+void stopProfiler() {
+  setTimerPeriod(WDT_TICK_MS * 1000);
+  profiler.active = false;
+}
+
+// Starts a fresh trace; taskProfiler() stops it after the given time
+bool startTracer(unsigned long seconds) {
+  if (tracer.active) return false;
+  if (!tracer.ring) {
+    tracer.ring = (TraceRecord*)malloc(sizeof(TraceRecord) * TRACE_RECORDS);
+    if (!tracer.ring) return false;
+  }
+  tracer.written = 0;
+  tracer.seconds = seconds;
+  tracer.stopAt = millis() + seconds * 1000;
+  tracer.active = true;
+  return true;
+}
+
+#ifdef HEAP_PROFILE
+// Heap attribution (env:heap_profile). The linker routes every malloc, free,
+// realloc and calloc through the wrappers below (-Wl,--wrap), which prefix
+// each block with the breadcrumb tag that allocated it, so String, HTTPClient,
+// PubSubClient and ArduinoJson allocations are charged to the task/section
+// that made them and their frees credited back. Costs 8 bytes per block.
+//
+// newlib's reentrant _malloc_r family is wrapped the same way, since the
+// core implements it next to malloc and the two can free each other's
+// blocks. The SDK's pvPortMalloc/vPortFree family is not wrapped: the SDK
+// only frees blocks it allocated itself, and lwIP allocates through malloc,
+// so no block crosses between the families. A block without a header (from
+// before the wrappers, or from the SDK) fails the check, which includes the
+// header's own address, and is passed through untouched.
+#define HEAP_TAGS 24
+#define HEAP_HEADER_MAGIC 0x48505446 // "HPTF"
+
+struct HeapHeader {
+  uint32_t check;  // Magic ^ address ^ tag ^ size; SDK blocks don't have one
+  uint16_t tag;
+  uint16_t size;
+};
+
+struct HeapTagStats {
+  uint16_t tag;
+  bool used;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t liveBytes;
+  uint32_t peakBytes;
+  uint32_t totalBytes;
+};
+
+HeapTagStats heapTags[HEAP_TAGS];
+unsigned long heapResetTime = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+void* __real_realloc(void* ptr, size_t size);
+void* __wrap_malloc(size_t size);
+void* __wrap_calloc(size_t count, size_t size);
+void __wrap_free(void* ptr);
+void* __wrap_realloc(void* ptr, size_t size);
+
+// Last slot collects whatever doesn't fit
+static HeapTagStats& heapTagStats(uint16_t tag) {
+  for (uint8_t i = 0; i < HEAP_TAGS - 1; i++) {
+    if (heapTags[i].used && heapTags[i].tag == tag) return heapTags[i];
+    if (!heapTags[i].used) {
+      heapTags[i].used = true;
+      heapTags[i].tag = tag;
+      return heapTags[i];
     }
-    configFile.close();
+  }
+  heapTags[HEAP_TAGS - 1].used = true;
+  heapTags[HEAP_TAGS - 1].tag = 0xFFFF;
+  return heapTags[HEAP_TAGS - 1];
+}
+
+static uint32_t heapCheck(const HeapHeader* header) {
+  return HEAP_HEADER_MAGIC ^ (uint32_t)(uintptr_t)header ^ header->tag ^ ((uint32_t)header->size << 16);
+}
+
+static void* heapTrackAlloc(HeapHeader* header, size_t size) {
+  if (!header) return nullptr;
+  uint32_t ps = xt_rsil(3);
+  header->tag = wdtCrumb & 0xFFFF;
+  header->size = size;
+  header->check = heapCheck(header);
+  HeapTagStats& stats = heapTagStats(header->tag);
+  stats.allocs++;
+  stats.totalBytes += size;
+  stats.liveBytes += size;
+  if (stats.liveBytes > stats.peakBytes) stats.peakBytes = stats.liveBytes;
+  xt_wsr_ps(ps);
+  return header + 1;
+}
+
+// Header of a block allocated through the wrappers, or null
+static HeapHeader* heapHeader(void* ptr) {
+  HeapHeader* header = (HeapHeader*)ptr - 1;
+  return header->check == heapCheck(header) ? header : nullptr;
+}
+
+static void heapCredit(const HeapHeader& header) {
+  uint32_t ps = xt_rsil(3);
+  HeapTagStats& stats = heapTagStats(header.tag);
+  stats.frees++;
+  stats.liveBytes -= min(stats.liveBytes, (uint32_t)header.size);
+  xt_wsr_ps(ps);
+}
+
+void* __wrap_malloc(size_t size) {
+  if (size > 0xFFFF) return nullptr;
+  return heapTrackAlloc((HeapHeader*)__real_malloc(size + sizeof(HeapHeader)), size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  if (size && count > 0xFFFF / size) return nullptr;
+  void* ptr = __wrap_malloc(count * size);
+  if (ptr) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+void __wrap_free(void* ptr) {
+  if (!ptr) return;
+  HeapHeader* header = heapHeader(ptr);
+  if (!header) {
+    __real_free(ptr);
+    return;
+  }
+  heapCredit(*header);
+  header->check = 0;
+  __real_free(header);
+}
+
+// A resized block is charged to whoever resized it
+void* __wrap_realloc(void* ptr, size_t size) {
+  if (!ptr) return __wrap_malloc(size);
+  if (size > 0xFFFF) return nullptr;
+  HeapHeader* header = heapHeader(ptr);
+  if (!header) return __real_realloc(ptr, size);
+  HeapHeader saved = *header;
+  HeapHeader* moved = (HeapHeader*)__real_realloc(header, size + sizeof(HeapHeader));
+  if (!moved) return nullptr;
+  heapCredit(saved);
+  return heapTrackAlloc(moved, size);
+}
+
+void* __wrap__malloc_r(struct _reent* reent, size_t size) {
+  (void)reent;
+  return __wrap_malloc(size);
+}
+
+void* __wrap__calloc_r(struct _reent* reent, size_t count, size_t size) {
+  (void)reent;
+  return __wrap_calloc(count, size);
+}
+
+void __wrap__free_r(struct _reent* reent, void* ptr) {
+  (void)reent;
+  __wrap_free(ptr);
+}
+
+void* __wrap__realloc_r(struct _reent* reent, void* ptr, size_t size) {
+  (void)reent;
+  return __wrap_realloc(ptr, size);
+}
+}
+
+void resetHeapProfile() {
+  uint32_t ps = xt_rsil(3);
+  for (uint8_t i = 0; i < HEAP_TAGS; i++) {
+    heapTags[i].allocs = 0;
+    heapTags[i].frees = 0;
+    heapTags[i].totalBytes = 0;
+    heapTags[i].peakBytes = heapTags[i].liveBytes;
+  }
+  xt_wsr_ps(ps);
+  heapResetTime = millis();
+}
+#endif
+
+void loadRtcBootState() {
+  ESP.rtcUserMemoryRead(RTC_BOOT_STATE_OFFSET, (uint32_t*)&rtcBootState, sizeof(rtcBootState));
+  if (rtcBootState.magic != RTC_BOOT_STATE_MAGIC || rtcBootState.crc != rtcBootStateCrc()) {
+    // Cold power-on or corrupted record: start from a clean state
+    memset(&rtcBootState, 0, sizeof(rtcBootState));
+  }
+}
+
+void saveRtcBootState() {
+  rtcBootState.magic = RTC_BOOT_STATE_MAGIC;
+  rtcBootState.crc = rtcBootStateCrc();
+  ESP.rtcUserMemoryWrite(RTC_BOOT_STATE_OFFSET, (uint32_t*)&rtcBootState, sizeof(rtcBootState));
 }
 
 // Threshold breach tracking
@@ -164,15 +647,30 @@ unsigned long lastBuzzerToggle = 0;
 // Variables for WiFi disconnection tracking
 unsigned long lastWifiBeepTime = 0;
 
-unsigned long lastReconnectAttempt = 0;
-unsigned long lastReadingTime = 0;
+unsigned long lastReconnectAttempt = 0; // Last MQTT connect attempt
+const unsigned long MQTT_RETRY_INTERVAL = 5000;
 unsigned long systemStartTime = 0; // Track system start time
 
 #define BUFFER_SIZE 15
 float gasDataBuffer[BUFFER_SIZE] = {0}; // Initialize all elements to 0
-unsigned long lastPublishTime = 0; // Timestamp of the last publish
 const unsigned long publishInterval = 1000; // 15 seconds in milliseconds
 
+// Warm-start state. After a software reset (OTA, /restart, watchdog) the
+// MQ-9 heater is still hot, so the filter window and alarm state are kept in
+// RTC memory and restored instead of paying the full warmup again.
+#define RTC_WARM_STATE_MAGIC 0x47445753 // "GDWS"
+const unsigned long WARM_START_MAX_GAP = 30000; // Longer outages count as a cold start
+
+struct RtcWarmState {
+  uint32_t magic;
+  uint32_t crc;                     // CRC32 of the fields below
+  uint32_t lastAliveRtc;            // RTC clock ticks at the last save
+  uint32_t breachElapsed;           // ms the current breach had lasted, 0 if none
+  uint32_t underThresholdElapsed;   // ms back under threshold, 0 if none
+  uint32_t alertState;
+  float gasDataBuffer[BUFFER_SIZE];
+};
+
 // Calibration variables
 bool calibrationRunning = false;
 unsigned long calibrationStartTime = 0;
@@ -184,960 +682,4107 @@ float calibrationReadings[300];
 int calibrationReadingCount = 0;
 
 // AP mode timeout and WiFi retry variables
-unsigned long apModeStartTime = 0;
-const unsigned long AP_MODE_TIMEOUT = 5 * 60 * 1000; // 5 minutes in milliseconds
-const unsigned long WIFI_RETRY_INTERVAL = 5 * 60 * 1000; // 5 minutes in milliseconds
-unsigned long lastWifiRetryTime = 0;
 bool apModeTimedOut = false;
 
+// WiFi reconnect state machine. Attempts are started from loop() and end on
+// a WiFi event or timeout, never by waiting; failed attempts back off
+// exponentially with jitter so a fleet doesn't retry in lockstep.
+enum WifiRetryState {
+  WIFI_RETRY_IDLE,       // Connected, or boot sequence still owns WiFi
+  WIFI_RETRY_WAIT,       // Backing off until wifiRetryAt
+  WIFI_RETRY_CONNECTING  // Attempt in flight
+};
+
+WifiRetryState wifiRetryState = WIFI_RETRY_IDLE;
+const unsigned long WIFI_RETRY_MIN = 10000;             // First backoff
+const unsigned long WIFI_RETRY_INTERVAL = 5 * 60 * 1000; // Backoff cap, 5 minutes
+const unsigned long WIFI_ATTEMPT_TIMEOUT = 15000;
+unsigned long wifiRetryDelay = WIFI_RETRY_MIN;
+unsigned long wifiRetryAt = 0;
+unsigned long wifiRetryCount = 0;    // Failed attempts since the last connect
+volatile bool wifiAttemptFailed = false;
+
+// Boot sequence. setup() only does the local work needed to start sampling;
+// networking is brought up one stage per loop() pass so that sampling, the
+// alarm FSM, buzzer and LEDs keep running while WiFi associates.
+enum BootStage {
+  BOOT_WIFI_START,
+  BOOT_WIFI_WAIT,
+  BOOT_WIFI_PORTAL,
+  BOOT_WIFI_PORTAL_WAIT,
+  BOOT_MDNS,
+  BOOT_OTA,
+  BOOT_TELNET,
+  BOOT_WEB,
+  BOOT_MQTT,
+  BOOT_NOTIFY,
+  BOOT_DONE
+};
+
+BootStage bootStage = BOOT_WIFI_START;
+unsigned long bootStageStart = 0;
+unsigned long firstSampleTime = 0; // millis() at the first protected sample
+const unsigned long WIFI_CONNECT_TIMEOUT = 30000; // Stored credentials, before falling back to the portal
+char deviceHostname[41];           // Sanitized DHCP/mDNS/OTA hostname
+WiFiManager wifiManager;           // Config portal, serviced from loop() while active
+
+// Boot profile. Each step of setup() and each boot stage is timed with
+// micros(); the last few profiles are kept in the KV store and published so
+// boot-time regressions can be tracked across firmware versions.
+enum BootStep : uint8_t {
+  STEP_CORE,    // Reset to setup()
+  STEP_FS,
+  STEP_KV,
+  STEP_CONFIG,  // Config, restart counter
+  STEP_SETUP,   // Pins, warm-start restore, WiFi cache
+  STEP_STAGES   // BootStage n is step STEP_STAGES + n
+};
+#define BOOT_STEP_COUNT (STEP_STAGES + BOOT_DONE)
+#define BOOT_PROFILE_HISTORY 4
+
+static const char BOOT_STEP_NAMES[BOOT_STEP_COUNT][12] PROGMEM = {
+  "core", "fs", "kv", "config", "setup",
+  "wifi_start", "wifi_wait", "portal", "portal_wait",
+  "mdns", "ota", "telnet", "web", "mqtt", "notify"
+};
+
+struct BootProfile {
+  char version[24];
+  uint32_t resetReason;
+  uint32_t totalUs;
+  uint32_t stepUs[BOOT_STEP_COUNT];
+};
+
+struct BootProfileLog {
+  uint32_t count;
+  BootProfile profiles[BOOT_PROFILE_HISTORY]; // Newest first
+};
+
+BootProfile bootProfile;
+BootProfileLog bootProfileLog;
+uint32_t bootStepStartUs = 0;
+bool bootProfilePending = false; // Not yet published over MQTT
+
+// Fast WiFi reconnect. The last good BSSID, channel and IP configuration are
+// kept in RTC memory, and the BSSID and channel also in flash, so association
+// can skip the channel scan and, after a warm reset, DHCP.
+#define RTC_WIFI_CACHE_MAGIC 0x47445743 // "GDWC"
+const unsigned long WIFI_DIRECTED_TIMEOUT = 3000; // Cached BSSID, before a full scan
+
+struct WifiCache {
+  uint32_t magic;
+  uint32_t crc;         // CRC32 of the fields below
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;          // Cached lease, 0 if only the BSSID is known
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+WifiCache wifiCache;
+bool wifiCacheValid = false;
+bool wifiDirected = false;        // Current attempt targets the cached BSSID/channel
+bool wifiStaticLease = false;     // Current attempt reuses the cached lease
+bool wifiCachePending = false;    // Got an IP; loop() saves the cache and reports
+unsigned long wifiAssocStart = 0;
+unsigned long wifiAssocTime = 0;  // ms from begin (or link loss) to IP
+bool wifiAssocDirected = false;
+bool wifiAssocStatic = false;
+bool warmStart = false;           // Restored from RTC after a recent software reset
+WiFiEventHandler wifiGotIpHandler;
+WiFiEventHandler wifiDisconnectedHandler;
+
 // Discovery config publish variables
-unsigned long lastDiscoveryPublish = 0;
 const unsigned long discoveryPublishInterval = 5 * 60 * 1000; // 5 minutes
 
+// Heap fragmentation trend: 100 - largest free block / free heap, sampled
+// every minute by taskHeap(); the worst value of each hour is kept for a day
+#define FRAG_HISTORY 24
+
+struct FragTrend {
+  uint8_t current;              // Percent
+  uint8_t worst;                // Since boot
+  uint8_t hourWorst;
+  uint8_t minutes;              // Samples in the current hour
+  uint8_t history[FRAG_HISTORY];
+  uint8_t count;
+  uint8_t head;                 // Next slot to write
+  uint32_t minFreeHeap;
+};
+FragTrend fragTrend = {};
+
 // Add function prototype at the top of the file, before it's used:
 void setLedColor(bool r, bool g, bool b);
+void renderSchedulerStatus(String& html);
+void handleMetrics();
+void publishPostMortem();
+void handleResetHistograms();
+void handleProfile();
+void handleTrace();
+void handleCacheBench();
+void applyPowerMode();
+void taskBuzzer();
+void taskLed();
+void taskIdleUntil(void (*fn)(), uint32_t until);
+void taskWake(void (*fn)());
+
+// Telnet sessions. Each client reads the log through its own sink in the
+// log ring and gets command replies through its own bounded buffer; both
+// drain without blocking. A client that takes nothing for
+// TELNET_STALL_TIMEOUT while output is waiting is disconnected.
+//
+// Replies longer than the buffer, like profile and trace dumps, are made
+// one line at a time by a TelnetReplyFn, called again from telnetDrain()
+// whenever the buffer has room for TELNET_REPLY_LINE. A session takes no
+// new command until its reply is out, and a reply still running
+// TELNET_REPLY_DEADLINE after its command is cut off.
+#define TELNET_MAX_CLIENTS 3
+#define TELNET_REPLY_SIZE 512 // Power of two
+#define TELNET_REPLY_LINE 384 // Longest line a TelnetReplyFn writes (a histogram row)
+const unsigned long TELNET_STALL_TIMEOUT = 10000;
+const unsigned long TELNET_REPLY_DEADLINE = 30000;
+
+// Writes line index of a reply to out; false once past the last line
+typedef bool (*TelnetReplyFn)(uint32_t index, Print& out);
+
+class TelnetSession : public Print {
+public:
+  WiFiClient client;
+  char line[32];
+  uint8_t lineLength;
+  bool truncated;              // Reply output lost since the last command
+  uint16_t replyHead;          // Free-running positions in reply
+  uint16_t replyTail;
+  unsigned long lastProgress;  // Last time the client took output or had none waiting
+  TelnetReplyFn replyFn;       // Running reply, or nullptr
+  uint32_t replyIndex;         // Next line of it
+  unsigned long replyStart;
+  char reply[TELNET_REPLY_SIZE];
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t length) override;
+};
+TelnetSession telnetSessions[TELNET_MAX_CLIENTS];
+uint32_t telnetSlowDisconnects = 0;
+
+void handleTelnetCommand(char* line, TelnetSession& session);
+
+// Logger. Log calls format into a RAM ring and the "log" task drains it
+// to Serial and each telnet client as fast as each accepts without
+// blocking. Each sink has its own read position; when the ring is full, a
+// sink that has fallen behind loses its oldest whole lines, which are
+// counted. Nothing is formatted while no sink is attached. Single producer
+// and consumer, both in loop() context, so no locking is needed.
+#define LOG_RING_SIZE 2048 // Power of two
+
+enum LogSink : uint8_t { LOG_SINK_SERIAL, LOG_SINK_TELNET, LOG_SINK_COUNT = LOG_SINK_TELNET + TELNET_MAX_CLIENTS };
+#define LOG_TO_SERIAL (1 << LOG_SINK_SERIAL)
+#define LOG_TO_TELNET (((1 << TELNET_MAX_CLIENTS) - 1) << LOG_SINK_TELNET)
+#define LOG_TO_ALL (LOG_TO_SERIAL | LOG_TO_TELNET)
+
+struct LogRing {
+  char data[LOG_RING_SIZE];
+  uint32_t head;                    // Free-running write position
+  uint32_t tail[LOG_SINK_COUNT];    // Free-running read position per sink
+  uint32_t dropped[LOG_SINK_COUNT]; // Lines lost to backpressure
+  uint8_t attached;                 // Sinks seen by the last append
+#ifdef LOG_BINARY
+  uint32_t oldest;                  // Start of the oldest entry still whole in data
+#endif
+};
+LogRing logRing = {};
 
-// Add these helper functions near the top of the file
-void printBoth(const String& msg) {
-    Serial.print(msg);
-    if (telnetClient && telnetClient.connected()) {
-        telnetClient.print(msg);
-    }
+uint8_t logSinks(uint8_t wanted) {
+  uint8_t sinks = LOG_TO_SERIAL;
+  for (uint8_t slot = 0; slot < TELNET_MAX_CLIENTS; slot++) {
+    if (telnetSessions[slot].client.connected()) sinks |= 1 << (LOG_SINK_TELNET + slot);
+  }
+  return sinks & wanted;
 }
-void printlnBoth(const String& msg) {
-    Serial.println(msg);
-    if (telnetClient && telnetClient.connected()) {
-        telnetClient.println(msg);
-    }
+
+#ifdef LOG_BINARY
+#define LOG_FRAME_SYNC 0xFE // First byte of a binary frame, never of UTF-8 text
+
+// End of the ring entry starting at at: a frame by its length byte, text
+// after its '\n'
+uint32_t logEntryEnd(uint32_t at) {
+  if ((uint8_t)logRing.data[at % LOG_RING_SIZE] == LOG_FRAME_SYNC) {
+    return at + 2 + (uint8_t)logRing.data[(at + 1) % LOG_RING_SIZE];
+  }
+  while (at != logRing.head && logRing.data[at++ % LOG_RING_SIZE] != '\n') {}
+  return at;
+}
+#endif
+
+// Drops a sink's oldest lines until length more bytes fit behind it. Under
+// LOG_BINARY frames can hold any byte, '\n' included, so entries are walked
+// by length instead, from the oldest whole one up to where the sink stopped.
+void logMakeRoom(uint8_t sink, size_t length) {
+  uint32_t& tail = logRing.tail[sink];
+#ifdef LOG_BINARY
+  if (logRing.head + length - tail <= LOG_RING_SIZE) return;
+  uint32_t at = logRing.oldest;
+  while ((int32_t)(at - tail) < 0) at = logEntryEnd(at);
+  if (at != tail) {
+    // The sink was part way through an entry; the rest of it goes too
+    tail = at;
+    logRing.dropped[sink]++;
+  }
+  while (logRing.head + length - tail > LOG_RING_SIZE) {
+    tail = logEntryEnd(tail);
+    logRing.dropped[sink]++;
+  }
+#else
+  while (logRing.head + length - tail > LOG_RING_SIZE) {
+    while (tail != logRing.head && logRing.data[tail++ % LOG_RING_SIZE] != '\n') {}
+    logRing.dropped[sink]++;
+  }
+#endif
+}
+
+void logAppend(const char* text, size_t length, uint8_t sinks) {
+  sinks = logSinks(sinks);
+  if (!sinks) return;
+  length = min(length, (size_t)LOG_RING_SIZE / 2);
+  for (uint8_t sink = 0; sink < LOG_SINK_COUNT; sink++) {
+    // A sink that just attached starts from here, not from old lines
+    bool attached = sinks & (1 << sink);
+    if (attached && !(logRing.attached & (1 << sink))) logRing.tail[sink] = logRing.head;
+    if (attached) logMakeRoom(sink, length);
+  }
+  logRing.attached = sinks;
+#ifdef LOG_BINARY
+  while (logRing.head + length - logRing.oldest > LOG_RING_SIZE) logRing.oldest = logEntryEnd(logRing.oldest);
+#endif
+  uint32_t at = logRing.head % LOG_RING_SIZE;
+  size_t first = min(length, (size_t)LOG_RING_SIZE - at);
+  memcpy(logRing.data + at, text, first);
+  memcpy(logRing.data, text + first, length - first);
+  logRing.head += length;
+  // Sinks not attached skip what they would never read
+  for (uint8_t sink = 0; sink < LOG_SINK_COUNT; sink++) {
+    if (!(sinks & (1 << sink))) logRing.tail[sink] = logRing.head;
+  }
+}
+
+// Writes what the sink can take right now; returns false if it had to stop
+bool logDrainTo(uint8_t sink, Print& out, size_t room) {
+  uint32_t& tail = logRing.tail[sink];
+  while (room > 0 && tail != logRing.head) {
+    uint32_t at = tail % LOG_RING_SIZE;
+    size_t chunk = min(min((size_t)(logRing.head - tail), (size_t)LOG_RING_SIZE - at), room);
+    size_t written = out.write((const uint8_t*)logRing.data + at, chunk);
+    tail += written;
+    room -= written;
+    if (written < chunk) break;
+  }
+  return tail == logRing.head;
 }
-void printfBoth(const char* fmt, ...) {
+
+void vprintfSinks(uint8_t sinks, const char* fmt, va_list args) {
+    if (!logSinks(sinks)) return;
     char buf[256];
+    int length = vsnprintf_P(buf, sizeof(buf), fmt, args);
+    if (length <= 0) return;
+    logAppend(buf, min((size_t)length, sizeof(buf) - 1), sinks);
+}
+// Debug output only worth formatting for someone watching over telnet
+void printfTelnet(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, args);
+    vprintfSinks(LOG_TO_TELNET, fmt, args);
     va_end(args);
-    Serial.print(buf);
-    if (telnetClient && telnetClient.connected()) {
-        telnetClient.print(buf);
-    }
 }
 
-void sendNotification(bool isAlert) {
-    if (!(WiFi.status() == WL_CONNECTED) || !config.ntfyEnabled) {
-        printlnBoth(F("WiFi not connected or ntfy notifications disabled, skipping notification"));
-        return;
-    }
-   
-    // Use the same approach as sendStartupNotification
-    WiFiClient client; // Use regular WiFiClient instead of secure client for HTTP
-    HTTPClient http;
-    String url = String(F("http://ntfy.sh/")) + config.topicName;
-    
-    if (!http.begin(client, url)) {
-        printlnBoth(F("Failed to begin HTTP client"));
-        return;
-    }
-    http.addHeader(F("Title"), F("Gas Detector Alert"));
-    http.addHeader(F("Content-Type"), F("text/plain"));
-    
-    const char* message = isAlert ? ALERT_MESSAGE : NORMAL_MESSAGE;
-    int httpResponseCode = http.POST(message);
-    
-    if (httpResponseCode > 0) {
-        printfBoth(PSTR("Notification sent successfully, HTTP code: %d\n"), httpResponseCode);
-    } else {
-        printfBoth(PSTR("Notification Failed, HTTP error: %s\n"), http.errorToString(httpResponseCode).c_str());
-    }
-    
-    http.end();
+// Log levels. LOG_E/W/I/D(module, fmt, ...) log one line through
+// logLine, or as one binary frame under LOG_BINARY. LOG_LEVEL and
+// LOG_LEVEL_<module> are set per PlatformIO environment; a call above its
+// module's level is a constant-false branch, so the compiler drops the
+// call, its PSTR format and its argument evaluation. logLevels[] can lower
+// a module further at run time, down from what was compiled in.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#ifndef LOG_LEVEL_SYS
+#define LOG_LEVEL_SYS LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_SENSOR
+#define LOG_LEVEL_SENSOR LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_WIFI
+#define LOG_LEVEL_WIFI LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_MQTT
+#define LOG_LEVEL_MQTT LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_NOTIFY
+#define LOG_LEVEL_NOTIFY LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_NET
+#define LOG_LEVEL_NET LOG_LEVEL
+#endif
+
+enum LogModule : uint8_t { LOG_MOD_SYS, LOG_MOD_SENSOR, LOG_MOD_WIFI, LOG_MOD_MQTT, LOG_MOD_NOTIFY, LOG_MOD_NET, LOG_MOD_COUNT };
+static const char LOG_MODULE_NAMES[LOG_MOD_COUNT][8] PROGMEM = { "sys", "sensor", "wifi", "mqtt", "notify", "net" };
+static const char LOG_LEVEL_NAMES[LOG_LEVEL_DEBUG + 1][8] PROGMEM = { "none", "error", "warn", "info", "debug" };
+
+uint8_t logLevels[LOG_MOD_COUNT] = {
+  LOG_LEVEL_SYS, LOG_LEVEL_SENSOR, LOG_LEVEL_WIFI, LOG_LEVEL_MQTT, LOG_LEVEL_NOTIFY, LOG_LEVEL_NET
+};
+const uint8_t LOG_COMPILED_LEVELS[LOG_MOD_COUNT] = {
+  LOG_LEVEL_SYS, LOG_LEVEL_SENSOR, LOG_LEVEL_WIFI, LOG_LEVEL_MQTT, LOG_LEVEL_NOTIFY, LOG_LEVEL_NET
+};
+
+// Syslog sink. Log lines up to config.syslogLevel also go to
+// config.syslogServer as RFC 5424 records over UDP, several to a datagram
+// separated by LF, which the collector splits on. A batch is sent when the
+// next record would not fit, SYSLOG_FLUSH_INTERVAL after its first record,
+// or on the next task pass once it holds a warning or error. Sending never
+// waits; a datagram the stack cannot take is dropped and counted. Each
+// level has a token bucket, so a burst of debug lines cannot crowd out
+// errors. Under LOG_BINARY nothing is formatted on the device and syslog
+// gets nothing.
+#define SYSLOG_BATCH_SIZE 1400 // One 1500-byte MTU less IP and UDP headers
+#define SYSLOG_FACILITY 16     // local0
+const unsigned long SYSLOG_FLUSH_INTERVAL = 1000;
+
+// Indexed by log level
+const uint8_t SYSLOG_SEVERITY[LOG_LEVEL_DEBUG + 1] = { 7, 3, 4, 6, 7 };
+const uint8_t SYSLOG_BURST[LOG_LEVEL_DEBUG + 1] = { 0, 20, 20, 10, 10 };
+const uint8_t SYSLOG_PER_SECOND[LOG_LEVEL_DEBUG + 1] = { 0, 5, 5, 2, 2 };
+
+struct SyslogState {
+  WiFiUDP udp;
+  IPAddress server;            // Unset while syslog is off
+  char batch[SYSLOG_BATCH_SIZE];
+  uint16_t length;
+  uint8_t batchRecords;
+  bool urgent;                 // Batch holds a warning or error
+  unsigned long batchStart;
+  unsigned long refillAt;
+  uint8_t tokens[LOG_LEVEL_DEBUG + 1];
+  uint32_t sequence;
+  uint32_t sent;               // Records
+  uint32_t rateLimited;
+  uint32_t sendFailed;
+};
+SyslogState syslogSink;
+
+bool syslogWants(uint8_t level) {
+  return syslogSink.server.isSet() && level <= config.syslogLevel;
 }
 
-void sendStartupNotification() {
-    if (!(WiFi.status() == WL_CONNECTED) || !config.ntfyEnabled) {
-        printlnBoth(F("WiFi not connected or ntfy notifications disabled, skipping startup notification"));
-        return;
-    }
-    // Prepare message
-    String ip = WiFi.localIP().toString();
-    String hostname = String(config.deviceName);
-    hostname.replace(F(" "), F("-"));
-    hostname.toLowerCase();
-    String mdnsUrl = hostname + F(".local");
-    float ppm = analogRead(gasSensorPin) - config.baseGasValue;
-    if (ppm < 0) ppm = 0; // Ensure no negative values
-    String msg = F("Device started!\nIP: ") + ip + F("\nMDNS: http://") + mdnsUrl + F("/\nCurrent PPM: ") + String(ppm, 1);
+void syslogFlush() {
+  if (syslogSink.length == 0) return;
+  // The last record needs no separator
+  size_t length = syslogSink.length - 1;
+  bool sent = WiFi.status() == WL_CONNECTED && syslogSink.udp.beginPacket(syslogSink.server, config.syslogPort) &&
+              syslogSink.udp.write((const uint8_t*)syslogSink.batch, length) == length && syslogSink.udp.endPacket();
+  (sent ? syslogSink.sent : syslogSink.sendFailed) += syslogSink.batchRecords;
+  syslogSink.length = 0;
+  syslogSink.batchRecords = 0;
+  syslogSink.urgent = false;
+}
 
-    // Send to ntfy using consistent approach
-    WiFiClient client;
-    HTTPClient http;
-    String url = String(F("http://ntfy.sh/")) + config.topicName;
-    if (http.begin(client, url)) {
-        http.addHeader(F("Title"), F("Gas Detector Online"));
-        http.addHeader(F("Content-Type"), F("text/plain"));
-        int code = http.POST(msg);
-        if (code > 0) {
-            printfBoth(PSTR("Startup notification sent, HTTP code: %d\n"), code);
-        } else {
-            printfBoth(PSTR("Startup notification failed, HTTP error: %s\n"), http.errorToString(code).c_str());
-        }
-        http.end();
-    } else {
-        printlnBoth(F("Failed to begin HTTP client for startup notification"));
-    }
+void syslogAppend(uint8_t module, uint8_t level, const char* text, size_t length) {
+  if (syslogSink.tokens[level] == 0) {
+    syslogSink.rateLimited++;
+    return;
+  }
+  syslogSink.tokens[level]--;
+  while (length > 0 && (*text == '\n' || *text == '\r')) {
+    text++;
+    length--;
+  }
+  while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')) length--;
+
+  char moduleName[8];
+  char header[128];
+  memcpy_P(moduleName, LOG_MODULE_NAMES[module], sizeof(moduleName));
+  if (++syslogSink.sequence > 0x7FFFFFFF) syslogSink.sequence = 1;
+  int headerLength = snprintf_P(header, sizeof(header), PSTR("<%u>1 - %s gasdetect - %s [meta sequenceId=\"%lu\" sysUpTime=\"%lu\"] "),
+                                SYSLOG_FACILITY * 8 + SYSLOG_SEVERITY[level], deviceHostname[0] ? deviceHostname : "-", moduleName,
+                                (unsigned long)syslogSink.sequence, millis() / 10);
+  if (headerLength <= 0) return;
+  headerLength = min((size_t)headerLength, sizeof(header) - 1);
+  length = min(length, (size_t)SYSLOG_BATCH_SIZE - headerLength - 1);
+  if (syslogSink.length + headerLength + length + 1 > SYSLOG_BATCH_SIZE) syslogFlush();
+
+  if (syslogSink.length == 0) syslogSink.batchStart = millis();
+  memcpy(syslogSink.batch + syslogSink.length, header, headerLength);
+  memcpy(syslogSink.batch + syslogSink.length + headerLength, text, length);
+  syslogSink.length += headerLength + length;
+  syslogSink.batch[syslogSink.length++] = '\n';
+  syslogSink.batchRecords++;
+  if (level <= LOG_LEVEL_WARN) syslogSink.urgent = true;
 }
 
-void addGasReading(float gasReading) {
-  //print reading to telnet
-  if (telnetClient && telnetClient.connected()) {
-    telnetClient.printf(PSTR("Gas Sensor Value: %.2f\n"), gasReading);
-    printfBoth(PSTR("Gas Sensor Value: %.2f\n"), gasReading);
+// Formats once for the log ring and syslog
+void logLine(uint8_t module, uint8_t level, const char* fmt, ...) {
+  bool toSyslog = syslogWants(level);
+  if (!logSinks(LOG_TO_ALL) && !toSyslog) return;
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int length = vsnprintf_P(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (length <= 0) return;
+  length = min((size_t)length, sizeof(buf) - 1);
+  logAppend(buf, length, LOG_TO_ALL);
+  if (toSyslog) syslogAppend(module, level, buf, length);
+}
+
+#define LOG_ENABLED(module, level) ((level) <= LOG_LEVEL_##module && (level) <= logLevels[LOG_MOD_##module])
+#ifdef LOG_BINARY
+// Deferred formatting (-DLOG_BINARY). A log call sends a frame instead of
+// text: 0xFE, the length of the rest, the call's format ID (FNV-1a of the
+// format string, computed at compile time, little endian), then each
+// argument packed by its C++ type. Integers are zigzag varints, floats
+// 4 bytes, strings a length byte and up to LOG_FRAME_STRING bytes, with
+// LOG_FRAME_CUT set in the length byte if the string was longer. A
+// LogFloats array is a count byte and the floats; its format is "%[.2f]",
+// which the decoder prints as "[%.2f]" per value, and which only binary
+// builds may use. The format strings never reach flash; tools/logdecode.py
+// hashes the ones in the source and turns frames back into lines. Other
+// output, such as telnet command replies, stays text and passes through
+// the decoder.
+#define LOG_FRAME_STRING 127
+#define LOG_FRAME_CUT 0x80
+
+constexpr uint32_t logFormatId(const char* fmt) {
+  uint32_t hash = 2166136261u;
+  while (*fmt) {
+    hash ^= (uint8_t)*fmt++;
+    hash *= 16777619u;
   }
+  return hash;
+}
 
-  // Shift elements to the left
-  for (int i = 1; i < BUFFER_SIZE; i++) {
-    gasDataBuffer[i - 1] = gasDataBuffer[i];
+struct LogFrame {
+  uint8_t data[2 + 255];
+  uint16_t length;
+
+  void put(uint8_t byte) {
+    if (length < sizeof(data)) data[length++] = byte;
   }
-  // Add new reading to the end
-  gasDataBuffer[BUFFER_SIZE - 1] = gasReading;
+  void putVarint(int64_t value) {
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    do {
+      uint8_t byte = zigzag & 0x7F;
+      zigzag >>= 7;
+      put(zigzag ? byte | 0x80 : byte);
+    } while (zigzag);
+  }
+  // RAM or flash; pgm_read_byte reads both
+  void putString(const char* text) {
+    if (!text) text = PSTR("(null)");
+    size_t length = strnlen_P(text, LOG_FRAME_STRING + 1);
+    if (length > LOG_FRAME_STRING) {
+      length = LOG_FRAME_STRING;
+      put(length | LOG_FRAME_CUT);
+    } else {
+      put(length);
+    }
+    for (size_t i = 0; i < length; i++) put(pgm_read_byte(text + i));
+  }
+};
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type logPack(LogFrame& frame, T value) {
+  frame.putVarint((int64_t)value);
 }
+inline void logPack(LogFrame& frame, double value) {
+  float narrow = value;
+  uint8_t bytes[4];
+  memcpy(bytes, &narrow, sizeof(bytes));
+  for (uint8_t byte : bytes) frame.put(byte);
+}
+inline void logPack(LogFrame& frame, const char* text) { frame.putString(text); }
+inline void logPack(LogFrame& frame, const __FlashStringHelper* text) { frame.putString((PGM_P)text); }
 
-float calculateMedian(float data[], int size) {
-  float temp[size];
-  memcpy(temp, data, size * sizeof(float)); // Copy data to avoid modifying the original array
-  std::sort(temp, temp + size);
-  //print sorted values to telnet
-  if (telnetClient && telnetClient.connected()) {
-    telnetClient.print(F("Sorted values: "));
-    for (int i = 0; i < size; i++) {
-      telnetClient.printf(PSTR("[%.2f]"), temp[i]);
+struct LogFloats {
+  const float* values;
+  uint8_t count;
+};
+inline void logPack(LogFrame& frame, const LogFloats& floats) {
+  frame.put(floats.count);
+  const uint8_t* bytes = (const uint8_t*)floats.values;
+  for (size_t i = 0; i < floats.count * sizeof(float); i++) frame.put(bytes[i]);
+}
+
+template <typename... Args>
+void logBinary(uint8_t sinks, uint32_t id, const Args&... args) {
+  if (!logSinks(sinks)) return;
+  LogFrame frame;
+  frame.length = 0;
+  frame.put(LOG_FRAME_SYNC);
+  frame.put(0);
+  for (uint8_t shift = 0; shift < 32; shift += 8) frame.put(id >> shift);
+  (logPack(frame, args), ...);
+  frame.data[1] = frame.length - 2;
+  logAppend((const char*)frame.data, frame.length, sinks);
+}
+
+#define LOG_AT_TO(sinks, module, level, fmt, ...) \
+  do { \
+    if (LOG_ENABLED(module, level)) { \
+      constexpr uint32_t logId = logFormatId(fmt); \
+      logBinary(sinks, logId, ##__VA_ARGS__); \
+    } \
+  } while (0)
+#define LOG_AT(module, level, fmt, ...) LOG_AT_TO(LOG_TO_ALL, module, level, fmt, ##__VA_ARGS__)
+// Debug frames only worth sending to someone watching over telnet, as
+// printfTelnet() is for text
+#define LOG_D_TELNET(module, fmt, ...) LOG_AT_TO(LOG_TO_TELNET, module, LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_AT(module, level, fmt, ...) \
+  do { \
+    if (LOG_ENABLED(module, level)) logLine(LOG_MOD_##module, level, PSTR(fmt "\n"), ##__VA_ARGS__); \
+  } while (0)
+#endif
+#define LOG_E(module, fmt, ...) LOG_AT(module, LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_W(module, fmt, ...) LOG_AT(module, LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_I(module, fmt, ...) LOG_AT(module, LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_D(module, fmt, ...) LOG_AT(module, LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Sets a module's run-time level, capped at what was compiled in
+bool setLogLevel(const char* module, const char* level) {
+  for (uint8_t m = 0; m < LOG_MOD_COUNT; m++) {
+    if (strcmp_P(module, LOG_MODULE_NAMES[m]) != 0) continue;
+    for (uint8_t l = 0; l <= LOG_LEVEL_DEBUG; l++) {
+      if (strcmp_P(level, LOG_LEVEL_NAMES[l]) != 0) continue;
+      logLevels[m] = min(l, LOG_COMPILED_LEVELS[m]);
+      return true;
     }
-    telnetClient.println();
   }
-  int mid = size / 2;
-  return (size % 2 == 0) ? (temp[mid - 1] + temp[mid]) / 2.0 : temp[mid];
+  return false;
 }
 
-void saveConfig() {
-  File configFile = LittleFS.open("/config.json", "w");
-  if (!configFile) {
-    printlnBoth(F("Failed to open config file for writing"));
-    return;
+void printLogLevels(Print& out) {
+  for (uint8_t m = 0; m < LOG_MOD_COUNT; m++) {
+    out.printf_P(PSTR("%-7S %-6S (compiled %S)\n"), LOG_MODULE_NAMES[m], LOG_LEVEL_NAMES[logLevels[m]], LOG_LEVEL_NAMES[LOG_COMPILED_LEVELS[m]]);
   }
+}
 
-  JsonDocument json;
-  json[F("mqttServer")] = config.mqttServer;
-  json[F("mqttUser")] = config.mqttUser;
-  json[F("mqttPassword")] = config.mqttPassword;
-  json[F("deviceName")] = config.deviceName;
-  json[F("mqttPort")] = config.mqttPort;
-  json[F("mqttEnabled")] = config.mqttEnabled;
-  json[F("thresholdLimit")] = config.thresholdLimit;
-  json[F("thresholdDuration")] = config.thresholdDuration;
-  json[F("topicName")] = config.topicName;
-  json[F("ntfyEnabled")] = config.ntfyEnabled;  // Save ntfy status
-  json[F("baseGasValue")] = config.baseGasValue;  // Save base gas value
-  json[F("restartCounter")] = config.restartCounter;  // Save restart counter
-
-  if (serializeJson(json, configFile) == 0) {
-    printlnBoth(F("Failed to write to config file"));
-  }
-  else {
-    printlnBoth(F("Configuration saved successfully"));
+void applySyslogConfig() {
+  syslogFlush();
+  IPAddress server;
+  if (config.syslogServer[0] && !server.fromString(config.syslogServer)) {
+    server = IPAddress();
+    LOG_W(NET, "Syslog server must be an IP address, not %s", config.syslogServer);
+  }
+  syslogSink.server = server;
+  memcpy(syslogSink.tokens, SYSLOG_BURST, sizeof(syslogSink.tokens));
+  syslogSink.refillAt = millis();
+}
+
+void taskSyslog() {
+  if (millis() - syslogSink.refillAt >= 1000) {
+    syslogSink.refillAt = millis();
+    for (uint8_t level = 0; level <= LOG_LEVEL_DEBUG; level++) {
+      syslogSink.tokens[level] = min(SYSLOG_BURST[level], (uint8_t)(syslogSink.tokens[level] + SYSLOG_PER_SECOND[level]));
+    }
   }
+  if (syslogSink.length > 0 && (syslogSink.urgent || millis() - syslogSink.batchStart >= SYSLOG_FLUSH_INTERVAL)) syslogFlush();
+}
 
-  configFile.close();
+void startTelnetReply(TelnetSession& session, TelnetReplyFn fn) {
+  session.replyFn = fn;
+  session.replyIndex = 0;
+  session.replyStart = millis();
 }
 
-void loadConfig() {
-  File configFile = LittleFS.open("/config.json", "r");
-  if (!configFile) {
-    printlnBoth(F("Failed to open config file"));
-    return;
+void endTelnetReply(TelnetSession& session) {
+  session.replyFn = nullptr;
+  if (session.truncated) {
+    session.truncated = false;
+    LOG_W(NET, "Telnet reply to client %u truncated", (unsigned)(&session - telnetSessions));
   }
+}
 
-  JsonDocument json;
-  DeserializationError error = deserializeJson(json, configFile);
-  if (error) {
-    printlnBoth(F("Failed to parse config file"));
+// Log lines first, then replies, so a reply never lands inside a log line
+void telnetDrain(TelnetSession& session) {
+  uint8_t slot = &session - telnetSessions;
+  uint8_t sink = LOG_SINK_TELNET + slot;
+  if (!session.client.connected()) {
+    logRing.tail[sink] = logRing.head;
+    session.replyTail = session.replyHead;
+    session.replyFn = nullptr;
     return;
   }
+  if (session.replyFn && millis() - session.replyStart > TELNET_REPLY_DEADLINE) {
+    session.truncated = true;
+    endTelnetReply(session);
+  }
+  while (session.replyFn && TELNET_REPLY_SIZE - (uint16_t)(session.replyHead - session.replyTail) >= TELNET_REPLY_LINE) {
+    if (!session.replyFn(session.replyIndex++, session)) endTelnetReply(session);
+  }
 
-  strlcpy(config.mqttServer, json[F("mqttServer")] | "", sizeof(config.mqttServer));
-  strlcpy(config.mqttUser, json[F("mqttUser")] | "", sizeof(config.mqttUser));
-  strlcpy(config.mqttPassword, json[F("mqttPassword")] | "", sizeof(config.mqttPassword));
-  strlcpy(config.deviceName, json[F("deviceName")] | "", sizeof(config.deviceName));
-  config.mqttPort = json[F("mqttPort")] | 1883;
-  config.mqttEnabled = json[F("mqttEnabled")] | false;
-  config.thresholdLimit = json[F("thresholdLimit")] | 200;
-  config.thresholdDuration = json[F("thresholdDuration")] | 5;
+  size_t room = session.client.availableForWrite();
+  if (logDrainTo(sink, session.client, room)) {
+    room = session.client.availableForWrite();
+    while (room > 0 && session.replyTail != session.replyHead) {
+      uint16_t at = session.replyTail % TELNET_REPLY_SIZE;
+      size_t chunk = min(min((size_t)(uint16_t)(session.replyHead - session.replyTail), (size_t)TELNET_REPLY_SIZE - at), room);
+      size_t written = session.client.write((const uint8_t*)session.reply + at, chunk);
+      session.replyTail += written;
+      room -= written;
+      if (written < chunk) break;
+    }
+  }
 
-  // Always set topicName to GasDetect_Macaddress (no colons)
-  String mac = WiFi.macAddress();
-  mac.replace(":", ""); // Remove colons from MAC address
-  String ntfyChannel = F("GasDetect_") + mac.substring(mac.length() - 6);
-  strlcpy(config.topicName, ntfyChannel.c_str(), sizeof(config.topicName));
-
-  config.ntfyEnabled = json[F("ntfyEnabled")] | true;  // Default to enabled for backwards compatibility
-  config.baseGasValue = json[F("baseGasValue")] | -1; // Default to -1 if not set
-  config.restartCounter = json[F("restartCounter")] | 0; // Default to 0 if not set
-
-  configFile.close();
-  //print all config values on serial
-  printlnBoth(F("Loaded configuration:"));
-
-  printfBoth(PSTR("MQTT Server: %s\n"), config.mqttServer);
-  printfBoth(PSTR("MQTT User: %s\n"), config.mqttUser);
-  printfBoth(PSTR("MQTT Password: %s\n"), config.mqttPassword);
-  printfBoth(PSTR("Device Name: %s\n"), config.deviceName);
-  printfBoth(PSTR("MQTT Port: %d\n"), config.mqttPort);
-  printfBoth(PSTR("MQTT Enabled: %s\n"), config.mqttEnabled ? F("true") : F("false"));
-  printfBoth(PSTR("Threshold Limit: %d\n"), config.thresholdLimit);
-  printfBoth(PSTR("Threshold Duration: %d\n"), config.thresholdDuration);
-  printfBoth(PSTR("Topic Name: %s\n"), config.topicName);
-  printfBoth(PSTR("NTFY Enabled: %s\n"), config.ntfyEnabled ? F("true") : F("false"));
-  printfBoth(PSTR("Base Gas Value: %d\n"), config.baseGasValue);
-  printfBoth(PSTR("Restart Counter: %d\n"), config.restartCounter);
+  bool waiting = logRing.tail[sink] != logRing.head || session.replyTail != session.replyHead || session.replyFn;
+  if (!waiting || session.client.availableForWrite() > 0) {
+    session.lastProgress = millis();
+  } else if (millis() - session.lastProgress > TELNET_STALL_TIMEOUT) {
+    session.client.stop();
+    logRing.tail[sink] = logRing.head;
+    session.replyTail = session.replyHead;
+    session.replyFn = nullptr;
+    telnetSlowDisconnects++;
+    LOG_W(NET, "Telnet client %u too slow, disconnected", slot);
+  }
 }
 
-// Function to handle calibration LED pattern
-void updateCalibrationLed() {
-  unsigned long currentTime = millis();
-  
-  // Toggle LED every 800ms (300ms on, 500ms off)
-  if (currentTime - lastCalibrationLedToggle >= 800) {
-    lastCalibrationLedToggle = currentTime;
-    
-    // Cycle through Red, Green, Blue
-    if (calibrationLedState == 0) {
-      // Red
-      setLedColor(true, false, false);
-      calibrationLedState = 1;
-    } else if (calibrationLedState == 1) {
-      // Green
-      setLedColor(false, true, false);
-      calibrationLedState = 2;
+// Never waits for the client: output that does not fit is dropped and the
+// reply marked truncated
+size_t TelnetSession::write(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length && !truncated; i++) {
+    if ((uint16_t)(replyHead - replyTail) == TELNET_REPLY_SIZE) {
+      truncated = true;
     } else {
-      // Blue
-      setLedColor(false, false, true);
-      calibrationLedState = 0;
+      reply[replyHead++ % TELNET_REPLY_SIZE] = data[i];
     }
-  } else if (currentTime - lastCalibrationLedToggle >= 300) {
-    // Turn LED off after 300ms
-    setLedColor(false, false, false);
   }
+  return length;
 }
 
-// Calculate average of calibration readings
-float calculateCalibrationAverage() {
-  if (calibrationReadingCount == 0) return -1;
-  
-  float sum = 0;
-  for (int i = 0; i < calibrationReadingCount; i++) {
-    sum += calibrationReadings[i];
+void logDrain() {
+  logDrainTo(LOG_SINK_SERIAL, Serial, Serial.availableForWrite());
+  for (uint8_t slot = 0; slot < TELNET_MAX_CLIENTS; slot++) {
+    telnetDrain(telnetSessions[slot]);
   }
-  return sum / calibrationReadingCount;
 }
 
+// Blocking drain, for just before a restart
+void logFlush() {
+  unsigned long start = millis();
+  while (millis() - start < 500) {
+    logDrain();
+    bool drained = true;
+    for (uint8_t sink = 0; sink < LOG_SINK_COUNT; sink++) drained &= logRing.tail[sink] == logRing.head;
+    if (drained) break;
+    yield();
+  }
+  Serial.flush();
+}
 
+// Log-structured key-value store for persistent state.
+//
+// Records are appended to one of two flash sectors reserved just below the
+// end of the EEPROM sector, which this firmware does not otherwise use. The
+// newest record for a key wins, so a small update costs one small flash
+// write instead of a file rewrite and block erase. When the active sector
+// fills up, the live records are copied to the spare sector and its header is
+// written last: a power cut at any point leaves one complete, valid sector.
+// The superseded sector is erased later from loop() by kvService().
+//
+// Flash offsets come from the linker script; the native build supplies its own.
+#ifndef FLASH_FS_END
+extern "C" uint32_t _FS_end;
+extern "C" uint32_t _EEPROM_start;
+#define FLASH_FS_END ((uint32_t)(uintptr_t)&_FS_end - 0x40200000)
+#define FLASH_EEPROM_START ((uint32_t)(uintptr_t)&_EEPROM_start - 0x40200000)
+#endif
+
+#define KV_SECTOR_SIZE 4096
+#define KV_MAGIC 0x564B4447 // "GDKV"
+#define KV_MAX_KEYS 16
+#define KV_MAX_VALUE 512
+
+enum KvKey : uint16_t {
+  KV_KEY_CONFIG = 1,    // ConfigBlob
+  KV_KEY_BASE_GAS = 2,  // Calibrated base gas value (int)
+  KV_KEY_WIFI_CACHE = 3, // WifiCache without the lease
+  KV_KEY_BOOT_PROFILES = 4, // BootProfileLog
+  KV_KEY_WEAR = 5       // uint32_t[2] erase counters, see kvService()
+};
 
-// Add a handler function for device reset
-void handleReset() {
-  server.send(200, F("text/html"), F("<html><body><h1>Resetting Device</h1><p>The device will now reset and all configurations will be wiped.</p></body></html>"));
-  delay(1000); // Give time for the response to be sent
+struct KvSectorHeader {
+  uint32_t magic;
+  uint32_t sequence;       // The valid sector with the higher sequence is active
+  uint32_t eraseCount[2];  // Wear counters for both sectors
+  uint32_t crc;            // CRC32 of the fields above
+};
 
-  printlnBoth(F("Performing factory reset..."));
+struct KvRecordHeader {
+  uint32_t crc;     // CRC32 of key, length and data
+  uint16_t key;
+  uint16_t length;  // 0 marks a removed key
+};
 
-  // Clear stored configurations - with error checking
-  if (LittleFS.exists("/config.json")) {
-    if (LittleFS.remove("/config.json")) {
-      printlnBoth(F("Config file deleted successfully"));
-    } else {
-      printlnBoth(F("Failed to delete config file"));
-    }
-  } else {
-    printlnBoth(F("Config file not found"));
+struct KvIndexEntry {
+  uint16_t key;
+  uint16_t offset;  // Record offset within the active sector
+};
+
+struct KvState {
+  bool ready;
+  bool spareClean;          // Spare sector verified blank, ready for compaction
+  uint8_t active;           // Active sector (0 or 1)
+  uint8_t keyCount;
+  uint32_t base;            // Flash offset of sector 0
+  uint32_t sequence;
+  uint32_t writeOffset;     // Next free byte in the active sector
+  uint32_t eraseCount[2];
+  uint32_t writes;
+  uint32_t compactions;
+  KvIndexEntry index[KV_MAX_KEYS];
+};
+KvState kv;
+uint32_t kvBuffer[(sizeof(KvRecordHeader) + KV_MAX_VALUE) / 4]; // Word-aligned for flash I/O
+
+uint32_t kvAlign(uint32_t length) {
+  return (length + 3) & ~3u;
+}
+
+uint32_t kvSectorAddress(uint8_t sector) {
+  return kv.base + sector * KV_SECTOR_SIZE;
+}
+
+bool kvEraseSector(uint8_t sector) {
+  kv.eraseCount[sector]++;
+  return ESP.flashEraseSector(kvSectorAddress(sector) / KV_SECTOR_SIZE);
+}
+
+bool kvReadSectorHeader(uint8_t sector, KvSectorHeader& header) {
+  ESP.flashRead(kvSectorAddress(sector), (uint32_t*)&header, sizeof(header));
+  return header.magic == KV_MAGIC && header.crc == crc32(&header, offsetof(KvSectorHeader, crc));
+}
+
+bool kvWriteSectorHeader(uint8_t sector, uint32_t sequence) {
+  KvSectorHeader header;
+  header.magic = KV_MAGIC;
+  header.sequence = sequence;
+  header.eraseCount[0] = kv.eraseCount[0];
+  header.eraseCount[1] = kv.eraseCount[1];
+  header.crc = crc32(&header, offsetof(KvSectorHeader, crc));
+  return ESP.flashWrite(kvSectorAddress(sector), (uint32_t*)&header, sizeof(header));
+}
+
+int kvIndexFind(uint16_t key) {
+  for (int i = 0; i < kv.keyCount; i++) {
+    if (kv.index[i].key == key) return i;
   }
-  
-  // Clear WiFi settings by removing the wifi config file
-  if (LittleFS.exists("/wifi_cred.dat")) {
-    if (LittleFS.remove("/wifi_cred.dat")) {
-      printlnBoth(F("WiFi credentials file deleted successfully"));
-    } else {
-      printlnBoth(F("Failed to delete WiFi credentials file"));
+  return -1;
+}
+
+void kvIndexPut(uint16_t key, uint16_t offset) {
+  int i = kvIndexFind(key);
+  if (i < 0) {
+    if (kv.keyCount >= KV_MAX_KEYS) return;
+    i = kv.keyCount++;
+    kv.index[i].key = key;
+  }
+  kv.index[i].offset = offset;
+}
+
+// Reads the record at offset of the active sector into kvBuffer and returns
+// false if its checksum does not match (a write torn by a power cut)
+bool kvLoadRecord(uint32_t offset, KvRecordHeader& header) {
+  KvRecordHeader* record = (KvRecordHeader*)kvBuffer;
+  ESP.flashRead(kvSectorAddress(kv.active) + offset, kvBuffer, sizeof(KvRecordHeader));
+  header = *record;
+  if (header.length > KV_MAX_VALUE) return false;
+  if (header.length > 0) {
+    ESP.flashRead(kvSectorAddress(kv.active) + offset + sizeof(KvRecordHeader), kvBuffer + sizeof(KvRecordHeader) / 4, kvAlign(header.length));
+  }
+  return header.crc == crc32(&record->key, 4 + header.length);
+}
+
+// Rebuilds the index by walking the log of the active sector
+void kvScan() {
+  kv.keyCount = 0;
+  uint32_t offset = sizeof(KvSectorHeader);
+  while (offset + sizeof(KvRecordHeader) <= KV_SECTOR_SIZE) {
+    KvRecordHeader record;
+    ESP.flashRead(kvSectorAddress(kv.active) + offset, (uint32_t*)&record, sizeof(record));
+    if (record.crc == 0xFFFFFFFF && record.key == 0xFFFF && record.length == 0xFFFF) {
+      break; // Erased flash: end of the log
     }
-  } else {
-    printlnBoth(F("WiFi credentials file not found"));
+    uint32_t next = offset + sizeof(KvRecordHeader) + kvAlign(record.length);
+    if (record.length > KV_MAX_VALUE || next > KV_SECTOR_SIZE) {
+      // Torn header from a power cut: nothing past here is usable, so force a
+      // compaction before the next write
+      offset = KV_SECTOR_SIZE;
+      break;
+    }
+    if (kvLoadRecord(offset, record)) {
+      kvIndexPut(record.key, offset);
+    }
+    offset = next;
   }
-  
-  // Ensure the filesystem has time to complete operations
-  LittleFS.end();
-  delay(500);
-  
-  // Explicitly clear WiFi settings in memory
-  WiFi.disconnect(true);  // disconnect and delete credentials
-  
-  // Wait for WiFi disconnect to complete
-  printlnBoth(F("Disconnecting WiFi..."));
-  delay(1000);
-  
-  // Erase config and reset
-  printlnBoth(F("Erasing configuration and restarting..."));
-  ESP.eraseConfig();
-  delay(1000);
-  ESP.restart();
+  kv.writeOffset = offset;
 }
 
-void handleResetWiFi() {
-  server.send(200, F("text/html"), F("<html><body><h1>Resetting WiFi Settings</h1><p>The device will now reset WiFi settings and reboot.</p></body></html>"));
-  delay(1000); // Give time for the response to be sent
-  WiFi.disconnect(true); // Disconnect from Wi-Fi
-  ESP.eraseConfig(); // Erase all Wi-Fi and network-related settings
-  printlnBoth(F("Resetting WiFi settings..."));
+bool kvFormat(uint8_t sector, uint32_t sequence) {
+  if (!kvEraseSector(sector) || !kvWriteSectorHeader(sector, sequence)) return false;
+  kv.active = sector;
+  kv.sequence = sequence;
+  kv.writeOffset = sizeof(KvSectorHeader);
+  kv.keyCount = 0;
+  kv.spareClean = false;
+  return true;
+}
 
-  // Clear WiFi settings by removing the WiFi credentials file
-  if (LittleFS.exists("/wifi_cred.dat")) {
-    if (LittleFS.remove("/wifi_cred.dat")) {
-      printlnBoth(F("WiFi credentials file deleted successfully"));
-    } else {
-      printlnBoth(F("Failed to delete WiFi credentials file"));
+bool kvBegin() {
+  uint32_t fsEnd = FLASH_FS_END;
+  uint32_t eepromStart = FLASH_EEPROM_START;
+  kv.base = eepromStart + KV_SECTOR_SIZE - 2 * KV_SECTOR_SIZE;
+  if (kv.base < fsEnd) {
+    LOG_I(SYS, "KV store: no reserved flash region, using LittleFS");
+    return false;
+  }
+
+  KvSectorHeader headers[2];
+  bool valid[2];
+  for (uint8_t i = 0; i < 2; i++) {
+    valid[i] = kvReadSectorHeader(i, headers[i]);
+  }
+  if (!valid[0] && !valid[1]) {
+    LOG_I(SYS, "KV store: formatting");
+    kv.eraseCount[0] = kv.eraseCount[1] = 0;
+    if (!kvFormat(0, 1)) {
+      LOG_W(SYS, "KV store: format failed, using LittleFS");
+      return false;
     }
   } else {
-    printlnBoth(F("WiFi credentials file not found"));
+    kv.active = (valid[0] && (!valid[1] || (int32_t)(headers[0].sequence - headers[1].sequence) > 0)) ? 0 : 1;
+    kv.sequence = headers[kv.active].sequence;
+    kv.eraseCount[0] = headers[kv.active].eraseCount[0];
+    kv.eraseCount[1] = headers[kv.active].eraseCount[1];
+    kv.spareClean = false;
+    kvScan();
+    // Erases by kvService() are newer than the header's counters
+    int wear = kvIndexFind(KV_KEY_WEAR);
+    KvRecordHeader record;
+    if (wear >= 0 && kvLoadRecord(kv.index[wear].offset, record) && record.length == sizeof(kv.eraseCount)) {
+      const uint32_t* counts = kvBuffer + sizeof(KvRecordHeader) / 4;
+      kv.eraseCount[0] = std::max(kv.eraseCount[0], counts[0]);
+      kv.eraseCount[1] = std::max(kv.eraseCount[1], counts[1]);
+    }
   }
+  kv.ready = true;
+  LOG_I(SYS, "KV store: sector %d active, %d keys, %lu bytes used", kv.active, kv.keyCount, kv.writeOffset);
+  return true;
+}
 
- 
-  // Wait for WiFi disconnect to complete
-  delay(1000);
+// Copies the live records into the spare sector and makes it active
+bool kvCompact() {
+  uint8_t target = kv.active ^ 1;
+  if (!kv.spareClean && !kvEraseSector(target)) return false;
+
+  KvIndexEntry newIndex[KV_MAX_KEYS];
+  uint8_t newCount = 0;
+  uint32_t offset = sizeof(KvSectorHeader);
+  for (int i = 0; i < kv.keyCount; i++) {
+    KvRecordHeader record;
+    if (!kvLoadRecord(kv.index[i].offset, record) || record.length == 0) continue; // Removed keys are dropped here
+    uint32_t size = sizeof(KvRecordHeader) + kvAlign(record.length);
+    if (!ESP.flashWrite(kvSectorAddress(target) + offset, kvBuffer, size)) return false;
+    newIndex[newCount].key = record.key;
+    newIndex[newCount].offset = offset;
+    newCount++;
+    offset += size;
+  }
+  // Commit point: the new sector becomes valid once its header is written
+  if (!kvWriteSectorHeader(target, kv.sequence + 1)) return false;
+
+  kv.active = target;
+  kv.sequence++;
+  kv.writeOffset = offset;
+  kv.keyCount = newCount;
+  memcpy(kv.index, newIndex, sizeof(KvIndexEntry) * newCount);
+  kv.spareClean = false;
+  kv.compactions++;
+  return true;
+}
 
-  // Restart the device
-  ESP.restart();
+// Returns the stored length of key (copying at most size bytes), or -1
+int kvRead(uint16_t key, void* data, size_t size) {
+  if (!kv.ready) return -1;
+  int i = kvIndexFind(key);
+  if (i < 0) return -1;
+  KvRecordHeader record;
+  if (!kvLoadRecord(kv.index[i].offset, record) || record.length == 0) return -1;
+  memcpy(data, kvBuffer + sizeof(KvRecordHeader) / 4, std::min((size_t)record.length, size));
+  return record.length;
 }
 
-void handleResetCalibration() {
-  server.send(200, F("text/html"), F("<html><body><h1>Resetting Calibration</h1><p>The device will now reset and calibration will be triggered.</p></body></html>"));
-  delay(1000); // Give time for the response to be sent
+bool kvAppend(uint16_t key, const void* data, size_t length) {
+  uint32_t size = sizeof(KvRecordHeader) + kvAlign(length);
+  if (kv.writeOffset + size > KV_SECTOR_SIZE) {
+    if (!kvCompact() || kv.writeOffset + size > KV_SECTOR_SIZE) {
+      LOG_W(SYS, "KV store: out of space");
+      return false;
+    }
+  }
+  KvRecordHeader* record = (KvRecordHeader*)kvBuffer;
+  memset(kvBuffer, 0xFF, size);
+  record->key = key;
+  record->length = length;
+  if (length > 0) {
+    memcpy(kvBuffer + sizeof(KvRecordHeader) / 4, data, length);
+  }
+  record->crc = crc32(&record->key, 4 + length);
+  if (!ESP.flashWrite(kvSectorAddress(kv.active) + kv.writeOffset, kvBuffer, size)) return false;
+  kvIndexPut(key, kv.writeOffset);
+  kv.writeOffset += size;
+  kv.writes++;
+  return true;
+}
 
-  // Reset baseGasValue to -1 to trigger calibration
-  config.baseGasValue = -1;
-  saveConfig();
+bool kvWrite(uint16_t key, const void* data, size_t length) {
+  if (!kv.ready || length == 0 || length > KV_MAX_VALUE) return false;
+  int i = kvIndexFind(key);
+  if (i >= 0) {
+    // Skip rewriting an unchanged value
+    KvRecordHeader record;
+    if (kvLoadRecord(kv.index[i].offset, record) && record.length == length && memcmp(kvBuffer + sizeof(KvRecordHeader) / 4, data, length) == 0) return true;
+  }
+  return kvAppend(key, data, length);
+}
 
-  // Restart the device
-  ESP.restart();
+bool kvRemove(uint16_t key) {
+  if (!kv.ready || kvIndexFind(key) < 0) return true;
+  return kvAppend(key, nullptr, 0);
 }
 
-void handleRestart() {
-  server.send(200, F("text/html"), F("<html><body><h1>Restarting Device</h1><p>The device will now restart.</p></body></html>"));
-  delay(1000); // Give time for the response to be sent
+// Erases all stored state (factory reset)
+void kvWipe() {
+  if (!kv.ready) return;
+  kvEraseSector(kv.active ^ 1);
+  kvFormat(kv.active, kv.sequence + 1);
+  kv.spareClean = true;
+}
 
-  // Restart the device
-  ESP.restart();
+// Called from loop(): prepares the spare sector for the next compaction so
+// the erase never happens inside a write
+void kvService() {
+  if (!kv.ready || kv.spareClean) return;
+  uint8_t spare = kv.active ^ 1;
+  bool blank = true;
+  for (uint32_t offset = 0; offset < KV_SECTOR_SIZE && blank; offset += 256) {
+    ESP.flashRead(kvSectorAddress(spare) + offset, kvBuffer, 256);
+    for (int i = 0; i < 64; i++) {
+      if (kvBuffer[i] != 0xFFFFFFFF) {
+        blank = false;
+        break;
+      }
+    }
+  }
+  kv.spareClean = true;
+  if (!blank) {
+    // No sector header write follows this erase, so the counters go into a
+    // record of the active sector instead
+    kvEraseSector(spare);
+    kvAppend(KV_KEY_WEAR, kv.eraseCount, sizeof(kv.eraseCount));
+  }
 }
 
-void setupMQTT() {
-    loadMQTTConfig();
-    if (mqttConfig.isEmpty()) {
-        printBoth(F("No MQTT configuration found - MQTT disabled"));
+void sendNotification(bool isAlert) {
+    if (!(WiFi.status() == WL_CONNECTED) || !config.ntfyEnabled) {
+        LOG_I(NOTIFY, "WiFi not connected or ntfy notifications disabled, skipping notification");
         return;
     }
-    // Use device name or fallback to MAC for client ID and topic
-    String hostname = String(config.deviceName);
-    if (hostname.length() == 0) {
-        hostname = WiFi.macAddress();
-        hostname.replace(":", "");
+   
+    // Use the same approach as sendStartupNotification
+    WiFiClient client; // Use regular WiFiClient instead of secure client for HTTP
+    HTTPClient http;
+    char url[40];
+    snprintf_P(url, sizeof(url), PSTR("http://ntfy.sh/%s"), config.topicName);
+    
+    // HTTPClient keeps its own String copy of the URL; begin() only takes a String
+    if (!http.begin(client, String(url))) {
+        LOG_W(NOTIFY, "Failed to begin HTTP client");
+        return;
     }
-    hostname.toLowerCase();
-    mqttClient.setServer(mqttConfig.mqtt_server, mqttConfig.mqtt_port);
-    // Set callback if you want to handle incoming messages
-    // mqttClient.setCallback(mqttCallback);
-    printfBoth(PSTR("Attempting to connect to MQTT broker as %s..."), hostname.c_str());
-    if (mqttClient.connect(hostname.c_str(), mqttConfig.mqtt_user, mqttConfig.mqtt_password)) {
-        printBoth(F("MQTT Connected Successfully"));
-        publishDiscoveryConfig(); // Use the clean discovery function only
-        // Subscribe to command topic for future remote control
-        mqttClient.subscribe((F("homeassistant/") + hostname + F("/command")).c_str());
+    http.addHeader(F("Title"), F("Gas Detector Alert"));
+    http.addHeader(F("Content-Type"), F("text/plain"));
+    
+    const char* message = isAlert ? ALERT_MESSAGE : NORMAL_MESSAGE;
+    traceBegin(TRACE_MARK + MARK_HTTP_POST);
+    int httpResponseCode = http.POST(message);
+    traceEnd(TRACE_MARK + MARK_HTTP_POST);
+    
+    if (httpResponseCode > 0) {
+        LOG_I(NOTIFY, "Notification sent successfully, HTTP code: %d", httpResponseCode);
     } else {
-        int state = mqttClient.state();
-        String errorMsg = F("Initial MQTT connection failed, state: ");
-        switch (state) {
-            case -4: errorMsg += F("MQTT_CONNECTION_TIMEOUT"); break;
-            case -3: errorMsg += F("MQTT_CONNECTION_LOST"); break;
-            case -2: errorMsg += F("MQTT_CONNECT_FAILED"); break;
-            case -1: errorMsg += F("MQTT_DISCONNECTED"); break;
-            case 1: errorMsg += F("MQTT_CONNECT_BAD_PROTOCOL"); break;
-            case 2: errorMsg += F("MQTT_CONNECT_BAD_CLIENT_ID"); break;
-            case 3: errorMsg += F("MQTT_CONNECT_UNAVAILABLE"); break;
-            case 4: errorMsg += F("MQTT_CONNECT_BAD_CREDENTIALS"); break;
-            case 5: errorMsg += F("MQTT_CONNECT_UNAUTHORIZED"); break;
-            default: errorMsg += String(state);
-        }
-        printBoth(errorMsg);
-        printBoth(F("Will retry in main loop"));
+        LOG_W(NOTIFY, "Notification Failed, HTTP error: %s", http.errorToString(httpResponseCode).c_str());
     }
+    
+    http.end();
 }
 
-void reconnectMQTT() {
-    loadMQTTConfig();
-    if (mqttConfig.isEmpty()) return;
-    String hostname = String(config.deviceName);
-    if (hostname.length() == 0) {
-        hostname = WiFi.macAddress();
-        hostname.replace(":", "");
-    }
-    hostname.toLowerCase();
-    if (mqttClient.connected()) return;
-    printfBoth(PSTR("Attempting MQTT connection as %s..."), hostname.c_str());
-    if (mqttClient.connect(hostname.c_str(), mqttConfig.mqtt_user, mqttConfig.mqtt_password)) {
-        printBoth(F("Connected to MQTT broker"));
-        publishDiscoveryConfig(); // Use the clean discovery function only
-        // Subscribe to command topic
-        mqttClient.subscribe((F("homeassistant/") + hostname + F("/command")).c_str());
-    } else {
-        int state = mqttClient.state();
-        String errorMsg = F("Connection failed, state: ");
-        switch (state) {
-            case -4: errorMsg += F("MQTT_CONNECTION_TIMEOUT"); break;
-            case -3: errorMsg += F("MQTT_CONNECTION_LOST"); break;
-            case -2: errorMsg += F("MQTT_CONNECT_FAILED"); break;
-            case -1: errorMsg += F("MQTT_DISCONNECTED"); break;
-            case 1: errorMsg += F("MQTT_CONNECT_BAD_PROTOCOL"); break;
-            case 2: errorMsg += F("MQTT_CONNECT_BAD_CLIENT_ID"); break;
-            case 3: errorMsg += F("MQTT_CONNECT_UNAVAILABLE"); break;
-            case 4: errorMsg += F("MQTT_CONNECT_BAD_CREDENTIALS"); break;
-            case 5: errorMsg += F("MQTT_CONNECT_UNAUTHORIZED"); break;
-            default: errorMsg += String(state);
-        }
-        printBoth(errorMsg);
-        printBoth(F("Will try again later"));
+void sendStartupNotification() {
+    if (!(WiFi.status() == WL_CONNECTED) || !config.ntfyEnabled) {
+        LOG_I(NOTIFY, "WiFi not connected or ntfy notifications disabled, skipping startup notification");
+        return;
     }
-}
+    // Prepare message
+    IPAddress ip = WiFi.localIP();
+    float ppm = analogRead(gasSensorPin) - config.baseGasValue;
+    if (ppm < 0) ppm = 0; // Ensure no negative values
+    char msg[160];
+    int length = snprintf_P(msg, sizeof(msg), PSTR("Device started!\nIP: %u.%u.%u.%u\nMDNS: http://%s.local/\nCurrent PPM: %.1f"),
+                            ip[0], ip[1], ip[2], ip[3], deviceHostname, ppm);
+    length = min(length, (int)sizeof(msg) - 1);
 
-void publishMQTTData(float gasValue) {
-    if (mqttConfig.isEmpty()) return;
-    String hostname = String(config.deviceName);
-    if (hostname.length() == 0) {
-        hostname = WiFi.macAddress();
-        hostname.replace(":", "");
-    }
-    hostname.toLowerCase();
-    if (!mqttClient.connected()) {
-        printBoth(F("MQTT disconnected, attempting to reconnect..."));
-        if (mqttClient.connect(hostname.c_str(), mqttConfig.mqtt_user, mqttConfig.mqtt_password)) {
-            printBoth(F("connected"));
+    // Send to ntfy using consistent approach
+    WiFiClient client;
+    HTTPClient http;
+    char url[40];
+    snprintf_P(url, sizeof(url), PSTR("http://ntfy.sh/%s"), config.topicName);
+    if (http.begin(client, String(url))) {
+        http.addHeader(F("Title"), F("Gas Detector Online"));
+        http.addHeader(F("Content-Type"), F("text/plain"));
+        traceBegin(TRACE_MARK + MARK_HTTP_POST);
+        int code = http.POST((uint8_t*)msg, length);
+        traceEnd(TRACE_MARK + MARK_HTTP_POST);
+        if (code > 0) {
+            LOG_I(NOTIFY, "Startup notification sent, HTTP code: %d", code);
         } else {
-            printBoth(F("failed"));
-            return;
+            LOG_W(NOTIFY, "Startup notification failed, HTTP error: %s", http.errorToString(code).c_str());
         }
+        http.end();
+    } else {
+        LOG_W(NOTIFY, "Failed to begin HTTP client for startup notification");
     }
-    mqttClient.loop();
-    String topic = F("homeassistant/sensor/") + hostname + F("/gas/state");
-    String gasValueStr = String(gasValue, 1); // Format to 1 decimal place
-    bool published = mqttClient.publish(topic.c_str(), gasValueStr.c_str(), true);
-    printfBoth(PSTR("MQTT publish %s: topic=%s, value=%s\n"), published ? F("SUCCESS") : F("FAILED"), topic.c_str(), gasValueStr.c_str());
 }
 
-// Publishes Home Assistant discovery config for the gas sensor
-void publishDiscoveryConfig() {
-    String hostname = String(config.deviceName);
-    hostname.toLowerCase();
-    hostname.replace(F("."), F("_"));
-    for (size_t i = 0; i < hostname.length(); i++) {
-        if (!isalnum(hostname[i]) && hostname[i] != '_') hostname[i] = '_';
-    }
-    String configTopic = F("homeassistant/sensor/") + hostname + F("/gas/config");
-    String stateTopic = F("homeassistant/sensor/") + hostname + F("/gas/state");
-    // Do NOT use device_class: gas if using ppm as unit
-    String configPayload = F("{");
-    configPayload += F("\"name\":\"") + hostname + F(" Gas Sensor\",");
-    configPayload += F("\"state_topic\":\"") + stateTopic + F("\",");
-    configPayload += F("\"unit_of_measurement\":\"ppm\",");
-    configPayload += F("\"unique_id\":\"") + hostname + F("_gas\"}");
-    bool pubSuccess = mqttClient.publish(configTopic.c_str(), configPayload.c_str(), true);
-    printfBoth(PSTR("MQTT: Discovery config publish %s\n"), pubSuccess ? F("successful") : F("failed"));
-    printfBoth(PSTR("Config topic: %s\n"), configTopic.c_str());
-    printfBoth(PSTR("Config payload: %s\n"), configPayload.c_str());
+void IRAM_ATTR storeGasReading(float gasReading) {
+  // Shift elements to the left
+  for (int i = 1; i < BUFFER_SIZE; i++) {
+    gasDataBuffer[i - 1] = gasDataBuffer[i];
+  }
+  // Add new reading to the end
+  gasDataBuffer[BUFFER_SIZE - 1] = gasReading;
 }
 
-void handleRoot() {
-  String html = F("<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'>");
-  html += F("<style>");
-  html += F("body { font-family: Arial, sans-serif; margin: 0; padding: 0; background: #f4f4f9; color: #333; }"
-            "h1, h2 { text-align: center; color: #444; }"
-            "form, .info-section, .danger-zone { max-width: 90%; margin: 1em auto; padding: 1em; background: #fff; border-radius: 5px; box-shadow: 0 2px 5px rgba(0,0,0,0.1); }"
-            "input[type='text'], input[type='password'], input[type='number'] { width: 100%; padding: 0.7em; margin: 0.5em 0; border: 1px solid #ccc; border-radius: 3px; box-sizing: border-box; }"
-            "input[type='submit'], button { width: 100%; background: #007BFF; color: white; border: none; padding: 0.7em; border-radius: 3px; cursor: pointer; font-size: 1em; }"
-            "input[type='submit']:hover, button:hover { background: #0056b3; }"
-            ".danger-button { background: #dc3545; }"
-            ".danger-button:hover { background: #c82333; }"
-            ".info-section p, .danger-zone p { margin: 0.5em 0; }"
-            ".info-section strong, .danger-zone strong { display: inline-block; width: 50%; }"
-            ".mqtt-settings { display: none; }"
-  );
-  html += F("</style>");
+void addGasReading(float gasReading) {
+  storeGasReading(gasReading);
+}
 
-  html += F("<script>");
-  html += F("function toggleMqttSettings() {"
-            "  var mqttDiv = document.getElementById('mqttSettings');"
-            "  var enabled = document.getElementById('mqttEnabled').checked;"
-            "  mqttDiv.style.display = enabled ? 'block' : 'none';"
-            "}"
-            "function confirmReset() {"
-            "  return confirm('WARNING: This will erase all settings including WiFi credentials and reboot the device. Continue?');"
-            "}"
-            "</script></head><body>");
+// Per-sample kernels. These run on every reading and on the alarm path, so
+// they live in IRAM: their timing must not depend on whether WiFi code has
+// just evicted them from the flash instruction cache. Keep them small and
+// free of flash-resident calls: scheduler bookkeeping such as taskWake()
+// belongs in the flash-side caller, as addGasReading() wraps
+// storeGasReading(). /cache-bench measures them cold and warm.
+
+// Insertion sort into sorted, median returned. Readings are never negative,
+// so their IEEE bit patterns sort like the values and no soft-float compare
+// is needed.
+float IRAM_ATTR medianFilter(const float* data, float* sorted, int size) {
+  for (int i = 0; i < size; i++) {
+    float value = data[i];
+    int32_t key;
+    memcpy(&key, &value, sizeof(key));
+    int j = i;
+    for (; j > 0; j--) {
+      int32_t previous;
+      memcpy(&previous, &sorted[j - 1], sizeof(previous));
+      if (previous <= key) break;
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = value;
+  }
+  int mid = size / 2;
+  return (size % 2 == 0) ? (sorted[mid - 1] + sorted[mid]) / 2.0f : sorted[mid];
+}
 
-  html += F("<h1>Device Configuration</h1>");
-  html += F("<form action='/save' method='POST'>");
-  html += F("<label for='deviceName'>Device Name:</label>");
-  html += "<input type='text' id='deviceName' name='deviceName' value='" + String(config.deviceName) + F("'><br>");
-
-  html += F("<label for='mqttEnabled'>Enable MQTT:</label>");
-  html += "<input type='checkbox' id='mqttEnabled' name='mqttEnabled' value='1' onchange='toggleMqttSettings()'";
-  if (config.mqttEnabled) {
-    html += F(" checked");
-  }
-  html += F("><br>");
-
-  html += "<div id='mqttSettings' class='mqtt-settings' style='display: " + String(config.mqttEnabled ? F("block") : F("none")) + F(";'>");
-  html += F("<label for='mqtt_server'>MQTT Server:</label>");
-  html += "<input type='text' id='mqtt_server' name='mqtt_server' value='" + String(config.mqttServer) + F("'><br>");
-  html += F("<label for='mqtt_user'>MQTT User:</label>");
-  html += "<input type='text' id='mqtt_user' name='mqtt_user' value='" + String(config.mqttUser) + F("'><br>");
-  html += F("<label for='mqtt_password'>MQTT Password:</label>");
-  html += "<input type='password' id='mqtt_password' name='mqtt_password' value='" + String(config.mqttPassword) + F("'><br>");
-  html += F("<label for='mqtt_port'>MQTT Port:</label>");
-  html += "<input type='number' id='mqtt_port' name='mqtt_port' value='" + String(config.mqttPort) + F("'><br>");
-  html += F("</div>");
+float calculateMedian(float data[], int size) {
+  float temp[size];
+  float median = medianFilter(data, temp, size);
+  //print sorted values to telnet
+  if (LOG_ENABLED(SENSOR, LOG_LEVEL_DEBUG) && logSinks(LOG_TO_TELNET)) {
+#ifdef LOG_BINARY
+    LOG_D_TELNET(SENSOR, "Sorted values: %[.2f]", LogFloats{ temp, (uint8_t)size });
+#else
+    char line[200];
+    size_t length = strlcpy_P(line, PSTR("Sorted values: "), sizeof(line));
+    for (int i = 0; i < size && length < sizeof(line); i++) {
+      length += snprintf_P(line + length, sizeof(line) - length, PSTR("[%.2f]"), temp[i]);
+    }
+    printfTelnet(PSTR("%s\n"), line);
+#endif
+  }
+  return median;
+}
 
-  html += F("<label for='thresholdLimit'>Gas Threshold (ppm):</label>");
-  html += "<input type='number' id='thresholdLimit' name='thresholdLimit' value='" + String(config.thresholdLimit) + F("'><br>");
-  html += F("<label for='thresholdDuration'>Duration (s):</label>");
-  html += "<input type='number' id='thresholdDuration' name='thresholdDuration' value='" + String(config.thresholdDuration) + F("'><br>");
+void setConfigDefaults(Config& cfg) {
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    void* value = configFieldPtr(cfg, field);
+    switch (field.type) {
+      case CFG_STR:  memset(value, 0, field.size); break;
+      case CFG_INT:  *(int*)value = field.defaultValue; break;
+      case CFG_BOOL: *(bool*)value = field.defaultValue != 0; break;
+    }
+  }
+}
 
-  html += F("<label for='ntfyEnabled'>Enable NTFY Notifications:</label>");
-  html += "<input type='checkbox' id='ntfyEnabled' name='ntfyEnabled' value='1'";
-  if (config.ntfyEnabled) {
-    html += F(" checked");
+// Returns true if any field carrying the given flag differs between a and b
+bool configFieldsChanged(Config& a, Config& b, uint8_t flag) {
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & flag)) continue;
+    bool differs = field.type == CFG_STR
+        ? strcmp((const char*)configFieldPtr(a, field), (const char*)configFieldPtr(b, field)) != 0
+        : memcmp(configFieldPtr(a, field), configFieldPtr(b, field), field.size) != 0;
+    if (differs) {
+      return true;
+    }
   }
-  html += F("><br>");
+  return false;
+}
 
-  html += F("<label for='topicName'>Notification Topic:</label>");
-  html += "<input type='text' id='topicName' name='topicName' value='" + String(config.topicName) + F("' readonly><br>");
+// Binary config record stored in the KV store. Each persisted field is
+// written as [field id (2)][length (1)][value], where the id is derived from
+// the field name, so fields can be added or removed without a format change.
+#define CONFIG_BLOB_SIZE 320
 
-  html += F("<input type='submit' value='Save'>");
-  html += F("</form>");
+uint16_t configFieldId(const ConfigField& field) {
+  char name[32];
+  strlcpy_P(name, field.name, sizeof(name));
+  return crc32(name, strlen(name)) & 0xFFFF;
+}
 
-  html += F("<div class='info-section'>");
+size_t encodeConfig(const Config& cfg, uint8_t* out, size_t capacity) {
+  size_t length = 0;
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & CFG_PERSIST)) continue;
+    const uint8_t* value = (const uint8_t*)&cfg + field.offset;
+    size_t valueLength = field.type == CFG_STR ? strlen((const char*)value) : field.size;
+    if (length + 3 + valueLength > capacity) return 0;
+    uint16_t id = configFieldId(field);
+    out[length++] = id & 0xFF;
+    out[length++] = id >> 8;
+    out[length++] = valueLength;
+    memcpy(out + length, value, valueLength);
+    length += valueLength;
+  }
+  return length;
+}
+
+void decodeConfig(Config& cfg, const uint8_t* in, size_t length) {
+  size_t pos = 0;
+  while (pos + 3 <= length) {
+    uint16_t id = in[pos] | (in[pos + 1] << 8);
+    size_t valueLength = in[pos + 2];
+    const uint8_t* value = in + pos + 3;
+    pos += 3 + valueLength;
+    if (pos > length) break;
+    for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+      ConfigField field = readConfigField(i);
+      if (!(field.flags & CFG_PERSIST) || configFieldId(field) != id) continue;
+      void* target = configFieldPtr(cfg, field);
+      if (field.type == CFG_STR && valueLength < field.size) {
+        memcpy(target, value, valueLength);
+        ((char*)target)[valueLength] = '\0';
+      } else if (field.type == CFG_INT && valueLength == sizeof(int)) {
+        int intValue;
+        memcpy(&intValue, value, sizeof(intValue));
+        if (intValue >= field.minValue && intValue <= field.maxValue) *(int*)target = intValue;
+      } else if (field.type == CFG_BOOL && valueLength == sizeof(bool)) {
+        *(bool*)target = value[0] != 0;
+      }
+      break;
+    }
+  }
+}
+
+bool saveConfigJson(Config& cfg, const char* path) {
+  File configFile = LittleFS.open(path, "w");
+  if (!configFile) {
+    LOG_W(SYS, "Failed to open config file for writing");
+    return false;
+  }
+
+  JsonDocument json;
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & CFG_PERSIST)) continue;
+    void* value = configFieldPtr(cfg, field);
+    switch (field.type) {
+      case CFG_STR:  json[FPSTR(field.name)] = (const char*)value; break;
+      case CFG_INT:  json[FPSTR(field.name)] = *(int*)value; break;
+      case CFG_BOOL: json[FPSTR(field.name)] = *(bool*)value; break;
+    }
+  }
+
+  bool written = serializeJson(json, configFile) > 0;
+  configFile.close();
+  return written;
+}
+
+void saveConfig() {
+  bool saved;
+  if (kv.ready) {
+    uint8_t blob[CONFIG_BLOB_SIZE];
+    size_t length = encodeConfig(config, blob, sizeof(blob));
+    saved = length > 0 && kvWrite(KV_KEY_CONFIG, blob, length);
+  } else {
+    saved = saveConfigJson(config, "/config.json");
+  }
+  if (saved) {
+    LOG_I(SYS, "Configuration saved successfully");
+  } else {
+    LOG_W(SYS, "Failed to write configuration");
+  }
+}
+
+// Calibration results are stored on their own so that updating the baseline
+// is a 4-byte record rather than a full config write
+void saveBaseGasValue(int value) {
+  config.baseGasValue = value;
+  if (!kv.ready || !kvWrite(KV_KEY_BASE_GAS, &value, sizeof(value))) {
+    saveConfig();
+  }
+}
+
+// Older firmware kept the broker settings in a separate /mqtt_config.json.
+// Fold them into the main config once and drop the old file.
+void migrateLegacyMQTTConfig() {
+  if (!LittleFS.exists("/mqtt_config.json")) return;
+  File legacyFile = LittleFS.open("/mqtt_config.json", "r");
+  if (legacyFile) {
+    JsonDocument doc;
+    if (!deserializeJson(doc, legacyFile) && (doc[F("server")] | "")[0] != '\0') {
+      strlcpy(config.mqttServer, doc[F("server")] | "", sizeof(config.mqttServer));
+      config.mqttPort = doc[F("port")] | 1883;
+      strlcpy(config.mqttUser, doc[F("user")] | "", sizeof(config.mqttUser));
+      strlcpy(config.mqttPassword, doc[F("password")] | "", sizeof(config.mqttPassword));
+    }
+    legacyFile.close();
+  }
+  LittleFS.remove("/mqtt_config.json");
+  LOG_I(MQTT, "Migrated MQTT settings from /mqtt_config.json");
+  saveConfig();
+}
+
+void printConfig() {
+  LOG_I(SYS, "Loaded configuration:");
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    void* value = configFieldPtr(config, field);
+    switch (field.type) {
+      case CFG_STR:
+        LOG_I(SYS, "%s: %s", FPSTR(field.label), (field.flags & CFG_SECRET) ? "****" : (const char*)value);
+        break;
+      case CFG_INT:
+        LOG_I(SYS, "%s: %d", FPSTR(field.label), *(int*)value);
+        break;
+      case CFG_BOOL:
+        LOG_I(SYS, "%s: %s", FPSTR(field.label), *(bool*)value ? "true" : "false");
+        break;
+    }
+  }
+}
+
+bool loadConfigJson(Config& cfg, const char* path) {
+  File configFile = LittleFS.open(path, "r");
+  if (!configFile) {
+    LOG_W(SYS, "Failed to open config file");
+    return false;
+  }
+
+  JsonDocument json;
+  DeserializationError error = deserializeJson(json, configFile);
+  configFile.close();
+  if (error) {
+    LOG_W(SYS, "Failed to parse config file");
+    return false;
+  }
+
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & CFG_PERSIST)) continue;
+    void* value = configFieldPtr(cfg, field);
+    switch (field.type) {
+      case CFG_STR:
+        strlcpy((char*)value, json[FPSTR(field.name)] | "", field.size);
+        break;
+      case CFG_INT: {
+        int intValue = json[FPSTR(field.name)] | (int)field.defaultValue;
+        // Out-of-range values fall back to the default rather than being used
+        *(int*)value = (intValue >= field.minValue && intValue <= field.maxValue) ? intValue : field.defaultValue;
+        break;
+      }
+      case CFG_BOOL:
+        *(bool*)value = json[FPSTR(field.name)] | (field.defaultValue != 0);
+        break;
+    }
+  }
+  return true;
+}
+
+void loadConfig() {
+  setConfigDefaults(config);
+
+  uint8_t blob[CONFIG_BLOB_SIZE];
+  int length = kvRead(KV_KEY_CONFIG, blob, sizeof(blob));
+  if (length > 0) {
+    decodeConfig(config, blob, std::min((size_t)length, sizeof(blob)));
+  } else if (loadConfigJson(config, "/config.json") && kv.ready) {
+    // Settings from older firmware: move them into the KV store
+    LOG_I(SYS, "Migrating /config.json to KV store");
+    saveConfig();
+    LittleFS.remove("/config.json");
+  }
+  migrateLegacyMQTTConfig();
+
+  int baseGasValue;
+  if (kvRead(KV_KEY_BASE_GAS, &baseGasValue, sizeof(baseGasValue)) == sizeof(baseGasValue)) {
+    config.baseGasValue = baseGasValue;
+  }
+
+  // Always set topicName to GasDetect_Macaddress (no colons)
+  String mac = WiFi.macAddress();
+  mac.replace(":", ""); // Remove colons from MAC address
+  String ntfyChannel = F("GasDetect_") + mac.substring(mac.length() - 6);
+  strlcpy(config.topicName, ntfyChannel.c_str(), sizeof(config.topicName));
+
+  //print all config values on serial
+  printConfig();
+}
+
+uint32_t wifiCacheCrc(WifiCache& cache) {
+  return crc32(cache.bssid, sizeof(WifiCache) - offsetof(WifiCache, bssid));
+}
+
+// Prefers the RTC copy. Its lease is only trusted after a warm reset: a
+// lease from before a longer outage may have been handed to another host.
+void loadWifiCache() {
+  ESP.rtcUserMemoryRead(RTC_WIFI_CACHE_OFFSET, (uint32_t*)&wifiCache, sizeof(wifiCache));
+  wifiCacheValid = wifiCache.magic == RTC_WIFI_CACHE_MAGIC && wifiCache.crc == wifiCacheCrc(wifiCache);
+  if (!wifiCacheValid) {
+    wifiCacheValid = kvRead(KV_KEY_WIFI_CACHE, &wifiCache, sizeof(wifiCache)) == sizeof(wifiCache) &&
+                     wifiCache.magic == RTC_WIFI_CACHE_MAGIC;
+  }
+  if (!wifiCacheValid || !warmStart) {
+    wifiCache.ip = 0;
+  }
+  if (wifiCacheValid) {
+    LOG_I(WIFI, "WiFi cache: channel %u, BSSID %02X:%02X:%02X:%02X:%02X:%02X%s", wifiCache.channel,
+               wifiCache.bssid[0], wifiCache.bssid[1], wifiCache.bssid[2],
+               wifiCache.bssid[3], wifiCache.bssid[4], wifiCache.bssid[5],
+               wifiCache.ip ? ", with lease" : "");
+  }
+}
+
+// Called from loop() once connected. The flash copy leaves out the lease, so
+// it only changes (and costs a flash write) when the access point does.
+void saveWifiCache() {
+  memset(&wifiCache, 0, sizeof(wifiCache));
+  wifiCache.magic = RTC_WIFI_CACHE_MAGIC;
+  memcpy(wifiCache.bssid, WiFi.BSSID(), sizeof(wifiCache.bssid));
+  wifiCache.channel = WiFi.channel();
+  wifiCache.crc = wifiCacheCrc(wifiCache);
+  if (kv.ready) kvWrite(KV_KEY_WIFI_CACHE, &wifiCache, sizeof(wifiCache));
+
+  wifiCache.ip = WiFi.localIP();
+  wifiCache.gateway = WiFi.gatewayIP();
+  wifiCache.subnet = WiFi.subnetMask();
+  wifiCache.dns = WiFi.dnsIP();
+  wifiCache.crc = wifiCacheCrc(wifiCache);
+  ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_OFFSET, (uint32_t*)&wifiCache, sizeof(wifiCache));
+  wifiCacheValid = true;
+}
+
+void clearWifiCache() {
+  uint32_t invalid = 0;
+  ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_OFFSET, &invalid, sizeof(invalid));
+  if (kv.ready) kvRemove(KV_KEY_WIFI_CACHE);
+  wifiCacheValid = false;
+}
+
+// Starts associating with the stored credentials without waiting. With a
+// valid cache this is a directed connect on the known channel and BSSID,
+// which skips the scan, and after a warm reset the cached lease skips DHCP.
+void beginWiFi(bool useCache) {
+  wifiDirected = useCache && wifiCacheValid;
+  wifiStaticLease = wifiDirected && wifiCache.ip != 0;
+  if (wifiStaticLease) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+  } else {
+    WiFi.config(0u, 0u, 0u); // DHCP
+  }
+
+  // The SDK would otherwise write the BSSID lock into its flash config
+  String ssid = WiFi.SSID();
+  String psk = WiFi.psk();
+  WiFi.persistent(false);
+  if (wifiDirected) {
+    WiFi.begin(ssid.c_str(), psk.c_str(), wifiCache.channel, wifiCache.bssid);
+  } else {
+    WiFi.begin(ssid.c_str(), psk.c_str());
+  }
+  WiFi.persistent(true);
+  wifiAssocStart = millis();
+}
+
+void scheduleWifiRetry() {
+  // Equal jitter: wait between half and all of the current backoff
+  unsigned long wait = wifiRetryDelay / 2 + ESP.random() % (wifiRetryDelay / 2 + 1);
+  wifiRetryAt = millis() + wait;
+  wifiRetryDelay = min(wifiRetryDelay * 2, WIFI_RETRY_INTERVAL);
+  wifiRetryState = WIFI_RETRY_WAIT;
+  LOG_I(WIFI, "Next WiFi attempt in %lu s", wait / 1000);
+}
+
+// Called every loop() pass once the boot sequence is done; never waits. The
+// SDK's own auto-reconnect keeps running during the backoff and simply wins
+// if it gets there first.
+void serviceWifiRetry() {
+  if (bootStage != BOOT_DONE) return;
+
+  switch (wifiRetryState) {
+    case WIFI_RETRY_IDLE:
+      if (WiFi.status() != WL_CONNECTED) {
+        LOG_I(WIFI, "WiFi down, continuing in offline mode");
+        wifiRetryCount = 0;
+        scheduleWifiRetry();
+      }
+      break;
+
+    case WIFI_RETRY_WAIT:
+      if ((long)(millis() - wifiRetryAt) >= 0) {
+        if (WiFi.SSID().length() == 0) {
+          scheduleWifiRetry(); // Nothing to connect to until the portal is used
+          break;
+        }
+        LOG_I(WIFI, "Trying to reconnect to WiFi...");
+        wifiAttemptFailed = false;
+        wifiRetryState = WIFI_RETRY_CONNECTING;
+        // Reconnect using stored credentials, directed if the cache is valid
+        beginWiFi(true);
+      }
+      break;
+
+    case WIFI_RETRY_CONNECTING:
+      if (wifiAttemptFailed || millis() - wifiAssocStart >= WIFI_ATTEMPT_TIMEOUT) {
+        wifiRetryCount++;
+        LOG_W(WIFI, "Failed to connect to WiFi (attempt %lu)", wifiRetryCount);
+        if (wifiDirected) {
+          clearWifiCache(); // The access point moved; scan right away
+          wifiAttemptFailed = false;
+          beginWiFi(false);
+        } else {
+          scheduleWifiRetry();
+        }
+      }
+      break;
+  }
+}
+
+// Function to handle calibration LED pattern
+void updateCalibrationLed() {
+  unsigned long currentTime = millis();
+  
+  // Toggle LED every 800ms (300ms on, 500ms off)
+  if (currentTime - lastCalibrationLedToggle >= 800) {
+    lastCalibrationLedToggle = currentTime;
+    
+    // Cycle through Red, Green, Blue
+    if (calibrationLedState == 0) {
+      // Red
+      setLedColor(true, false, false);
+      calibrationLedState = 1;
+    } else if (calibrationLedState == 1) {
+      // Green
+      setLedColor(false, true, false);
+      calibrationLedState = 2;
+    } else {
+      // Blue
+      setLedColor(false, false, true);
+      calibrationLedState = 0;
+    }
+  } else if (currentTime - lastCalibrationLedToggle >= 300) {
+    // Turn LED off after 300ms
+    setLedColor(false, false, false);
+  }
+}
+
+// Calculate average of calibration readings
+float calculateCalibrationAverage() {
+  if (calibrationReadingCount == 0) return -1;
+  
+  float sum = 0;
+  for (int i = 0; i < calibrationReadingCount; i++) {
+    sum += calibrationReadings[i];
+  }
+  return sum / calibrationReadingCount;
+}
+
+
+
+// Add a handler function for device reset
+void handleReset() {
+  server.send(200, F("text/html"), F("<html><body><h1>Resetting Device</h1><p>The device will now reset and all configurations will be wiped.</p></body></html>"));
+  delay(1000); // Give time for the response to be sent
+
+  LOG_I(SYS, "Performing factory reset...");
+
+  // Clear stored configurations - with error checking
+  clearWifiCache();
+  kvWipe();
+  if (LittleFS.exists("/config.json")) {
+    if (LittleFS.remove("/config.json")) {
+      LOG_I(SYS, "Config file deleted successfully");
+    } else {
+      LOG_W(SYS, "Failed to delete config file");
+    }
+  } else {
+    LOG_I(SYS, "Config file not found");
+  }
+  
+  // Clear WiFi settings by removing the wifi config file
+  if (LittleFS.exists("/wifi_cred.dat")) {
+    if (LittleFS.remove("/wifi_cred.dat")) {
+      LOG_I(SYS, "WiFi credentials file deleted successfully");
+    } else {
+      LOG_W(SYS, "Failed to delete WiFi credentials file");
+    }
+  } else {
+    LOG_I(SYS, "WiFi credentials file not found");
+  }
+  
+  // Ensure the filesystem has time to complete operations
+  LittleFS.end();
+  delay(500);
+  
+  // Explicitly clear WiFi settings in memory
+  WiFi.disconnect(true);  // disconnect and delete credentials
+  
+  // Wait for WiFi disconnect to complete
+  LOG_I(SYS, "Disconnecting WiFi...");
+  delay(1000);
+  
+  // Erase config and reset
+  LOG_I(SYS, "Erasing configuration and restarting...");
+  ESP.eraseConfig();
+  delay(1000);
+  logFlush();
+  ESP.restart();
+}
+
+void handleResetWiFi() {
+  server.send(200, F("text/html"), F("<html><body><h1>Resetting WiFi Settings</h1><p>The device will now reset WiFi settings and reboot.</p></body></html>"));
+  delay(1000); // Give time for the response to be sent
+  WiFi.disconnect(true); // Disconnect from Wi-Fi
+  ESP.eraseConfig(); // Erase all Wi-Fi and network-related settings
+  clearWifiCache();
+  LOG_I(WIFI, "Resetting WiFi settings...");
+
+  // Clear WiFi settings by removing the WiFi credentials file
+  if (LittleFS.exists("/wifi_cred.dat")) {
+    if (LittleFS.remove("/wifi_cred.dat")) {
+      LOG_I(WIFI, "WiFi credentials file deleted successfully");
+    } else {
+      LOG_W(WIFI, "Failed to delete WiFi credentials file");
+    }
+  } else {
+    LOG_I(WIFI, "WiFi credentials file not found");
+  }
+
+ 
+  // Wait for WiFi disconnect to complete
+  delay(1000);
+
+  // Restart the device
+  logFlush();
+  ESP.restart();
+}
+
+void handleResetCalibration() {
+  server.send(200, F("text/html"), F("<html><body><h1>Resetting Calibration</h1><p>The device will now reset and calibration will be triggered.</p></body></html>"));
+  delay(1000); // Give time for the response to be sent
+
+  // Reset baseGasValue to -1 to trigger calibration
+  saveBaseGasValue(-1);
+
+  // Restart the device
+  logFlush();
+  ESP.restart();
+}
+
+void handleRestart() {
+  server.send(200, F("text/html"), F("<html><body><h1>Restarting Device</h1><p>The device will now restart.</p></body></html>"));
+  delay(1000); // Give time for the response to be sent
+
+  // Restart the device
+  logFlush();
+  ESP.restart();
+}
+
+// MQTT client ID and topic segment: the device name, or the MAC without
+// colons, lowercased
+void mqttClientId(char* out, size_t size) {
+    size_t length = 0;
+    for (const char* c = config.deviceName; *c && length < size - 1; c++) {
+        out[length++] = tolower(*c);
+    }
+    out[length] = '\0';
+    if (length == 0) {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf_P(out, size, PSTR("%02x%02x%02x%02x%02x%02x"), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+}
+
+PGM_P mqttStateName(int state) {
+    switch (state) {
+        case -4: return PSTR("MQTT_CONNECTION_TIMEOUT");
+        case -3: return PSTR("MQTT_CONNECTION_LOST");
+        case -2: return PSTR("MQTT_CONNECT_FAILED");
+        case -1: return PSTR("MQTT_DISCONNECTED");
+        case 1: return PSTR("MQTT_CONNECT_BAD_PROTOCOL");
+        case 2: return PSTR("MQTT_CONNECT_BAD_CLIENT_ID");
+        case 3: return PSTR("MQTT_CONNECT_UNAVAILABLE");
+        case 4: return PSTR("MQTT_CONNECT_BAD_CREDENTIALS");
+        case 5: return PSTR("MQTT_CONNECT_UNAUTHORIZED");
+        default: return nullptr;
+    }
+}
+
+void printMqttFailure(PGM_P prefix) {
+    int state = mqttClient.state();
+    PGM_P name = mqttStateName(state);
+    if (name) {
+        LOG_W(MQTT, "%S, state: %S", prefix, name);
+    } else {
+        LOG_W(MQTT, "%S, state: %d", prefix, state);
+    }
+}
+
+void subscribeCommandTopic(const char* clientId) {
+    char topic[64];
+    snprintf_P(topic, sizeof(topic), PSTR("homeassistant/%s/command"), clientId);
+    mqttClient.subscribe(topic);
+}
+
+void setupMQTT() {
+    if (mqttConfigMissing()) {
+        LOG_I(MQTT, "No MQTT configuration found - MQTT disabled");
+        return;
+    }
+    // Use device name or fallback to MAC for client ID and topic
+    char clientId[41];
+    mqttClientId(clientId, sizeof(clientId));
+    mqttClient.setServer(config.mqttServer, config.mqttPort);
+    mqttClient.setBufferSize(768); // Boot profile diagnostics exceed the 256 byte default
+    // Set callback if you want to handle incoming messages
+    // mqttClient.setCallback(mqttCallback);
+    LOG_I(MQTT, "Attempting to connect to MQTT broker as %s...", clientId);
+    if (mqttClient.connect(clientId, config.mqttUser, config.mqttPassword)) {
+        LOG_I(MQTT, "MQTT Connected Successfully");
+        publishDiscoveryConfig(); // Use the clean discovery function only
+        // Subscribe to command topic for future remote control
+        subscribeCommandTopic(clientId);
+    } else {
+        printMqttFailure(PSTR("Initial MQTT connection failed"));
+        LOG_I(MQTT, "Will retry in main loop");
+    }
+}
+
+void reconnectMQTT() {
+    if (mqttConfigMissing()) return;
+    if (mqttClient.connected()) return;
+    char clientId[41];
+    mqttClientId(clientId, sizeof(clientId));
+    mqttClient.setServer(config.mqttServer, config.mqttPort);
+    LOG_I(MQTT, "Attempting MQTT connection as %s...", clientId);
+    if (mqttClient.connect(clientId, config.mqttUser, config.mqttPassword)) {
+        LOG_I(MQTT, "Connected to MQTT broker");
+        publishDiscoveryConfig(); // Use the clean discovery function only
+        // Subscribe to command topic
+        subscribeCommandTopic(clientId);
+    } else {
+        printMqttFailure(PSTR("Connection failed"));
+        LOG_I(MQTT, "Will try again later");
+    }
+}
+
+void publishMQTTData(float gasValue) {
+    if (!config.mqttEnabled || bootStage <= BOOT_MQTT || mqttConfigMissing()) return;
+    char clientId[41];
+    mqttClientId(clientId, sizeof(clientId));
+    if (!mqttClient.connected()) {
+        LOG_I(MQTT, "MQTT disconnected, attempting to reconnect...");
+        reconnectMQTT(); // Republishes discovery and resubscribes, as the mqtt task would
+        if (!mqttClient.connected()) {
+            LOG_W(MQTT, "MQTT reconnect failed");
+            return;
+        }
+    }
+    mqttClient.loop();
+    char topic[80];
+    char value[16];
+    snprintf_P(topic, sizeof(topic), PSTR("homeassistant/sensor/%s/gas/state"), clientId);
+    snprintf_P(value, sizeof(value), PSTR("%.1f"), gasValue); // Format to 1 decimal place
+    bool published = mqttClient.publish(topic, value, true);
+    LOG_D(MQTT, "MQTT publish %S: topic=%s, value=%s", published ? PSTR("SUCCESS") : PSTR("FAILED"), topic, value);
+}
+
+// Publishes Home Assistant discovery config for the gas sensor
+void publishDiscoveryConfig() {
+    char object[41];
+    size_t length = 0;
+    for (const char* c = config.deviceName; *c && length < sizeof(object) - 1; c++) {
+        object[length++] = isalnum(*c) ? tolower(*c) : '_';
+    }
+    object[length] = '\0';
+    char configTopic[80];
+    snprintf_P(configTopic, sizeof(configTopic), PSTR("homeassistant/sensor/%s/gas/config"), object);
+    // Do NOT use device_class: gas if using ppm as unit
+    char configPayload[256];
+    snprintf_P(configPayload, sizeof(configPayload),
+               PSTR("{\"name\":\"%s Gas Sensor\",\"state_topic\":\"homeassistant/sensor/%s/gas/state\","
+                    "\"unit_of_measurement\":\"ppm\",\"unique_id\":\"%s_gas\"}"),
+               object, object, object);
+    bool pubSuccess = mqttClient.publish(configTopic, configPayload, true);
+    LOG_I(MQTT, "MQTT: Discovery config publish %S", pubSuccess ? PSTR("successful") : PSTR("failed"));
+    LOG_D(MQTT, "Config topic: %s", configTopic);
+    LOG_D(MQTT, "Config payload: %s", configPayload);
+}
+
+// Renders every CFG_FORM field of the schema as a labelled input
+void renderConfigForm(String& html) {
+  bool inMqttBlock = false;
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & CFG_FORM)) continue;
+
+    bool mqttField = field.flags & CFG_MQTT;
+    if (mqttField != inMqttBlock) {
+      if (mqttField) {
+        html += F("<div id='mqttSettings' class='mqtt-settings' style='display: ");
+        html += config.mqttEnabled ? F("block") : F("none");
+        html += F(";'>");
+      } else {
+        html += F("</div>");
+      }
+      inMqttBlock = mqttField;
+    }
+
+    void* value = configFieldPtr(config, field);
+    html += F("<label for='");
+    html += FPSTR(field.name);
+    html += F("'>");
+    html += FPSTR(field.label);
+    html += F(":</label><input type='");
+    switch (field.type) {
+      case CFG_STR:  html += (field.flags & CFG_SECRET) ? F("password") : F("text"); break;
+      case CFG_INT:  html += F("number"); break;
+      case CFG_BOOL: html += F("checkbox"); break;
+    }
+    html += F("' id='");
+    html += FPSTR(field.name);
+    html += F("' name='");
+    html += FPSTR(field.name);
+    switch (field.type) {
+      case CFG_STR:
+        html += F("' maxlength='");
+        html += String(field.size - 1);
+        html += F("' value='");
+        html += (const char*)value;
+        html += F("'");
+        break;
+      case CFG_INT:
+        html += F("' min='");
+        html += String(field.minValue);
+        html += F("' max='");
+        html += String(field.maxValue);
+        html += F("' value='");
+        html += String(*(int*)value);
+        html += F("'");
+        break;
+      case CFG_BOOL:
+        html += F("' value='1'");
+        if (field.flags & CFG_TOGGLE) html += F(" onchange='toggleMqttSettings()'");
+        if (*(bool*)value) html += F(" checked");
+        break;
+    }
+    if (field.flags & CFG_READONLY) html += F(" readonly");
+    html += F("><br>");
+  }
+  if (inMqttBlock) html += F("</div>");
+}
+
+// Applies submitted form arguments to cfg. Returns false and describes the
+// first offending field in error if any value is out of range.
+bool parseConfigArgs(Config& cfg, String& error) {
+  for (size_t i = 0; i < CONFIG_SCHEMA_SIZE; i++) {
+    ConfigField field = readConfigField(i);
+    if (!(field.flags & CFG_FORM) || (field.flags & CFG_READONLY)) continue;
+    void* value = configFieldPtr(cfg, field);
+    String name = FPSTR(field.name);
+
+    if (field.type == CFG_BOOL) {
+      // Unchecked checkboxes are not submitted at all
+      *(bool*)value = server.hasArg(name) && server.arg(name) == "1";
+      continue;
+    }
+    if (!server.hasArg(name)) continue;
+    String arg = server.arg(name);
+
+    if (field.type == CFG_STR) {
+      if (arg.length() >= field.size) {
+        error = String(FPSTR(field.label)) + F(" must be at most ") + String(field.size - 1) + F(" characters");
+        return false;
+      }
+      strlcpy((char*)value, arg.c_str(), field.size);
+    } else {
+      long intValue = arg.toInt();
+      if (intValue < field.minValue || intValue > field.maxValue) {
+        error = String(FPSTR(field.label)) + F(" must be between ") + String(field.minValue) + F(" and ") + String(field.maxValue);
+        return false;
+      }
+      *(int*)value = intValue;
+    }
+  }
+  return true;
+}
+
+void handleRoot() {
+  String html = F("<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'>");
+  html += F("<style>");
+  html += F("body { font-family: Arial, sans-serif; margin: 0; padding: 0; background: #f4f4f9; color: #333; }"
+            "h1, h2 { text-align: center; color: #444; }"
+            "form, .info-section, .danger-zone { max-width: 90%; margin: 1em auto; padding: 1em; background: #fff; border-radius: 5px; box-shadow: 0 2px 5px rgba(0,0,0,0.1); }"
+            "input[type='text'], input[type='password'], input[type='number'] { width: 100%; padding: 0.7em; margin: 0.5em 0; border: 1px solid #ccc; border-radius: 3px; box-sizing: border-box; }"
+            "input[type='submit'], button { width: 100%; background: #007BFF; color: white; border: none; padding: 0.7em; border-radius: 3px; cursor: pointer; font-size: 1em; }"
+            "input[type='submit']:hover, button:hover { background: #0056b3; }"
+            ".danger-button { background: #dc3545; }"
+            ".danger-button:hover { background: #c82333; }"
+            ".info-section p, .danger-zone p { margin: 0.5em 0; }"
+            ".info-section strong, .danger-zone strong { display: inline-block; width: 50%; }"
+            ".mqtt-settings { display: none; }"
+  );
+  html += F("</style>");
+
+  html += F("<script>");
+  html += F("function toggleMqttSettings() {"
+            "  var mqttDiv = document.getElementById('mqttSettings');"
+            "  var enabled = document.getElementById('mqttEnabled').checked;"
+            "  mqttDiv.style.display = enabled ? 'block' : 'none';"
+            "}"
+            "function confirmReset() {"
+            "  return confirm('WARNING: This will erase all settings including WiFi credentials and reboot the device. Continue?');"
+            "}"
+            "</script></head><body>");
+
+  html += F("<h1>Device Configuration</h1>");
+  html += F("<form action='/save' method='POST'>");
+  renderConfigForm(html);
+
+  html += F("<input type='submit' value='Save'>");
+  html += F("</form>");
+
+  html += F("<div class='info-section'>");
   html += F("<h2>Device Information</h2>");
   html += F("<p><strong>IP Address:</strong><span>") + WiFi.localIP().toString() + F("</span></p>");
   html += F("<p><strong>MAC Address:</strong><span>") + WiFi.macAddress() + F("</span></p>");
+  if (wifiAssocTime) {
+    html += F("<p><strong>WiFi Association:</strong><span>") + String(wifiAssocTime) + F(" ms (") +
+            (wifiAssocDirected ? F("cached channel") : F("full scan")) + (wifiAssocStatic ? F(", cached lease)") : F(", DHCP)")) + F("</span></p>");
+  }
+  html += F("<p><strong>Time to First Sample:</strong><span>") + (firstSampleTime ? String(firstSampleTime) + F(" ms") : String(F("pending"))) + F("</span></p>");
+  
+  // Add memory information
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxFreeBlock = ESP.getMaxFreeBlockSize();
+  uint32_t freeSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+  uint32_t flashChipSize = ESP.getFlashChipSize();
+  
+  html += F("<p><strong>Free RAM:</strong><span>") + String(freeHeap) + F(" bytes</span></p>");
+  html += F("<p><strong>Largest Free Block:</strong><span>") + String(maxFreeBlock) + F(" bytes</span></p>");
+  html += F("<p><strong>Heap Fragmentation:</strong><span>") + String(fragTrend.current) + F("% (worst ") + String(fragTrend.worst) +
+          F("%, min free ") + String(fragTrend.minFreeHeap) + F(" bytes)</span></p>");
+  if (fragTrend.count) {
+    // Hourly worst values, oldest first
+    html += F("<p><strong>Fragmentation by Hour:</strong><span>");
+    for (uint8_t i = 0; i < fragTrend.count; i++) {
+      html += String(fragTrend.history[(fragTrend.head + FRAG_HISTORY - fragTrend.count + i) % FRAG_HISTORY]);
+      html += i + 1 < fragTrend.count ? F(" ") : F("%");
+    }
+    html += F("</span></p>");
+  }
+  html += F("<p><strong>Free Sketch Space:</strong><span>") + String(freeSketchSpace) + F(" bytes (") + String((freeSketchSpace * 100) / flashChipSize) + F("%)</span></p>");
+  html += F("<p><strong>Flash Chip Size:</strong><span>") + String(flashChipSize) + F(" bytes</span></p>");
+  html += F("</div>");
+
+  html += F("<div class='info-section'>");
+  html += F("<h2>Boot Profile</h2>");
+  html += F("<p><strong>Firmware:</strong><span>") + String(F(FIRMWARE_VERSION)) + F("</span></p>");
+  for (uint8_t i = 0; i < BOOT_STEP_COUNT; i++) {
+    if (bootProfile.stepUs[i] == 0) continue;
+    html += F("<p><strong>") + String(FPSTR(BOOT_STEP_NAMES[i])) + F(":</strong><span>") + String(bootProfile.stepUs[i] / 1000.0, 1) + F(" ms</span></p>");
+  }
+  if (bootStage == BOOT_DONE) {
+    html += F("<p><strong>Total:</strong><span>") + String(bootProfile.totalUs / 1000.0, 1) + F(" ms</span></p>");
+  }
+  for (uint32_t i = 1; i < bootProfileLog.count; i++) {
+    html += F("<p><strong>Previous boot ") + String(i) + F(":</strong><span>") + String(bootProfileLog.profiles[i].totalUs / 1000.0, 1) +
+            F(" ms (") + String(bootProfileLog.profiles[i].version) + F(")</span></p>");
+  }
+  html += F("</div>");
+
+  html += F("<div class='info-section'>");
+  html += F("<h2>Scheduler</h2>");
+  renderSchedulerStatus(html);
+  html += F("</div>");
+
+  html += F("<div class='info-section'>");
+  html += F("<h2>Storage</h2>");
+  if (kv.ready) {
+    html += F("<p><strong>Active Sector:</strong><span>") + String(kv.active) + F("</span></p>");
+    html += F("<p><strong>Log Usage:</strong><span>") + String(kv.writeOffset) + F(" / ") + String(KV_SECTOR_SIZE) + F(" bytes</span></p>");
+    html += F("<p><strong>Erase Count:</strong><span>") + String(kv.eraseCount[0]) + F(" / ") + String(kv.eraseCount[1]) + F("</span></p>");
+    html += F("<p><strong>Writes / Compactions:</strong><span>") + String(kv.writes) + F(" / ") + String(kv.compactions) + F("</span></p>");
+  } else {
+    html += F("<p>KV store unavailable, using LittleFS</p>");
+  }
+  html += F("</div>");
+
+  html += F("<div class='info-section'>");
+  html += F("<h2>Sensor Values</h2>");
+  html += F("<p><strong>Raw Value:</strong><span>") + String(analogRead(gasSensorPin)) + F("</span></p>");
+  html += F("<p><strong>Adjustment Value:</strong><span>") + String(config.baseGasValue) + F("</span></p>");
+  html += F("<p><strong>Adjusted Value:</strong><span>") + String(analogRead(gasSensorPin) - config.baseGasValue) + F("</span></p>");
+  html += F("</div>");
+
+  html += F("<div class='info-section'>");
+  html += F("<h2>Firmware Update</h2>");
+  html += F("<p>Download and install latest firmware from GitHub.</p>");
+  html += F("<a href='/update'><button style='background-color: #28a745;'>Update Firmware</button></a>");
+  html += F("</div>");
+
+  html += F("<div class='danger-zone'>");
+  html += F("<h2>Danger Zone</h2>");
+  html += F("<p>Erase all configurations including WiFi settings.</p>");
+  html += F("<a href='/reset' onclick='return confirmReset()'><button class='danger-button'>Reset Device</button></a>");
+  html += F("</div>");
+
+  html += F("<div class='danger-zone'>");
+  html += F("<h2>Calibration Reset</h2>");
+  html += F("<p>Erase the base gas value and restart the device to trigger calibration.</p>");
+  html += F("<a href='/reset-calibration'><button class='danger-button'>Reset Calibration</button></a>");
+  html += F("</div>");
+
+  html += F("<div class='danger-zone'>");
+  html += F("<h2>Restart Device</h2>");
+  html += F("<p>Restart the device without erasing configurations.</p>");
+  html += F("<a href='/restart'><button class='danger-button'>Restart Device</button></a>");
+  html += F("</div>");
+
+  html += F("<div class='danger-zone'>");
+  html += F("<h2>Reset WiFi Settings</h2>");
+  html += F("<p>Resetting WiFi settings will erase the saved WiFi credentials and restart the device to display the captive portal.</p>");
+  html += F("<a href='/reset-wifi'><button class='danger-button'>Reset WiFi Settings</button></a>");
+  html += F("</div>");
+
+  html += F("</body></html>");
+  server.send(200, F("text/html"), html);
+}
+
+void handleSave() {
+  Config updated = config;
+  String error;
+  if (!parseConfigArgs(updated, error)) {
+    server.send(400, F("text/html"), F("<html><body><h1>Invalid Configuration</h1><p>") + error + F("</p><a href='/'>Go Back</a></body></html>"));
+    return;
+  }
+
+  bool wasMqttEnabled = config.mqttEnabled;
+  bool mqttSettingsChanged = configFieldsChanged(config, updated, CFG_MQTT);
+  config = updated;
+
+  if (config.mqttEnabled && mqttConfigMissing()) {
+    config.mqttEnabled = false;
+    LOG_W(MQTT, "MQTT config not found or invalid, MQTT disabled");
+  }
+
+  // Handle MQTT client disconnect if being disabled or pointed elsewhere
+  if (wasMqttEnabled && (!config.mqttEnabled || mqttSettingsChanged)) {
+    mqttClient.disconnect();
+  }
+  
+  saveConfig();
+  
+  applyPowerMode();
+  applySyslogConfig();
+
+  // If MQTT was enabled or its settings changed, (re)initialize it
+  if (config.mqttEnabled && (!wasMqttEnabled || mqttSettingsChanged)) {
+    setupMQTT();
+  }
+  
+  server.send(200, F("text/html"), F("<html><body><h1>Configuration Saved</h1><a href='/'>Go Back</a></body></html>"));
+}
+
+void handleUpdate() {
+  HTTPUpload& upload = server.upload();
+  if (upload.status == UPLOAD_FILE_START) {
+    suspendWatchdog(); // The whole upload runs inside one handleClient()
+    LOG_I(NET, "Update: %s", upload.filename.c_str());
+    uint32_t maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+    if (!Update.begin(maxSketchSpace)) {
+      Update.printError(Serial);
+    }
+  } else if (upload.status == UPLOAD_FILE_WRITE) {
+    if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
+      Update.printError(Serial);
+    }
+  } else if (upload.status == UPLOAD_FILE_END) {
+    if (Update.end(true)) {
+      LOG_I(NET, "Update Success: %u", upload.totalSize);
+      server.send(200, F("text/plain"), F("Update successful! Rebooting..."));
+      delay(1000);
+      logFlush();
+      ESP.restart();
+    } else {
+      Update.printError(Serial);
+    }
+  }
+  yield();
+}
+
+void handleUpdatePage() {
+  String html = F("<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'>");
+  html += F("<style>");
+  html += F("body { font-family: Arial, sans-serif; margin: 0; padding: 20px; background: #f4f4f9; color: #333; }");
+  html += F("h1 { text-align: center; color: #444; }");
+  html += F(".update-container { max-width: 600px; margin: 0 auto; padding: 20px; background: #fff; border-radius: 5px; box-shadow: 0 2px 5px rgba(0,0,0,0.1); }");
+  html += F(".progress { width: 100%; height: 20px; background: #eee; border-radius: 10px; margin: 20px 0; display: none; }");
+  html += F(".progress-bar { width: 0%; height: 100%; background: #28a745; border-radius: 10px; transition: width 0.3s; }");
+  html += F("button { width: 100%; background: #28a745; color: white; border: none; padding: 10px; border-radius: 5px; cursor: pointer; font-size: 16px; }");
+  html += F("button:hover { background: #218838; }");
+  html += F(".status { text-align: center; margin: 10px 0; }");
+  html += F("</style>");
+
+  html += F("<script>");
+  html += F("async function startUpdate() {");
+  html += F("  const status = document.getElementById('status');");
+  html += F("  const progress = document.getElementById('progress');");
+  html += F("  const progressBar = document.getElementById('progressBar');");
+  html += F("  try {");
+  html += F("    status.textContent = 'Downloading firmware...';");
+  html += F("    progress.style.display = 'block';");
+  html += F("    const response = await fetch('https://arjunus1985.github.io/GasDetect/fwroot/firmware.bin');");
+  html += F("    const firmware = await response.arrayBuffer();");
+  html += F("    const formData = new FormData();");
+  html += F("    formData.append('firmware', new Blob([firmware]), 'firmware.bin');");
+  html += F("    status.textContent = 'Uploading firmware to device...';");
+  html += F("    progressBar.style.width = '50%';");
+  html += F("    const updateResponse = await fetch('/do-update', {");
+  html += F("      method: 'POST',");
+  html += F("      body: formData");
+  html += F("    });");
+  html += F("    if (updateResponse.ok) {");
+  html += F("      status.textContent = 'Update successful! Device will restart...';");
+  html += F("      progressBar.style.width = '100%';");
+  html += F("      setTimeout(() => { window.location.href = '/'; }, 5000);");
+  html += F("    } else {");
+  html += F("      throw new Error('Update failed');");
+  html += F("    }");
+  html += F("  } catch (error) {");
+  html += F("    status.textContent = 'Error: ' + error.message;");
+  html += F("    progressBar.style.background = '#dc3545';");
+  html += F("  }");
+  html += F("}");
+  html += F("</script></head><body>");
+
+  html += F("<div class='update-container'>");
+  html += F("<h1>Firmware Update</h1>");
+  html += F("<p>This will download and install the latest firmware from GitHub.</p>");
+  html += F("<button onclick='startUpdate()'>Start Update</button>");
+  html += F("<div id='progress' class='progress'>");
+  html += F("<div id='progressBar' class='progress-bar'></div>");
+  html += F("</div>");
+  html += F("<div id='status' class='status'></div>");
+  html += F("<p><a href='/'>&larr; Back to main page</a></p>");
+  html += F("</div>");
+  html += F("</body></html>");
+
+  server.send(200, F("text/html"), html);
+}
+
+// Config portal AP name, built once by startConfigPortal()
+char portalSsid[24];
+
+// Callback for when device enters config mode
+void configModeCallback(WiFiManager *myWiFiManager) {
+  (void)myWiFiManager;
+  LOG_W(WIFI, "Failed to connect to WiFi");
+  LOG_I(WIFI, "Entered config mode");
+  IPAddress ip = WiFi.softAPIP();
+  LOG_I(WIFI, "AP IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  LOG_I(WIFI, "AP SSID: %s", portalSsid);
+}
+
+void printGasDataBuffer() {
+  if (!LOG_ENABLED(SENSOR, LOG_LEVEL_DEBUG) || !logSinks(LOG_TO_ALL)) return;
+#ifdef LOG_BINARY
+  LOG_D(SENSOR, "%[.2f]", LogFloats{ gasDataBuffer, BUFFER_SIZE });
+#else
+  char line[200];
+  size_t length = 0;
+  for (int i = 0; i < BUFFER_SIZE && length < sizeof(line); i++) {
+    length += snprintf_P(line + length, sizeof(line) - length, PSTR("[%.2f]"), gasDataBuffer[i]);
+  }
+  LOG_D(SENSOR, "%s", line);
+#endif
+}
+
+// Function to set RGB LED color
+void IRAM_ATTR setLedColor(bool r, bool g, bool b) {
+  digitalWrite(redPin, r ? HIGH : LOW);
+  digitalWrite(greenPin, g ? HIGH : LOW);
+  digitalWrite(bluePin, b ? HIGH : LOW);
+}
+
+// Function to update LED status
+void updateLedStatus() {
+  unsigned long currentTime = millis();
+  
+  // During alert state
+  if (buzzerActive) {
+    if (currentLedState != LED_ALERT) {
+      priorLedState = currentLedState;
+      currentLedState = LED_ALERT;
+      ledBlinkInterval = redBlinkInterval;
+      currentLedInterval = redBlinkInterval;
+      lastLedToggle = currentTime;
+      ledOn = true;
+      setLedColor(true, false, false); // Red
+    }
+  } else if (currentLedState == LED_ALERT) {
+    // Restore previous state
+    currentLedState = priorLedState;
+    ledOn = true;
+    lastLedToggle = currentTime;
+    if (currentLedState == LED_WIFI_ONLY) {
+      currentLedInterval = greenBlinkInterval;
+      ledBlinkInterval = onDuration;
+    } else if (currentLedState == LED_MQTT_ACTIVE) {
+      currentLedInterval = blueBlinkInterval;
+      ledBlinkInterval = onDuration;
+    }
+  }
+
+  // Update LED state based on connectivity
+  if (!buzzerActive) {
+    // Check WiFi connection first
+    if (WiFi.status() != WL_CONNECTED) {
+      // WiFi disconnected - set constant red
+      if (currentLedState != LED_WIFI_DISCONNECTED) {
+        currentLedState = LED_WIFI_DISCONNECTED;
+        ledOn = true;
+        setLedColor(true, false, false); // Solid red
+      }
+      
+      // Beep once every minute during WiFi disconnection
+      if (currentTime - lastWifiBeepTime >= 60000) { // 60 seconds
+        lastWifiBeepTime = currentTime;
+        // Schedule a short beep
+        buzzerStartTime = currentTime;
+        buzzerDuration = 100; // 100ms beep
+        buzzerActive = true;
+        digitalWrite(buzzerPin, HIGH);
+        traceMark(MARK_BUZZER, 1);
+        taskWake(taskBuzzer);
+      }
+    } else if (WiFi.status() == WL_CONNECTED && mqttClient.connected() && config.mqttEnabled) {
+      if (currentLedState != LED_MQTT_ACTIVE) {
+        currentLedState = LED_MQTT_ACTIVE;
+        currentLedInterval = blueBlinkInterval;
+        ledBlinkInterval = onDuration;
+        lastLedToggle = currentTime;
+        ledOn = true;
+        setLedColor(false, false, true); // Blue
+      }
+    } else if (WiFi.status() == WL_CONNECTED) {
+      if (currentLedState != LED_WIFI_ONLY) {
+        currentLedState = LED_WIFI_ONLY;
+        currentLedInterval = greenBlinkInterval;
+        ledBlinkInterval = onDuration;
+        lastLedToggle = currentTime;
+        ledOn = true;
+        setLedColor(false, true, false); // Green
+      }
+    }
+  }
+
+  // Handle blinking based on current state
+  if (currentTime - lastLedToggle >= ledBlinkInterval) {
+    lastLedToggle = currentTime;
+    
+    switch (currentLedState) {
+      case LED_STARTUP:
+        // For startup, just toggle
+        ledOn = !ledOn;
+        setLedColor(ledOn, false, false); // red 
+        break;
+        
+      case LED_WIFI_DISCONNECTED:
+        // Keep constant red, no toggling needed
+        break;
+        
+      case LED_WIFI_ONLY:
+        if (ledOn) {
+          // Turn off after 500ms ON time
+          ledOn = false;
+          setLedColor(false, false, false); // OFF
+          ledBlinkInterval = greenBlinkInterval - onDuration; // Remaining time until next cycle
+        } else {
+          // Turn on for 500ms
+          ledOn = true;
+          setLedColor(false, true, false); // Green
+          ledBlinkInterval = onDuration;
+        }
+        break;
+        
+      case LED_MQTT_ACTIVE:
+        if (ledOn) {
+          // Turn off after 500ms ON time
+          ledOn = false;
+          setLedColor(false, false, false); // OFF
+          ledBlinkInterval = blueBlinkInterval - onDuration; // Remaining time until next cycle
+        } else {
+          // Turn on for 500ms
+          ledOn = true;
+          setLedColor(false, false, true); // Blue
+          ledBlinkInterval = onDuration;
+        }
+        break;
+        
+      case LED_ALERT:
+        // For alert state, just toggle every interval
+        ledOn = !ledOn;
+        setLedColor(ledOn, false, false); // Red blink
+        break;
+    }
+  }
+}
+
+uint32_t rtcWarmStateCrc(RtcWarmState& state) {
+  return crc32(&state.lastAliveRtc, sizeof(RtcWarmState) - offsetof(RtcWarmState, lastAliveRtc));
+}
+
+// Called after every sample; an RTC memory write costs a few microseconds
+void saveRtcWarmState() {
+  RtcWarmState state;
+  state.magic = RTC_WARM_STATE_MAGIC;
+  state.lastAliveRtc = system_get_rtc_time();
+  unsigned long now = millis();
+  state.breachElapsed = breachStart ? now - breachStart : 0;
+  state.underThresholdElapsed = underThresholdStart ? now - underThresholdStart : 0;
+  state.alertState = alertState;
+  memcpy(state.gasDataBuffer, gasDataBuffer, sizeof(gasDataBuffer));
+  state.crc = rtcWarmStateCrc(state);
+  ESP.rtcUserMemoryWrite(RTC_WARM_STATE_OFFSET, (uint32_t*)&state, sizeof(state));
+}
+
+// Restores the sensing state after a recent software reset. Returns false on
+// a cold power-on, an external reset that cleared the RTC clock, or a stale
+// record, in which case the heater needs its full warmup.
+bool restoreRtcWarmState() {
+  RtcWarmState state;
+  ESP.rtcUserMemoryRead(RTC_WARM_STATE_OFFSET, (uint32_t*)&state, sizeof(state));
+  // Consume the record so a later cold boot never sees it
+  uint32_t invalid = 0;
+  ESP.rtcUserMemoryWrite(RTC_WARM_STATE_OFFSET, &invalid, sizeof(invalid));
+  if (state.magic != RTC_WARM_STATE_MAGIC || state.crc != rtcWarmStateCrc(state)) return false;
+
+  uint32_t reason = ESP.getResetInfoPtr()->reason;
+  if (reason != REASON_SOFT_RESTART && reason != REASON_WDT_RST &&
+      reason != REASON_EXCEPTION_RST && reason != REASON_SOFT_WDT_RST && reason != REASON_EXT_SYS_RST) {
+    return false;
+  }
+  // The RTC clock keeps counting across software resets; the calibration
+  // value is the tick period in microseconds as 20.12 fixed point
+  uint32_t ticks = system_get_rtc_time() - state.lastAliveRtc;
+  uint32_t gapMs = (((uint64_t)ticks * system_rtc_clock_cali_proc()) >> 12) / 1000;
+  if (gapMs > WARM_START_MAX_GAP) return false;
+
+  memcpy(gasDataBuffer, state.gasDataBuffer, sizeof(gasDataBuffer));
+  unsigned long now = millis();
+  breachStart = state.breachElapsed ? now - state.breachElapsed : 0;
+  underThresholdStart = state.underThresholdElapsed ? now - state.underThresholdElapsed : 0;
+  alertState = state.alertState;
+  if (alertState) {
+    lastNotificationTime = now; // Already notified before the reset
+  }
+  LOG_I(SENSOR, "Warm start: reset reason %u, %lu ms since last sample, skipping warmup", reason, gapMs);
+  return true;
+}
+
+void endBootStep(uint8_t step) {
+  uint32_t now = micros();
+  bootProfile.stepUs[step] += now - bootStepStartUs;
+  bootStepStartUs = now;
+}
+
+// Header, one line per step that took time, then the total
+bool bootProfileLine(uint32_t index, Print& out) {
+  if (index == 0) {
+    out.printf_P(PSTR("Boot profile (%s):\n"), bootProfile.version);
+  } else if (index <= BOOT_STEP_COUNT) {
+    uint8_t i = index - 1;
+    if (bootProfile.stepUs[i] == 0) return true;
+    char name[12];
+    memcpy_P(name, BOOT_STEP_NAMES[i], sizeof(name));
+    out.printf_P(PSTR("  %-12s %8lu us\n"), name, (unsigned long)bootProfile.stepUs[i]);
+  } else if (index == BOOT_STEP_COUNT + 1) {
+    out.printf_P(PSTR("  %-12s %8lu us\n"), "total", (unsigned long)bootProfile.totalUs);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void printBootProfile(Print& out) {
+  for (uint32_t i = 0; bootProfileLine(i, out); i++) {}
+}
+
+// Closes the profile at BOOT_DONE and adds it to the persisted history
+void finishBootProfile() {
+  bootProfile.totalUs = micros();
+  if (kvRead(KV_KEY_BOOT_PROFILES, &bootProfileLog, sizeof(bootProfileLog)) != sizeof(bootProfileLog)) {
+    memset(&bootProfileLog, 0, sizeof(bootProfileLog));
+  }
+  memmove(&bootProfileLog.profiles[1], &bootProfileLog.profiles[0], sizeof(BootProfile) * (BOOT_PROFILE_HISTORY - 1));
+  bootProfileLog.profiles[0] = bootProfile;
+  if (bootProfileLog.count < BOOT_PROFILE_HISTORY) bootProfileLog.count++;
+  if (kv.ready) kvWrite(KV_KEY_BOOT_PROFILES, &bootProfileLog, sizeof(bootProfileLog));
+
+  printBootProfile(Serial);
+  for (TelnetSession& session : telnetSessions) {
+    if (session.client.connected() && !session.replyFn) startTelnetReply(session, bootProfileLine);
+  }
+  bootProfilePending = true;
+}
+
+// Retained, so a fleet dashboard sees the latest profile of every device
+void publishBootProfile() {
+  JsonDocument doc;
+  doc[F("fw")] = bootProfile.version;
+  doc[F("reset")] = bootProfile.resetReason;
+  doc[F("total_us")] = bootProfile.totalUs;
+  JsonObject steps = doc[F("steps_us")].to<JsonObject>();
+  for (uint8_t i = 0; i < BOOT_STEP_COUNT; i++) {
+    if (bootProfile.stepUs[i] == 0) continue;
+    steps[FPSTR(BOOT_STEP_NAMES[i])] = bootProfile.stepUs[i];
+  }
+  // Earlier boots, newest first
+  JsonArray history = doc[F("history")].to<JsonArray>();
+  for (uint32_t i = 1; i < bootProfileLog.count; i++) {
+    JsonObject entry = history.add<JsonObject>();
+    entry[F("fw")] = bootProfileLog.profiles[i].version;
+    entry[F("total_us")] = bootProfileLog.profiles[i].totalUs;
+  }
+
+  char payload[640];
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+  char topic[64];
+  snprintf_P(topic, sizeof(topic), PSTR("homeassistant/%s/diag/boot"), deviceHostname);
+  if (mqttClient.publish(topic, (const uint8_t*)payload, length, true)) {
+    bootProfilePending = false;
+  } else {
+    LOG_W(MQTT, "MQTT: Boot profile publish failed");
+  }
+}
+
+void advanceBootStage(BootStage next) {
+  endBootStep(STEP_STAGES + bootStage);
+  bootStage = next;
+  bootStageStart = millis();
+}
+
+void buildHostname() {
+  // Format and sanitize hostname
+  size_t length = 0;
+  for (const char* c = config.deviceName; *c && length < sizeof(deviceHostname) - 1; c++) {
+    deviceHostname[length++] = isalnum(*c) ? tolower(*c) : '-';
+  }
+  deviceHostname[length] = '\0';
+  if (length == 0) strlcpy(deviceHostname, "gas-detector", sizeof(deviceHostname));
+}
+
+// Opens the captive portal and returns right away; loop() keeps sampling
+// while finishPortal() services it. The stored credentials were already
+// tried by the boot sequence, so this skips autoConnect's own attempt.
+void startConfigPortal() {
+  // Set config mode callback
+  wifiManager.setAPCallback(configModeCallback);
+  
+  // Set connection timeout to 30 seconds
+  wifiManager.setConnectTimeout(30);
+  
+  // Set timeout for AP mode portal
+  wifiManager.setConfigPortalTimeout(300); // 5 minutes (300 seconds) timeout for AP mode
+  wifiManager.setConfigPortalBlocking(false);
+  
+  // Set custom AP name
+  if (!portalSsid[0]) snprintf_P(portalSsid, sizeof(portalSsid), PSTR("GasDetector-%lu"), (unsigned long)ESP.getChipId());
+  wifiManager.startConfigPortal(portalSsid);
+}
+
+// Services the portal for one loop() pass. Returns true once it has closed,
+// either connected with new credentials or timed out.
+bool finishPortal() {
+  if (wifiManager.process()) {
+    LOG_I(WIFI, "Connected to WiFi");
+  } else if (wifiManager.getConfigPortalActive()) {
+    return false;
+  } else {
+    LOG_W(WIFI, "Failed to connect to WiFi and AP mode timed out");
+    LOG_I(WIFI, "Continuing in offline mode, will retry WiFi connection later");
+    // Set flag to indicate we're in offline mode after AP timeout
+    apModeTimedOut = true;
+  }
+
+  // Ensure we are in station mode for mDNS
+  WiFi.mode(WIFI_STA);
+  LOG_I(WIFI, "WiFi mode: %d (1=STA,2=AP,3=STA+AP)", WiFi.getMode());
+  return true;
+}
+
+void startMDNS() {
+  if (!MDNS.begin(deviceHostname)) {
+    LOG_W(NET, "Error setting up mDNS responder");
+    // Debug info
+    LOG_I(NET, "Local IP: %s", WiFi.localIP().toString().c_str());
+    LOG_I(NET, "MAC: %s", WiFi.macAddress().c_str());
+  } else {
+    MDNS.addService(F("http"), F("tcp"), 80);
+    MDNS.addService(F("telnet"), F("tcp"), 23);
+    LOG_I(NET, "mDNS responder started: %s.local", deviceHostname);
+  }
+}
+
+void startOTA() {
+  // Configure OTA with same hostname
+  ArduinoOTA.setHostname(deviceHostname);
+
+  ArduinoOTA.onStart([]() {
+    suspendWatchdog(); // The whole update runs inside one ArduinoOTA.handle()
+    // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
+    LOG_I(NET, "Start updating %S", ArduinoOTA.getCommand() == U_FLASH ? PSTR("sketch") : PSTR("filesystem"));
+  });
+  ArduinoOTA.onEnd([]() {
+    LOG_I(NET, "OTA end");
+  });
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    LOG_D(NET, "Progress: %u%%\r", (progress / (total / 100)));
+  });
+  ArduinoOTA.onError([](ota_error_t error) {
+    PGM_P reason = PSTR("");
+    if (error == OTA_AUTH_ERROR) {
+      reason = PSTR("Auth Failed");
+    } else if (error == OTA_BEGIN_ERROR) {
+      reason = PSTR("Begin Failed");
+    } else if (error == OTA_CONNECT_ERROR) {
+      reason = PSTR("Connect Failed");
+    } else if (error == OTA_RECEIVE_ERROR) {
+      reason = PSTR("Receive Failed");
+    } else if (error == OTA_END_ERROR) {
+      reason = PSTR("End Failed");
+    }
+    LOG_E(NET, "OTA error[%u]: %S", error, reason);
+  });
+  ArduinoOTA.begin();
+
+  LOG_I(NET, "OTA Ready");
+  LOG_I(NET, "IP address: %s", WiFi.localIP().toString().c_str());
+}
+
+void startTelnet() {
+  telnetServer.begin();
+  telnetServer.setNoDelay(true);
+  LOG_I(NET, "Telnet server started");
+}
+
+void startWebServer() {
+  server.on(F("/"), handleRoot);
+  server.on(F("/save"), HTTP_POST, handleSave);
+ 
+  server.on(F("/reset"), HTTP_GET, handleReset); // Add handler for reset
+  server.on(F("/reset-calibration"), HTTP_GET, handleResetCalibration); // Add handler for reset calibration
+  server.on(F("/restart"), HTTP_GET, handleRestart); // Add handler for restart
+  server.on(F("/reset-wifi"), HTTP_GET, handleResetWiFi); // Add handler for resetting only WiFi settings
+  server.on(F("/update"), HTTP_GET, handleUpdatePage);  // New route for update page
+  server.on(F("/cache-bench"), HTTP_GET, handleCacheBench); // IRAM kernels, cold vs warm cache
+  server.on(F("/metrics"), HTTP_GET, handleMetrics);    // Prometheus text format
+  server.on(F("/reset-histograms"), HTTP_GET, handleResetHistograms);
+  server.on(F("/profile"), HTTP_GET, handleProfile);    // Sampling profiler
+  server.on(F("/trace"), HTTP_GET, handleTrace);        // Event tracer
+  server.on(F("/do-update"), HTTP_POST, []() {
+    server.sendHeader(F("Connection"), F("close"));
+    server.send(200, F("text/plain"), (Update.hasError()) ? F("FAIL") : F("OK"));
+    logFlush();
+    ESP.restart();
+  }, handleUpdate);
+  server.begin();
+  LOG_I(NET, "Web server started");
+}
+
+// Runs at most one boot stage per call. Each stage is short except the
+// blocking MQTT connect / startup POST.
+void runBootSequence() {
+  switch (bootStage) {
+    case BOOT_WIFI_START:
+      buildHostname();
+      WiFi.mode(WIFI_STA);
+      WiFi.hostname(deviceHostname);  // set DHCP hostname before associating
+      applyPowerMode();
+      applySyslogConfig();
+      LOG_I(SYS, "DHCP hostname: %s", deviceHostname);
+      wifiGotIpHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP&) {
+        wifiAssocTime = millis() - wifiAssocStart;
+        wifiAssocDirected = wifiDirected;
+        wifiAssocStatic = wifiStaticLease;
+        wifiCachePending = true;
+        wifiRetryState = WIFI_RETRY_IDLE;
+        wifiRetryDelay = WIFI_RETRY_MIN;
+      });
+      // The SDK reconnects on its own after a link loss; time that too
+      wifiDisconnectedHandler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected& event) {
+        if (wifiRetryState == WIFI_RETRY_CONNECTING) {
+          // begin() drops the old association first, which isn't a failure
+          if (event.reason != WIFI_DISCONNECT_REASON_ASSOC_LEAVE) wifiAttemptFailed = true;
+        } else if (WiFi.getMode() != WIFI_OFF) {
+          wifiAssocStart = millis();
+        }
+      });
+
+      if (WiFi.SSID().length() == 0) {
+        LOG_I(WIFI, "No stored WiFi credentials");
+        advanceBootStage(BOOT_WIFI_PORTAL);
+      } else {
+        // Try to connect with the stored credentials without blocking
+        LOG_I(WIFI, "%S", wifiCacheValid ? PSTR("Attempting directed WiFi connect...") : PSTR("Attempting to connect to WiFi..."));
+        beginWiFi(true);
+        advanceBootStage(BOOT_WIFI_WAIT);
+      }
+      break;
+
+    case BOOT_WIFI_WAIT:
+      if (WiFi.status() == WL_CONNECTED) {
+        LOG_I(WIFI, "Connected to WiFi in %lu ms", millis() - bootStageStart);
+        advanceBootStage(BOOT_MDNS);
+      } else if (wifiDirected && millis() - wifiAssocStart >= WIFI_DIRECTED_TIMEOUT) {
+        // The access point moved or changed channel
+        LOG_W(WIFI, "Directed connect failed, falling back to a full scan");
+        clearWifiCache();
+        beginWiFi(false);
+      } else if (millis() - bootStageStart >= WIFI_CONNECT_TIMEOUT) {
+        advanceBootStage(BOOT_WIFI_PORTAL);
+      }
+      break;
+
+    case BOOT_WIFI_PORTAL:
+      startConfigPortal();
+      advanceBootStage(BOOT_WIFI_PORTAL_WAIT);
+      break;
+
+    case BOOT_WIFI_PORTAL_WAIT:
+      // The portal owns port 80 until it closes, so our web server starts after
+      if (finishPortal()) {
+        advanceBootStage(BOOT_MDNS);
+      }
+      break;
+
+    case BOOT_MDNS:
+      startMDNS();
+      advanceBootStage(BOOT_OTA);
+      break;
+
+    case BOOT_OTA:
+      startOTA();
+      advanceBootStage(BOOT_TELNET);
+      break;
+
+    case BOOT_TELNET:
+      startTelnet();
+      advanceBootStage(BOOT_WEB);
+      break;
+
+    case BOOT_WEB:
+      startWebServer();
+      advanceBootStage(BOOT_MQTT);
+      break;
+
+    case BOOT_MQTT:
+      // Only setup MQTT if enabled in config
+      if (WiFi.status() == WL_CONNECTED && config.mqttEnabled) {
+        setCrumbSection(SECTION_MQTT_CONNECT);
+        setupMQTT();
+        setCrumbSection(SECTION_NONE);
+      } else {
+        LOG_I(MQTT, "WiFi not connected. Skipping MQTT setup.");
+      }
+      advanceBootStage(BOOT_NOTIFY);
+      break;
+
+    case BOOT_NOTIFY:
+      setCrumbSection(SECTION_NOTIFY);
+      sendStartupNotification();
+      setCrumbSection(SECTION_NONE);
+      // Boot completed: this was not a quick restart
+      rtcBootState.restartCounter = 0;
+      rtcBootState.flags = 0;
+      saveRtcBootState();
+      if (wifiStaticLease) {
+        // The cached lease only speeds up boot; go back to DHCP so the
+        // address keeps being renewed
+        WiFi.config(0u, 0u, 0u);
+        wifiStaticLease = false;
+      }
+      LOG_I(SYS, "Boot complete in %lu ms, first sample %s", millis(), firstSampleTime ? "taken" : "pending warmup");
+      advanceBootStage(BOOT_DONE);
+      finishBootProfile();
+      break;
+
+    case BOOT_DONE:
+      break;
+  }
+}
+
+// Marks the first reading the alarm path acted on and reports its latency
+void recordFirstSample() {
+  if (firstSampleTime != 0) return;
+  firstSampleTime = millis();
+  LOG_I(SENSOR, "Time to first sample: %lu ms after power-on", firstSampleTime);
+}
+
+// Cooperative scheduler. Periodic tasks wait in a two-level timer wheel, so
+// a loop() pass only looks at the slots that came due instead of testing
+// every interval. Level 0 has 64 slots of 8 ms, level 1 64 slots of 512 ms;
+// longer delays park in the last level 1 slot and cascade again. Due tasks
+// run in priority order. Network tasks share a time budget per pass and are
+// deferred to the next pass once it is spent, so a slow broker or web client
+// cannot delay sampling or the alarm.
+typedef void (*TaskFn)();
+
+enum TaskPriority : uint8_t {
+  PRIO_ALARM,    // Sampling, alarm FSM, buzzer
+  PRIO_LOCAL,    // LEDs
+  PRIO_NETWORK,  // Budgeted
+  PRIO_IDLE,     // Housekeeping
+  PRIO_COUNT
+};
+
+struct TaskDef {
+  char name[12];
+  TaskFn fn;
+  uint32_t interval;  // ms; 0 polls the task on every pass
+  TaskPriority priority;
+  uint32_t budgetMs;  // Watchdog budget per run, 0 for unchecked
+};
+
+struct TaskState {
+  uint32_t due;       // millis() deadline
+  uint32_t runs;
+  uint32_t totalUs;
+  uint32_t maxUs;
+  int8_t next;        // Next task in the same wheel slot, -1 at the end
+  bool ready;
+  bool idle;          // idleUntil replaces the next period, see taskIdleUntil()
+  uint32_t idleUntil;
+  uint32_t stalls;    // Runs over the watchdog budget
+};
+
+#define WHEEL_SLOTS 64
+#define WHEEL_RES_MS 8
+#define WHEEL_SPAN_MS (WHEEL_SLOTS * WHEEL_RES_MS)
+const uint32_t NETWORK_BUDGET_US = 20000;
+const uint32_t SCHED_WINDOW_US = 10000000; // Idle time is reported per 10 s window
+
+struct SchedulerStats {
+  uint32_t windowStartUs;
+  uint32_t windowBusyUs;
+  uint32_t windowPasses;
+  uint16_t idlePermille;  // Last complete window
+  uint32_t passesPerSecond;
+  uint32_t deferred;      // Network task runs pushed to a later pass
+  uint32_t windowSleepUs;
+  uint16_t sleepPermille; // Share of the last complete window spent in esp_delay()
+};
+
+SchedulerStats sched;
+int8_t wheel[2][WHEEL_SLOTS];
+uint32_t wheelTime = 0; // Start of the last processed level 0 slot
+
+enum AlarmAction : uint8_t { ALARM_NONE, ALARM_NOTIFY, ALARM_CLEAR };
+
+// Threshold state machine: a breach must persist for thresholdDuration
+// before alerting (re-notified every 2 minutes), and the level must stay
+// below it as long again before the alert clears
+AlarmAction IRAM_ATTR evaluateThreshold(float gasReading, unsigned long now) {
+  unsigned long duration = (unsigned long)config.thresholdDuration * 1000;
+  if (gasReading > config.thresholdLimit) {
+    // reset under-threshold tracking
+    underThresholdStart = 0;
+    // mark start of breach
+    if (breachStart == 0) {
+      breachStart = now;
+    }
+    if (now - breachStart < duration) return ALARM_NONE;
+    alertState = true;  // Enable alert state with beeping
+    if (lastNotificationTime != 0 && now - lastNotificationTime < 120000) return ALARM_NONE;
+    lastNotificationTime = now;
+    return ALARM_NOTIFY;
+  }
+
+  // reading back under threshold: start under-threshold timer
+  if (underThresholdStart == 0) {
+    underThresholdStart = now;
+  }
+  // if level stays below threshold long enough, reset breach state and notify
+  if (now - underThresholdStart < duration) return ALARM_NONE;
+  AlarmAction action = ALARM_NONE;
+  if (breachStart != 0) {
+    alertState = false;  // Disable alert state, stop beeping
+    action = ALARM_CLEAR;
+  }
+  breachStart = 0;
+  underThresholdStart = 0;
+  lastNotificationTime = 0;
+  return action;
+}
+
+AlarmAction notifyPending = ALARM_NONE;
+
+void taskSample() {
+  unsigned long now = millis();
+
+  // Check if we need to start calibration after warmup
+  if ((now - systemStartTime > warmupTime) && config.baseGasValue == -1 && !calibrationRunning) {
+    // Start calibration process
+    calibrationRunning = true;
+    calibrationStartTime = now;
+    calibrationReadingCount = 0;
+    LOG_I(SENSOR, "Starting calibration process for 5 minutes...");
+  }
+
+  // Handle calibration process
+  if (calibrationRunning) {
+    // Take readings every second for 5 minutes
+    if (now - calibrationStartTime <= calibrationDuration) {
+      // Read gas sensor value
+      float rawGasReading = analogRead(gasSensorPin);
+      traceMark(MARK_ADC_READ);
+      recordFirstSample();
+      
+      // Calculate median from buffer
+      float medianValue = calculateMedian(gasDataBuffer, BUFFER_SIZE);
+      
+      // Store median value for calibration if buffer has data
+      if (calibrationReadingCount < numCalibrationReadings && medianValue > 0) {
+        calibrationReadings[calibrationReadingCount++] = medianValue;
+        LOG_D(SENSOR, "Calibration reading %d: %.2f", calibrationReadingCount, medianValue);
+      }
+      
+      // Add gas sensor value to buffer
+      addGasReading(rawGasReading);
+      
+    } else {
+      // Calibration complete - calculate average and save
+      saveBaseGasValue((int)calculateCalibrationAverage());
+      calibrationRunning = false;
+      //reset buffer to all zeroes
+      for (int i = 0; i < BUFFER_SIZE; i++) {
+        gasDataBuffer[i] = 0;
+      }
+      LOG_I(SENSOR, "Calibration complete. Base gas value: %d", config.baseGasValue);
+    }
+    return;
+  }
+
+  // Normal operation after warmup
+  if (now - systemStartTime <= warmupTime) return;
+
+  // Read gas sensor value
+  float rawGasReading = analogRead(gasSensorPin);
+  traceMark(MARK_ADC_READ);
+  recordFirstSample();
   
-  // Add memory information
-  uint32_t freeHeap = ESP.getFreeHeap();
-  uint32_t maxFreeBlock = ESP.getMaxFreeBlockSize();
-  uint32_t freeSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
-  uint32_t flashChipSize = ESP.getFlashChipSize();
+  // Apply baseline offset if calibrated
+  float gasReading = rawGasReading;
+  if (config.baseGasValue > 0) {
+    gasReading = rawGasReading - config.baseGasValue;
+    if (gasReading < 0) gasReading = 0; // Ensure no negative values
+  }
   
-  html += F("<p><strong>Free RAM:</strong><span>") + String(freeHeap) + F(" bytes</span></p>");
-  html += F("<p><strong>Largest Free Block:</strong><span>") + String(maxFreeBlock) + F(" bytes</span></p>");
-  html += F("<p><strong>Free Sketch Space:</strong><span>") + String(freeSketchSpace) + F(" bytes (") + String((freeSketchSpace * 100) / flashChipSize) + F("%)</span></p>");
-  html += F("<p><strong>Flash Chip Size:</strong><span>") + String(flashChipSize) + F(" bytes</span></p>");
-  html += F("</div>");
+  LOG_D(SENSOR, "Gas Sensor Value: %.2f (raw: %.2f, base: %d)", gasReading, rawGasReading, config.baseGasValue);
+  // Add gas sensor value to buffer
+  addGasReading(gasReading);
+  printGasDataBuffer();
+
+  // Check threshold breach
+  bool wasAlert = alertState;
+  AlarmAction action = evaluateThreshold(gasReading, now);
+  if (alertState != wasAlert) taskWake(taskBuzzer);
+  if (action != ALARM_NONE) {
+    notifyPending = action;  // Sent by taskNotify()
+  }
 
-  html += F("<div class='info-section'>");
-  html += F("<h2>Sensor Values</h2>");
-  html += F("<p><strong>Raw Value:</strong><span>") + String(analogRead(gasSensorPin)) + F("</span></p>");
-  html += F("<p><strong>Adjustment Value:</strong><span>") + String(config.baseGasValue) + F("</span></p>");
-  html += F("<p><strong>Adjusted Value:</strong><span>") + String(analogRead(gasSensorPin) - config.baseGasValue) + F("</span></p>");
-  html += F("</div>");
+  saveRtcWarmState();
+}
+
+// The buzzer and LED tasks only run when something they drive is due to
+// change, so loop() can sleep for a whole beacon interval when neither is
+// active. The buzzer is woken by taskWake() when an alert or a beep starts,
+// and wakes the LED when it turns on or off; both still poll slowly in case
+// a change comes from elsewhere.
+const uint32_t BUZZER_IDLE_POLL_MS = 1000;
+const uint32_t LED_IDLE_POLL_MS = 250;
+
+// Non-blocking buzzer control for ongoing beeping during alert. Returns when
+// the buzzer next needs attention.
+uint32_t IRAM_ATTR updateBuzzer(unsigned long now) {
+  if (alertState) {
+    // Toggle buzzer every 1 second
+    if (now - lastBuzzerToggle >= 1000) {
+      lastBuzzerToggle = now;
+      buzzerActive = !buzzerActive;
+      digitalWrite(buzzerPin, buzzerActive ? HIGH : LOW);
+      traceMark(MARK_BUZZER, buzzerActive);
+    }
+  } else if (buzzerActive) {
+    // Turn off buzzer when duration elapsed
+    if (now - buzzerStartTime >= buzzerDuration) {
+      digitalWrite(buzzerPin, LOW);
+      buzzerActive = false;
+      traceMark(MARK_BUZZER, 0);
+    }
+  }
+
+  if (alertState) return lastBuzzerToggle + 1000;
+  if (buzzerActive) return buzzerStartTime + buzzerDuration;
+  return now + BUZZER_IDLE_POLL_MS;
+}
+
+void taskBuzzer() {
+  bool wasActive = buzzerActive;
+  taskIdleUntil(taskBuzzer, updateBuzzer(millis()));
+  // The LED shows the alert while the buzzer sounds
+  if (buzzerActive != wasActive) taskWake(taskLed);
+}
+
+void taskLed() {
+  unsigned long now = millis();
+  uint32_t next = now + LED_IDLE_POLL_MS;
+  if (calibrationRunning) {
+    updateCalibrationLed();
+    bool lit = now - lastCalibrationLedToggle < 300;
+    next = lastCalibrationLedToggle + (lit ? 300 : 800);
+  } else if (now - systemStartTime > warmupTime) {
+    updateLedStatus();
+    if (currentLedState != LED_WIFI_DISCONNECTED) next = lastLedToggle + ledBlinkInterval;
+  }
+  if ((int32_t)(next - now) > (int32_t)LED_IDLE_POLL_MS) next = now + LED_IDLE_POLL_MS;
+  taskIdleUntil(taskLed, next);
+}
+
+void taskOta() {
+  ArduinoOTA.handle();
+}
+
+// Bring up networking one stage at a time alongside sampling
+void taskBoot() {
+  runBootSequence();
+}
+
+void taskWifi() {
+  if (wifiCachePending) {
+    wifiCachePending = false;
+    LOG_I(WIFI, "WiFi associated in %lu ms (%s, %s)", wifiAssocTime,
+               wifiAssocDirected ? "cached channel" : "full scan", wifiAssocStatic ? "cached lease" : "DHCP");
+    saveWifiCache();
+  }
+  
+  // Reconnect in the background when WiFi is down
+  serviceWifiRetry();
+}
+
+// Accept new Telnet clients into free sessions using accept()
+void taskTelnet() {
+  if (telnetServer.hasClient()) {
+    TelnetSession* session = nullptr;
+    for (TelnetSession& candidate : telnetSessions) {
+      if (!candidate.client.connected()) {
+        session = &candidate;
+        break;
+      }
+    }
+    if (session) {
+      session->client.stop();
+      session->client = telnetServer.accept();
+      session->client.setNoDelay(true);
+      session->lineLength = 0;
+      session->truncated = false;
+      session->replyTail = session->replyHead;
+      session->replyFn = nullptr;
+      session->lastProgress = millis();
+      LOG_I(NET, "Telnet client %u connected from %s", (unsigned)(session - telnetSessions),
+            session->client.remoteIP().toString().c_str());
+      session->printf_P(PSTR("Firmware %s; type 'help' for commands\n"), FIRMWARE_VERSION);
+      if (bootStage == BOOT_DONE) startTelnetReply(*session, bootProfileLine);
+    } else {
+      WiFiClient rejected = telnetServer.accept();
+      rejected.println(F("Too many telnet clients"));
+      rejected.stop();
+    }
+  }
+
+  // Collect command lines without waiting for the rest of a line. The next
+  // command waits in the client's buffer until the last reply is out.
+  for (TelnetSession& session : telnetSessions) {
+    while (session.client.connected() && session.client.available() && !session.replyFn &&
+           session.replyTail == session.replyHead) {
+      char c = session.client.read();
+      if (c == '\r') continue;
+      if (c != '\n') {
+        if (session.lineLength < sizeof(session.line) - 1) session.line[session.lineLength++] = c;
+        continue;
+      }
+      session.line[session.lineLength] = '\0';
+      session.lineLength = 0;
+      handleTelnetCommand(session.line, session);
+      if (!session.replyFn) endTelnetReply(session);
+    }
+  }
+}
+
+// Handle web server requests
+void taskWeb() {
+  server.handleClient();
+}
+
+// Only perform MQTT operations if enabled and the boot sequence set it up
+void taskMqtt() {
+  if (!config.mqttEnabled || bootStage <= BOOT_MQTT) return;
+  if (!mqttClient.connected()) {
+    // A failed connect blocks, so don't retry on every pass
+    if (millis() - lastReconnectAttempt < MQTT_RETRY_INTERVAL) return;
+    lastReconnectAttempt = millis();
+    setCrumbSection(SECTION_MQTT_CONNECT);
+    reconnectMQTT();
+    setCrumbSection(SECTION_NONE);
+  }
+  mqttClient.loop(); // Call loop frequently to maintain connection
+  if (bootProfilePending && mqttClient.connected()) {
+    publishBootProfile();
+  }
+  if (postMortemPending && mqttClient.connected()) {
+    publishPostMortem();
+  }
+}
+
+// Sends the notification queued by taskSample(). The ntfy POST can block for
+// the whole 5 s HTTPClient timeout, so it runs here under its own watchdog
+// budget instead of holding up sampling and the alarm.
+void taskNotify() {
+  if (notifyPending == ALARM_NONE) return;
+  AlarmAction action = notifyPending;
+  notifyPending = ALARM_NONE;
+  setCrumbSection(SECTION_NOTIFY);
+  sendNotification(action == ALARM_NOTIFY);
+  setCrumbSection(SECTION_NONE);
+}
+
+// Publish median value every second once warmed up
+void taskPublish() {
+  unsigned long now = millis();
+  if (calibrationRunning || now - systemStartTime <= warmupTime) return;
+
+  float medianValue = calculateMedian(gasDataBuffer, BUFFER_SIZE);
+  
+  // Debug: Always log when we're about to publish
+  LOG_D(MQTT, "Publishing MQTT data: %.2f (system uptime: %lu ms)", medianValue, now - systemStartTime);
+
+  // Reduce startup delay from 60 seconds to 10 seconds
+  if (now - systemStartTime > 10000) {
+    publishMQTTData(medianValue); // Publish median value
+  } else {
+    LOG_D(MQTT, "Skipping MQTT publish - system still warming up (%lu seconds remaining)", (10000 - (now - systemStartTime)) / 1000);
+  }
+}
+
+// Publish discovery config every 5 minutes
+void taskDiscovery() {
+  if (config.mqttEnabled && mqttClient.connected()) {
+    publishDiscoveryConfig();
+  }
+}
+
+void taskMdns() {
+  MDNS.update();
+}
+
+// Pre-erase the spare KV sector outside any write path
+void taskKv() {
+  kvService();
+}
+
+void taskHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+  uint8_t frag = freeHeap ? 100 - (uint64_t)maxBlock * 100 / freeHeap : 0;
+  fragTrend.current = frag;
+  fragTrend.worst = max(fragTrend.worst, frag);
+  fragTrend.hourWorst = max(fragTrend.hourWorst, frag);
+  if (fragTrend.minFreeHeap == 0 || freeHeap < fragTrend.minFreeHeap) fragTrend.minFreeHeap = freeHeap;
+  if (++fragTrend.minutes < 60) return;
+  fragTrend.history[fragTrend.head] = fragTrend.hourWorst;
+  fragTrend.head = (fragTrend.head + 1) % FRAG_HISTORY;
+  if (fragTrend.count < FRAG_HISTORY) fragTrend.count++;
+  fragTrend.minutes = 0;
+  fragTrend.hourWorst = 0;
+}
+
+// Ends timed profiler and tracer runs
+void taskProfiler() {
+  if (profiler.active && (long)(millis() - profiler.stopAt) >= 0) {
+    stopProfiler();
+    LOG_I(SYS, "Profile complete: %lu samples, %lu dropped", (unsigned long)profiler.samples, (unsigned long)profiler.dropped);
+  }
+  if (tracer.active && (long)(millis() - tracer.stopAt) >= 0) {
+    tracer.active = false;
+    LOG_I(SYS, "Trace complete: %lu records, %lu overwritten", (unsigned long)tracer.written,
+               (unsigned long)(tracer.written > TRACE_RECORDS ? tracer.written - TRACE_RECORDS : 0));
+  }
+}
+
+//  name         function       interval                  priority      budget (ms)
+static const TaskDef TASKS[] PROGMEM = {
+  { "sample",    taskSample,    1000,                     PRIO_ALARM,   1000 },
+  { "buzzer",    taskBuzzer,    20,                       PRIO_ALARM,   100 },
+  { "led",       taskLed,       20,                       PRIO_LOCAL,   100 },
+  { "ota",       taskOta,       0,                        PRIO_NETWORK, 1000 },
+  { "boot",      taskBoot,      0,                        PRIO_NETWORK, 5000 },
+  { "wifi",      taskWifi,      100,                      PRIO_NETWORK, 500 },
+  { "telnet",    taskTelnet,    100,                      PRIO_NETWORK, 500 },
+  { "web",       taskWeb,       0,                        PRIO_NETWORK, 2000 },
+  { "mqtt",      taskMqtt,      0,                        PRIO_NETWORK, 2000 },
+  { "notify",    taskNotify,    0,                        PRIO_NETWORK, 6000 },
+  { "publish",   taskPublish,   publishInterval,          PRIO_NETWORK, 1000 },
+  { "discovery", taskDiscovery, discoveryPublishInterval, PRIO_NETWORK, 1000 },
+  { "mdns",      taskMdns,      1000,                     PRIO_NETWORK, 500 },
+  { "syslog",    taskSyslog,    250,                      PRIO_NETWORK, 500 },
+  { "kv",        taskKv,        1000,                     PRIO_IDLE,    500 },
+  { "log",       logDrain,      0,                        PRIO_IDLE,    100 },
+  { "heap",      taskHeap,      60000,                    PRIO_IDLE,    100 },
+  { "profiler",  taskProfiler,  100,                      PRIO_IDLE,    100 }
+};
+#define TASK_COUNT (sizeof(TASKS) / sizeof(TASKS[0]))
+
+TaskState taskState[TASK_COUNT];
+
+// Log2 run-time histograms per task, in CPU cycles: recording a run costs a
+// cycle-counter read and a count-leading-zeros. Bucket 0 counts runs under
+// 2^HIST_MIN_LOG2 cycles, bucket i runs under 2^(HIST_MIN_LOG2 + i), and
+// the last bucket everything longer.
+#define HIST_BUCKETS 20
+#define HIST_MIN_LOG2 10
+
+struct TaskHistogram {
+  uint32_t counts[HIST_BUCKETS];
+  uint64_t sumCycles;
+};
+
+TaskHistogram taskHist[TASK_COUNT];
+unsigned long histResetTime = 0;
+
+inline void histRecord(uint8_t id, uint32_t cycles) {
+  int bucket = (cycles ? 32 - __builtin_clz(cycles) : 0) - HIST_MIN_LOG2;
+  if (bucket < 0) bucket = 0;
+  if (bucket >= HIST_BUCKETS) bucket = HIST_BUCKETS - 1;
+  taskHist[id].counts[bucket]++;
+  taskHist[id].sumCycles += cycles;
+}
+
+void resetHistograms() {
+  memset(taskHist, 0, sizeof(taskHist));
+  histResetTime = millis();
+}
+
+// One line per task: run count, then "<2^n:count" for each used bucket
+bool histogramLine(uint32_t index, Print& out) {
+  if (index == 0) {
+    out.printf_P(PSTR("Task run time histograms (cycles at %lu MHz), last %lu s:\n"), F_CPU / 1000000, (millis() - histResetTime) / 1000);
+    return true;
+  }
+  if (index > TASK_COUNT) return false;
+  uint8_t i = index - 1;
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < HIST_BUCKETS; b++) total += taskHist[i].counts[b];
+  if (total == 0) return true;
+  out.printf_P(PSTR("%-10S n=%-8lu"), TASKS[i].name, (unsigned long)total);
+  for (uint8_t b = 0; b < HIST_BUCKETS; b++) {
+    if (taskHist[i].counts[b] == 0) continue;
+    if (b == HIST_BUCKETS - 1) {
+      out.printf_P(PSTR(" >=2^%u:%lu"), HIST_MIN_LOG2 + b - 1, (unsigned long)taskHist[i].counts[b]);
+    } else {
+      out.printf_P(PSTR(" <2^%u:%lu"), HIST_MIN_LOG2 + b, (unsigned long)taskHist[i].counts[b]);
+    }
+  }
+  out.println();
+  return true;
+}
+
+TaskDef readTaskDef(size_t index) {
+  TaskDef def;
+  memcpy_P(&def, &TASKS[index], sizeof(def));
+  return def;
+}
+
+int taskIndex(TaskFn fn) {
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    if ((TaskFn)pgm_read_ptr(&TASKS[i].fn) == fn) return i;
+  }
+  return -1;
+}
+
+void wheelInsert(uint8_t id) {
+  TaskState& task = taskState[id];
+  // Round up so a task never runs before its deadline
+  uint32_t at = task.due + WHEEL_RES_MS - 1;
+  int32_t delta = (int32_t)(at - wheelTime);
+  uint8_t level = 0;
+  if (delta < WHEEL_RES_MS) {
+    task.ready = true;
+    return;
+  } else if (delta >= WHEEL_SPAN_MS) {
+    level = 1;
+    if (delta >= WHEEL_SPAN_MS * (WHEEL_SLOTS - 1)) at = wheelTime + WHEEL_SPAN_MS * (WHEEL_SLOTS - 1);
+  }
+  uint8_t slot = level == 0 ? (at / WHEEL_RES_MS) % WHEEL_SLOTS : (at / WHEEL_SPAN_MS) % WHEEL_SLOTS;
+  task.next = wheel[level][slot];
+  wheel[level][slot] = id;
+}
+
+// Unlinks a task from whichever wheel slot holds it
+void wheelRemove(uint8_t id) {
+  for (uint8_t level = 0; level < 2; level++) {
+    for (uint8_t slot = 0; slot < WHEEL_SLOTS; slot++) {
+      for (int8_t* link = &wheel[level][slot]; *link >= 0; link = &taskState[*link].next) {
+        if (*link == id) {
+          *link = taskState[id].next;
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Called by a periodic task to skip its runs until `until`, when nothing it
+// drives can change before then. taskWake() ends the wait early.
+void taskIdleUntil(TaskFn fn, uint32_t until) {
+  int id = taskIndex(fn);
+  if (id < 0) return;
+  taskState[id].idle = true;
+  taskState[id].idleUntil = until;
+}
+
+// Runs a periodic task on the next pass instead of at its deadline
+void taskWake(TaskFn fn) {
+  int id = taskIndex(fn);
+  // Tasks are all ready until their first run, and not yet in the wheel
+  if (id < 0 || taskState[id].ready || taskState[id].runs == 0) return;
+  wheelRemove(id);
+  taskState[id].idle = false;
+  taskState[id].due = millis();
+  taskState[id].ready = true;
+}
+
+// Steps the wheel up to now, marking every task whose slot came due
+void wheelAdvance(uint32_t now) {
+  while ((int32_t)(now - wheelTime) >= WHEEL_RES_MS) {
+    wheelTime += WHEEL_RES_MS;
+    if (wheelTime % WHEEL_SPAN_MS == 0) {
+      // Cascade the next level 1 slot down
+      uint8_t slot = (wheelTime / WHEEL_SPAN_MS) % WHEEL_SLOTS;
+      int8_t id = wheel[1][slot];
+      wheel[1][slot] = -1;
+      while (id >= 0) {
+        int8_t next = taskState[id].next;
+        wheelInsert(id);
+        id = next;
+      }
+    }
+    uint8_t slot = (wheelTime / WHEEL_RES_MS) % WHEEL_SLOTS;
+    int8_t id = wheel[0][slot];
+    wheel[0][slot] = -1;
+    while (id >= 0) {
+      taskState[id].ready = true;
+      id = taskState[id].next;
+    }
+  }
+}
+
+void schedulerBegin() {
+  memset(wheel, -1, sizeof(wheel));
+  memset(taskState, 0, sizeof(taskState));
+  uint32_t now = millis();
+  wheelTime = now - now % WHEEL_RES_MS;
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    taskState[i].due = now;
+    taskState[i].ready = true;
+  }
+  sched.windowStartUs = micros();
+}
+
+// Earliest deadline of the periodic tasks, or now if one is already ready.
+// Polled tasks have no deadline of their own.
+uint32_t schedulerNextDeadline() {
+  uint32_t now = millis();
+  int32_t earliest = INT32_MAX;
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    TaskDef def = readTaskDef(i);
+    if (def.interval == 0) continue;
+    if (taskState[i].ready) return now;
+    earliest = min(earliest, (int32_t)(taskState[i].due - now));
+  }
+  return now + max(earliest, (int32_t)0);
+}
+
+void runTask(uint8_t id, const TaskDef& def) {
+  TaskState& task = taskState[id];
+  setCrumb(id, def.budgetMs);
+  uint32_t startCycles = ESP.getCycleCount();
+  def.fn();
+  uint32_t endCycles = ESP.getCycleCount();
+  uint32_t cycles = endCycles - startCycles;
+  histRecord(id, cycles);
+  uint32_t elapsed = cycles / (F_CPU / 1000000);
+  // Fast tasks run every pass; only their slow runs are worth ring space.
+  // Written after the run, so these pairs sit after anything nested inside.
+  if (def.interval >= 1000 || elapsed >= TRACE_MIN_RUN_US) {
+    traceRecord(TRACE_TASK + id, TRACE_BEGIN, 0, startCycles);
+    traceRecord(TRACE_TASK + id, TRACE_END, 0, endCycles);
+  }
+  if (wdtStalled) {
+    task.stalls++;
+    LOG_E(SYS, "Watchdog: task %s overran its %lu ms budget (%lu ms)", def.name, (unsigned long)def.budgetMs, elapsed / 1000);
+  }
+  setCrumb(CRUMB_SCHEDULER, 1000);
+  task.runs++;
+  task.totalUs += elapsed;
+  if (elapsed > task.maxUs) task.maxUs = elapsed;
+  sched.windowBusyUs += elapsed;
+
+  if (def.interval == 0) return;
+  task.ready = false;
+  task.due += def.interval;
+  // Don't replay missed periods after a long stall
+  if ((int32_t)(millis() - task.due) >= (int32_t)def.interval) task.due = millis() + def.interval;
+  if (task.idle) {
+    if ((int32_t)(task.idleUntil - task.due) > 0) task.due = task.idleUntil;
+    task.idle = false;
+  }
+  wheelInsert(id);
+}
+
+// One scheduler pass: run ready tasks by priority, network ones within budget
+void runScheduler() {
+  static uint8_t rotate = 0;
+  wheelAdvance(millis());
+
+  uint32_t networkUs = 0;
+  for (uint8_t priority = 0; priority < PRIO_COUNT; priority++) {
+    for (uint8_t k = 0; k < TASK_COUNT; k++) {
+      // Rotate the start so deferred network tasks get their turn first
+      uint8_t id = (k + rotate) % TASK_COUNT;
+      TaskDef def = readTaskDef(id);
+      if (def.priority != priority) continue;
+      if (def.interval != 0 && !taskState[id].ready) continue;
+      if (priority == PRIO_NETWORK && networkUs >= NETWORK_BUDGET_US) {
+        sched.deferred++;
+        continue;
+      }
+      uint32_t start = micros();
+      runTask(id, def);
+      if (priority == PRIO_NETWORK) networkUs += micros() - start;
+    }
+  }
+  rotate = (rotate + 1) % TASK_COUNT;
+
+  sched.windowPasses++;
+  uint32_t window = micros() - sched.windowStartUs;
+  if (window >= SCHED_WINDOW_US) {
+    sched.idlePermille = sched.windowBusyUs >= window ? 0 : 1000 - (uint64_t)sched.windowBusyUs * 1000 / window;
+    sched.passesPerSecond = (uint64_t)sched.windowPasses * 1000000 / window;
+    sched.sleepPermille = sched.windowSleepUs >= window ? 1000 : (uint64_t)sched.windowSleepUs * 1000 / window;
+    sched.windowStartUs += window;
+    sched.windowBusyUs = 0;
+    sched.windowPasses = 0;
+    sched.windowSleepUs = 0;
+  }
+}
+
+// Power saving. With a power mode set, loop() sleeps between scheduled
+// deadlines instead of spinning; the WiFi sleep type decides how deep the
+// SDK goes while we wait. Sleeps are capped at about one beacon interval and
+// end early on pending telnet or MQTT traffic, so network latency stays
+// bounded. The alarm path is timer driven, so its latency is unchanged.
+enum PowerMode {
+  POWER_OFF,    // Spin flat out, WiFi never sleeps
+  POWER_MODEM,  // Radio off between beacons
+  POWER_LIGHT   // Radio and CPU clock gated while idle
+};
+
+const uint32_t POWER_MAX_SLEEP_MS = 100;
+
+// Datasheet figures for the ESP8266 alone; the MQ-9 heater is not included
+const uint16_t POWER_ACTIVE_MA10 = 560;  // 56 mA receiving
+const uint16_t POWER_SLEEP_MA10[] = { 560, 150, 9 }; // By PowerMode, 0.1 mA units
+
+void applyPowerMode() {
+  static const WiFiSleepType_t sleepTypes[] = { WIFI_NONE_SLEEP, WIFI_MODEM_SLEEP, WIFI_LIGHT_SLEEP };
+  WiFi.setSleepMode(sleepTypes[constrain(config.powerMode, (int)POWER_OFF, (int)POWER_LIGHT)]);
+}
+
+bool networkPending() {
+  if (telnetServer.hasClient() || espClient.available()) return true;
+  for (TelnetSession& session : telnetSessions) {
+    if (session.client.available()) return true;
+  }
+  return false;
+}
+
+// Sleeps until the next task deadline when the power mode allows it
+void powerIdle() {
+  // Stay fully awake while booting and during an alert
+  if (config.powerMode == POWER_OFF || bootStage != BOOT_DONE || alertState) return;
+
+  int32_t sleepMs = min((int32_t)(schedulerNextDeadline() - millis()), (int32_t)POWER_MAX_SLEEP_MS);
+  if (sleepMs <= 0 || networkPending()) return;
+
+  uint32_t start = micros();
+  esp_delay(sleepMs, []() { return !networkPending(); }, 5);
+  sched.windowSleepUs += micros() - start;
+}
+
+// Estimated average current over the last window, in 0.1 mA: the datasheet
+// sleep figure for the power mode while in esp_delay(), active otherwise.
+// An estimate only; it assumes the SDK reached that sleep state every time.
+uint32_t estimatedCurrent() {
+  uint8_t mode = constrain(config.powerMode, (int)POWER_OFF, (int)POWER_LIGHT);
+  return ((1000 - sched.sleepPermille) * POWER_ACTIVE_MA10 + sched.sleepPermille * POWER_SLEEP_MA10[mode]) / 1000;
+}
+
+// Status page section: idle headroom and per-task run times
+void renderSchedulerStatus(String& html) {
+  // Only the time handed to the SDK; how deep it slept is not measured
+  html += F("<p><strong>Time in esp_delay:</strong><span>") + String(sched.sleepPermille / 10.0, 1) + F("%</span></p>");
+  html += F("<p><strong>Est. Current (ESP only, datasheet):</strong><span>~") + String(estimatedCurrent() / 10.0, 1) + F(" mA</span></p>");
+  html += F("<p><strong>Idle:</strong><span>") + String(sched.idlePermille / 10.0, 1) + F("%</span></p>");
+  html += F("<p><strong>Passes / s:</strong><span>") + String(sched.passesPerSecond) + F("</span></p>");
+  html += F("<p><strong>Deferred Network Runs:</strong><span>") + String(sched.deferred) + F("</span></p>");
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    TaskState& task = taskState[i];
+    if (task.runs == 0) continue;
+    html += F("<p><strong>") + String(FPSTR(TASKS[i].name)) + F(":</strong><span>") + String(task.runs) + F(" runs, avg ") +
+            String(task.totalUs / task.runs) + F(" us, max ") + String(task.maxUs) + F(" us</span></p>");
+  }
+}
+
+static const char CRUMB_SECTION_NAMES[SECTION_COUNT][8] PROGMEM = { "", "connect", "notify" };
+
+// "task" or "task/section" for a breadcrumb word
+void describeCrumb(uint32_t crumb, char* out, size_t size) {
+  uint8_t task = crumb & 0xFF;
+  uint8_t section = (crumb >> 8) & 0xFF;
+  char name[12];
+  if (task < TASK_COUNT) {
+    memcpy_P(name, TASKS[task].name, sizeof(name));
+  } else {
+    strlcpy_P(name, task == CRUMB_SETUP ? PSTR("setup") : PSTR("scheduler"), sizeof(name));
+  }
+  if (section > SECTION_NONE && section < SECTION_COUNT) {
+    char sectionName[8];
+    memcpy_P(sectionName, CRUMB_SECTION_NAMES[section], sizeof(sectionName));
+    snprintf_P(out, size, PSTR("%s/%s"), name, sectionName);
+  } else {
+    strlcpy(out, name, size);
+  }
+}
 
-  html += F("<div class='info-section'>");
-  html += F("<h2>Firmware Update</h2>");
-  html += F("<p>Download and install latest firmware from GitHub.</p>");
-  html += F("<a href='/update'><button style='background-color: #28a745;'>Update Firmware</button></a>");
-  html += F("</div>");
+// Collects the breadcrumb and stall record of the previous run. Must run
+// before startWatchdog() overwrites the breadcrumb.
+void loadPostMortem() {
+  postMortem.resetReason = ESP.getResetInfoPtr()->reason;
+  uint32_t crumb = RTC_USER_MEM[RTC_CRUMB_OFFSET];
+  postMortem.crumb = (crumb >> 16) == CRUMB_MAGIC ? crumb : 0;
+  ESP.rtcUserMemoryRead(RTC_STALL_OFFSET, (uint32_t*)&postMortem.stall, sizeof(postMortem.stall));
+  uint32_t invalid = 0;
+  ESP.rtcUserMemoryWrite(RTC_STALL_OFFSET, &invalid, sizeof(invalid));
+  // RTC memory holds noise after a power-on
+  if (postMortem.stall.magic != RTC_STALL_MAGIC || postMortem.resetReason == REASON_DEFAULT_RST) {
+    memset(&postMortem.stall, 0, sizeof(postMortem.stall));
+  }
+  if (postMortem.resetReason == REASON_DEFAULT_RST) postMortem.crumb = 0;
 
-  html += F("<div class='danger-zone'>");
-  html += F("<h2>Danger Zone</h2>");
-  html += F("<p>Erase all configurations including WiFi settings.</p>");
-  html += F("<a href='/reset' onclick='return confirmReset()'><button class='danger-button'>Reset Device</button></a>");
-  html += F("</div>");
+  LOG_I(SYS, "Reset reason: %s", ESP.getResetReason().c_str());
+  char stage[24];
+  if (postMortem.crumb) {
+    describeCrumb(postMortem.crumb, stage, sizeof(stage));
+    LOG_I(SYS, "Last stage before reset: %s", stage);
+  }
+  if (postMortem.stall.magic) {
+    describeCrumb(postMortem.stall.crumb, stage, sizeof(stage));
+    LOG_I(SYS, "Last watchdog stall: %s for %lu ms (pc 0x%08lx, isr sp ~0x%08lx)", stage,
+               (unsigned long)postMortem.stall.durationMs, (unsigned long)postMortem.stall.pc, (unsigned long)postMortem.stall.isrSp);
+  }
+  postMortemPending = true;
+}
 
-  html += F("<div class='danger-zone'>");
-  html += F("<h2>Calibration Reset</h2>");
-  html += F("<p>Erase the base gas value and restart the device to trigger calibration.</p>");
-  html += F("<a href='/reset-calibration'><button class='danger-button'>Reset Calibration</button></a>");
-  html += F("</div>");
+// Retained, so the reason of each device's last reset stays visible
+void publishPostMortem() {
+  JsonDocument doc;
+  char text[24];
+  doc[F("fw")] = FIRMWARE_VERSION;
+  doc[F("reason")] = ESP.getResetReason();
+  doc[F("info")] = ESP.getResetInfo();
+  if (postMortem.crumb) {
+    describeCrumb(postMortem.crumb, text, sizeof(text));
+    doc[F("stage")] = text;
+  }
+  if (postMortem.stall.magic) {
+    JsonObject stall = doc[F("stall")].to<JsonObject>();
+    describeCrumb(postMortem.stall.crumb, text, sizeof(text));
+    stall[F("stage")] = String(text);
+    stall[F("ms")] = postMortem.stall.durationMs;
+    snprintf_P(text, sizeof(text), PSTR("0x%08lx"), (unsigned long)postMortem.stall.pc);
+    stall[F("pc")] = String(text);
+    snprintf_P(text, sizeof(text), PSTR("0x%08lx"), (unsigned long)postMortem.stall.isrSp);
+    stall[F("isr_sp")] = String(text);  // Approximate, see RtcStallRecord
+  }
 
-  html += F("<div class='danger-zone'>");
-  html += F("<h2>Restart Device</h2>");
-  html += F("<p>Restart the device without erasing configurations.</p>");
-  html += F("<a href='/restart'><button class='danger-button'>Restart Device</button></a>");
-  html += F("</div>");
+  char payload[512];
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+  char topic[64];
+  snprintf_P(topic, sizeof(topic), PSTR("homeassistant/%s/diag/reset"), deviceHostname);
+  if (mqttClient.publish(topic, (const uint8_t*)payload, length, true)) {
+    postMortemPending = false;
+  } else {
+    LOG_W(MQTT, "MQTT: Reset report publish failed");
+  }
+}
 
-  html += F("<div class='danger-zone'>");
-  html += F("<h2>Reset WiFi Settings</h2>");
-  html += F("<p>Resetting WiFi settings will erase the saved WiFi credentials and restart the device to display the captive portal.</p>");
-  html += F("<a href='/reset-wifi'><button class='danger-button'>Reset WiFi Settings</button></a>");
-  html += F("</div>");
+void appendMetricHeader(String& out, PGM_P name, PGM_P type, PGM_P help) {
+  char line[160];
+  snprintf_P(line, sizeof(line), PSTR("# HELP %S %S\n# TYPE %S %S\n"), name, help, name, type);
+  out += line;
+}
 
-  html += F("</body></html>");
-  server.send(200, F("text/html"), html);
+// Sends what has been collected once it reaches a TCP segment or so, so the
+// whole exposition never has to fit in the heap
+void flushMetrics(String& body, bool force) {
+  if (body.length() < 1024 && !force) return;
+  server.sendContent(body);
+  body = "";
 }
 
-void handleSave() {
-  // Always handle device name regardless of MQTT status
-  if (server.hasArg("deviceName")) {
-    server.arg("deviceName").toCharArray(config.deviceName, 40);
+// Prometheus text exposition of health, watchdog and scheduler state
+void handleMetrics() {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain; version=0.0.4"), "");
+  String body;
+  body.reserve(1280);
+  char line[256];
+  char stage[24];
+
+  appendMetricHeader(body, PSTR("gasdetect_uptime_seconds"), PSTR("counter"), PSTR("Seconds since boot"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_uptime_seconds %lu\n"), millis() / 1000);
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_free_heap_bytes"), PSTR("gauge"), PSTR("Free heap"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_free_heap_bytes %lu\n"), (unsigned long)ESP.getFreeHeap());
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_heap_fragmentation_percent"), PSTR("gauge"), PSTR("100 - largest free block / free heap, last minute"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_heap_fragmentation_percent %u\n"), fragTrend.current);
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_heap_fragmentation_max_percent"), PSTR("gauge"), PSTR("Worst heap fragmentation since boot"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_heap_fragmentation_max_percent %u\n"), fragTrend.worst);
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_log_dropped_lines_total"), PSTR("counter"), PSTR("Log lines a slow sink lost to backpressure"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_log_dropped_lines_total{sink=\"serial\"} %lu\n"), (unsigned long)logRing.dropped[LOG_SINK_SERIAL]);
+  body += line;
+  for (uint8_t slot = 0; slot < TELNET_MAX_CLIENTS; slot++) {
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_log_dropped_lines_total{sink=\"telnet%u\"} %lu\n"), slot,
+               (unsigned long)logRing.dropped[LOG_SINK_TELNET + slot]);
+    body += line;
   }
-
-  bool wasMqttEnabled = config.mqttEnabled;
-  if (server.hasArg("mqttEnabled")) {
-    config.mqttEnabled = server.arg("mqttEnabled") == "1";
+  appendMetricHeader(body, PSTR("gasdetect_syslog_records_total"), PSTR("counter"), PSTR("Log records for the syslog collector, by outcome"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_syslog_records_total{result=\"sent\"} %lu\ngasdetect_syslog_records_total{result=\"rate_limited\"} %lu\n"
+                                      "gasdetect_syslog_records_total{result=\"send_failed\"} %lu\n"),
+             (unsigned long)syslogSink.sent, (unsigned long)syslogSink.rateLimited, (unsigned long)syslogSink.sendFailed);
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_telnet_slow_disconnects_total"), PSTR("counter"), PSTR("Telnet clients dropped for not reading their output"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_telnet_slow_disconnects_total %lu\n"), (unsigned long)telnetSlowDisconnects);
+  body += line;
+  appendMetricHeader(body, PSTR("gasdetect_idle_ratio"), PSTR("gauge"), PSTR("Share of time outside tasks, last window"));
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_idle_ratio %u.%03u\n"), sched.idlePermille / 1000, sched.idlePermille % 1000);
+  body += line;
+
+  appendMetricHeader(body, PSTR("gasdetect_reset_info"), PSTR("gauge"), PSTR("Reason and last stage of the previous reset"));
+  if (postMortem.crumb) {
+    describeCrumb(postMortem.crumb, stage, sizeof(stage));
   } else {
-    config.mqttEnabled = false;
+    strlcpy_P(stage, PSTR("unknown"), sizeof(stage));
+  }
+  snprintf_P(line, sizeof(line), PSTR("gasdetect_reset_info{reason=\"%s\",code=\"%lu\",stage=\"%s\"} 1\n"),
+             ESP.getResetReason().c_str(), (unsigned long)postMortem.resetReason, stage);
+  body += line;
+  if (postMortem.stall.magic) {
+    appendMetricHeader(body, PSTR("gasdetect_reset_stall_ms"), PSTR("gauge"), PSTR("Watchdog stall recorded before the previous reset"));
+    describeCrumb(postMortem.stall.crumb, stage, sizeof(stage));
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_reset_stall_ms{stage=\"%s\",pc=\"0x%08lx\",isr_sp=\"0x%08lx\"} %lu\n"), stage,
+               (unsigned long)postMortem.stall.pc, (unsigned long)postMortem.stall.isrSp, (unsigned long)postMortem.stall.durationMs);
+    body += line;
   }
 
-  if (config.mqttEnabled) {
-    if (server.hasArg("mqttServer")) {
-      server.arg("mqttServer").toCharArray(config.mqttServer, 40);
-    }
-    if (server.hasArg("mqttUser")) {
-      server.arg("mqttUser").toCharArray(config.mqttUser, 40);
-    }
-    if (server.hasArg("mqttPassword")) {
-      server.arg("mqttPassword").toCharArray(config.mqttPassword, 40);
-    }
-    if (server.hasArg("mqttPort")) {
-      config.mqttPort = server.arg("mqttPort").toInt();
+  appendMetricHeader(body, PSTR("gasdetect_task_runs_total"), PSTR("counter"), PSTR("Scheduler task runs"));
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_task_runs_total{task=\"%S\"} %lu\n"), TASKS[i].name, (unsigned long)taskState[i].runs);
+    body += line;
+  }
+  appendMetricHeader(body, PSTR("gasdetect_task_stalls_total"), PSTR("counter"), PSTR("Task runs over their watchdog budget"));
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_task_stalls_total{task=\"%S\"} %lu\n"), TASKS[i].name, (unsigned long)taskState[i].stalls);
+    body += line;
+  }
+  appendMetricHeader(body, PSTR("gasdetect_task_max_us"), PSTR("gauge"), PSTR("Longest task run"));
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_task_max_us{task=\"%S\"} %lu\n"), TASKS[i].name, (unsigned long)taskState[i].maxUs);
+    body += line;
+  }
+  flushMetrics(body, false);
+
+  // Buckets past the last used one are left out; +Inf always closes a series.
+  // Bucket b counts cycles below 2^(HIST_MIN_LOG2 + b), so its inclusive
+  // upper bound is one less.
+  appendMetricHeader(body, PSTR("gasdetect_task_cycles"), PSTR("histogram"), PSTR("Task run time in CPU cycles since the last reset"));
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    int last = HIST_BUCKETS - 2;
+    while (last >= 0 && taskHist[i].counts[last] == 0) last--;
+    uint32_t cumulative = 0;
+    for (int b = 0; b <= last; b++) {
+      cumulative += taskHist[i].counts[b];
+      snprintf_P(line, sizeof(line), PSTR("gasdetect_task_cycles_bucket{task=\"%S\",le=\"%lu\"} %lu\n"),
+                 TASKS[i].name, (1UL << (HIST_MIN_LOG2 + b)) - 1, (unsigned long)cumulative);
+      body += line;
     }
+    cumulative += taskHist[i].counts[HIST_BUCKETS - 1];
+    snprintf_P(line, sizeof(line), PSTR("gasdetect_task_cycles_bucket{task=\"%S\",le=\"+Inf\"} %lu\n"
+                                        "gasdetect_task_cycles_sum{task=\"%S\"} %llu\n"
+                                        "gasdetect_task_cycles_count{task=\"%S\"} %lu\n"),
+               TASKS[i].name, (unsigned long)cumulative, TASKS[i].name, (unsigned long long)taskHist[i].sumCycles,
+               TASKS[i].name, (unsigned long)cumulative);
+    body += line;
+    flushMetrics(body, false);
   }
 
-  if (server.hasArg("thresholdLimit")) {
-    config.thresholdLimit = server.arg("thresholdLimit").toInt();
+  flushMetrics(body, true);
+  server.sendContent("");
+}
+
+void handleResetHistograms() {
+  resetHistograms();
+  server.send(200, F("text/plain"), F("Histograms reset\n"));
+}
+
+// Dump format read by tools/profile_symbolize.py: comment header, then one
+// "pc task count" line per used slot
+void formatProfileHeader(char* out, size_t size) {
+  snprintf_P(out, size, PSTR("# gasdetect profile\n# firmware %s\n# period_us %u seconds %lu samples %lu dropped %lu\n"),
+             FIRMWARE_VERSION, PROFILE_PERIOD_US, profiler.seconds, (unsigned long)profiler.samples, (unsigned long)profiler.dropped);
+}
+
+bool formatProfileSlot(uint16_t index, char* out, size_t size) {
+  ProfileSlot& entry = profiler.table[index];
+  if (entry.pc == 0) return false;
+  char task[24];
+  describeCrumb(entry.taskAndCount >> 24, task, sizeof(task));
+  snprintf_P(out, size, PSTR("%08lx %s %lu\n"), (unsigned long)entry.pc, task, (unsigned long)(entry.taskAndCount & PROFILE_COUNT_MASK));
+  return true;
+}
+
+// Stops early, saying so, if a new run starts and resets the table mid-dump
+bool profileLine(uint32_t index, Print& out) {
+  if (index > PROFILE_SLOTS) return false;
+  if (profiler.active) {
+    out.println(F("# cut short: a new profile started"));
+    return false;
   }
-  if (server.hasArg("thresholdDuration")) {
-    config.thresholdDuration = server.arg("thresholdDuration").toInt();
+  char line[160];
+  if (index == 0) {
+    formatProfileHeader(line, sizeof(line));
+    out.print(line);
+  } else if (formatProfileSlot(index - 1, line, sizeof(line))) {
+    out.print(line);
   }
+  return true;
+}
 
-  // Handle NTFY toggle
-  if (server.hasArg("ntfyEnabled")) {
-    config.ntfyEnabled = server.arg("ntfyEnabled") == "1";
-  } else {
-    config.ntfyEnabled = false;
+// GET /profile?seconds=N starts a run; GET /profile downloads the last one
+void handleProfile() {
+  if (server.hasArg(F("seconds"))) {
+    unsigned long seconds = constrain(server.arg(F("seconds")).toInt(), 1L, 300L);
+    if (!startProfiler(seconds)) {
+      server.send(409, F("text/plain"), F("Profiler busy or out of memory\n"));
+      return;
+    }
+    LOG_I(NET, "Profiling for %lu s", seconds);
+    server.send(200, F("text/plain"), F("Profiling started; fetch /profile when done\n"));
+    return;
+  }
+  if (profiler.active || !profiler.table) {
+    server.send(409, F("text/plain"), profiler.active ? F("Profile still running\n") : F("No profile; start one with /profile?seconds=N\n"));
+    return;
   }
 
-  // Handle MQTT settings (use DeskClock-compatible field names and save to MQTTConfig)
-  if (server.hasArg("mqtt_server")) {
-    strncpy(mqttConfig.mqtt_server, server.arg("mqtt_server").c_str(), sizeof(mqttConfig.mqtt_server) - 1);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  String body;
+  body.reserve(1280);
+  char line[160];
+  formatProfileHeader(line, sizeof(line));
+  body += line;
+  for (uint16_t i = 0; i < PROFILE_SLOTS; i++) {
+    if (formatProfileSlot(i, line, sizeof(line))) body += line;
+    flushMetrics(body, false);
   }
-  if (server.hasArg("mqtt_port")) {
-    mqttConfig.mqtt_port = server.arg("mqtt_port").toInt();
+  flushMetrics(body, true);
+  server.sendContent("");
+}
+
+static const char TRACE_MARK_NAMES[MARK_COUNT][12] PROGMEM = { "http.POST", "adc", "buzzer" };
+
+// Dump format read by tools/trace_to_chrome.py: comment header, the event
+// name table, then one "cycles id phase arg" line per record, oldest first.
+// Returns the given line of the dump, false past the end.
+bool formatTraceLine(uint32_t index, char* out, size_t size) {
+  uint32_t kept = min(tracer.written, (uint32_t)TRACE_RECORDS);
+  if (index == 0) {
+    snprintf_P(out, size, PSTR("# gasdetect trace\n# firmware %s\n# cpu_mhz %lu seconds %lu records %lu overwritten %lu\n"),
+               FIRMWARE_VERSION, F_CPU / 1000000, tracer.seconds, (unsigned long)kept, (unsigned long)(tracer.written - kept));
+    return true;
   }
-  if (server.hasArg("mqtt_user")) {
-    strncpy(mqttConfig.mqtt_user, server.arg("mqtt_user").c_str(), sizeof(mqttConfig.mqtt_user) - 1);
+  index--;
+  char name[12];
+  if (index < TASK_COUNT) {
+    memcpy_P(name, TASKS[index].name, sizeof(name));
+    snprintf_P(out, size, PSTR("# event %04x task %s\n"), TRACE_TASK + index, name);
+    return true;
   }
-  if (server.hasArg("mqtt_password")) {
-    strncpy(mqttConfig.mqtt_password, server.arg("mqtt_password").c_str(), sizeof(mqttConfig.mqtt_password) - 1);
+  index -= TASK_COUNT;
+  if (index < SECTION_COUNT - 1) {
+    memcpy_P(name, CRUMB_SECTION_NAMES[index + 1], sizeof(CRUMB_SECTION_NAMES[0]));
+    snprintf_P(out, size, PSTR("# event %04x section %s\n"), TRACE_SECTION + index + 1, name);
+    return true;
   }
-  saveMQTTConfig();
-  loadMQTTConfig();
-  if (mqttConfig.isEmpty()) {
-    config.mqttEnabled = false;
-    printlnBoth(F("MQTT config not found or invalid, MQTT disabled"));
+  index -= SECTION_COUNT - 1;
+  if (index < MARK_COUNT) {
+    memcpy_P(name, TRACE_MARK_NAMES[index], sizeof(name));
+    snprintf_P(out, size, PSTR("# event %04x mark %s\n"), TRACE_MARK + index, name);
+    return true;
   }
+  index -= MARK_COUNT;
+  if (index >= kept) return false;
+  TraceRecord& record = tracer.ring[(tracer.written - kept + index) % TRACE_RECORDS];
+  snprintf_P(out, size, PSTR("%08lx %04x %c %u\n"), (unsigned long)record.cycles, record.id, record.phase, record.arg);
+  return true;
+}
 
-  // Handle MQTT client disconnect if being disabled
-  if (wasMqttEnabled && !config.mqttEnabled) {
-    mqttClient.disconnect();
+bool traceLine(uint32_t index, Print& out) {
+  if (tracer.active) {
+    out.println(F("# cut short: a new trace started"));
+    return false;
   }
-  
-  saveConfig();
-  loadMQTTConfig(); // Reload after saving
-  if (mqttConfig.isEmpty()) {
-    config.mqttEnabled = false;
-    printlnBoth(F("MQTT config not found or invalid, MQTT disabled"));
+  char line[160];
+  if (!formatTraceLine(index, line, sizeof(line))) return false;
+  out.print(line);
+  return true;
+}
+
+// GET /trace?seconds=N arms the tracer; GET /trace downloads the last run
+void handleTrace() {
+  if (server.hasArg(F("seconds"))) {
+    unsigned long seconds = constrain(server.arg(F("seconds")).toInt(), 1L, 300L);
+    if (!startTracer(seconds)) {
+      server.send(409, F("text/plain"), F("Tracer busy or out of memory\n"));
+      return;
+    }
+    LOG_I(NET, "Tracing for %lu s", seconds);
+    server.send(200, F("text/plain"), F("Tracing started; fetch /trace when done\n"));
+    return;
   }
-  
-  // If MQTT was enabled, initialize it
-  if (!wasMqttEnabled && config.mqttEnabled) {
-    setupMQTT();
-    reconnectMQTT();
+  if (tracer.active || !tracer.ring) {
+    server.send(409, F("text/plain"), tracer.active ? F("Trace still running\n") : F("No trace; start one with /trace?seconds=N\n"));
+    return;
   }
-  
-  server.send(200, F("text/html"), F("<html><body><h1>Configuration Saved</h1><a href='/'>Go Back</a></body></html>"));
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  String body;
+  body.reserve(1280);
+  char line[160];
+  for (uint32_t i = 0; formatTraceLine(i, line, sizeof(line)); i++) {
+    body += line;
+    flushMetrics(body, false);
+  }
+  flushMetrics(body, true);
+  server.sendContent("");
 }
 
-void handleUpdate() {
-  HTTPUpload& upload = server.upload();
-  if (upload.status == UPLOAD_FILE_START) {
-    printlnBoth(F("Update: ") + String(upload.filename));
-    uint32_t maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
-    if (!Update.begin(maxSketchSpace)) {
-      Update.printError(Serial);
-    }
-  } else if (upload.status == UPLOAD_FILE_WRITE) {
-    if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-      Update.printError(Serial);
-    }
-  } else if (upload.status == UPLOAD_FILE_END) {
-    if (Update.end(true)) {
-      printlnBoth(F("Update Success: ") + String(upload.totalSize));
-      server.send(200, F("text/plain"), F("Update successful! Rebooting..."));
-      delay(1000);
-      ESP.restart();
-    } else {
-      Update.printError(Serial);
+#ifdef HEAP_PROFILE
+// Tags ranked by allocations per second, the main driver of fragmentation.
+// The ranking is taken once, at the header, so rows stay in order while
+// the reply goes out; a second session asking meanwhile takes it again.
+HeapTagStats heapRanking[HEAP_TAGS];
+uint32_t heapRankingSeconds;
+
+bool heapProfileLine(uint32_t index, Print& out) {
+  if (index == 0) {
+    heapRankingSeconds = max((millis() - heapResetTime) / 1000, 1UL);
+    uint32_t ps = xt_rsil(3);
+    memcpy(heapRanking, heapTags, sizeof(heapRanking));
+    xt_wsr_ps(ps);
+    // Selection sort; the table is tiny
+    for (uint8_t i = 0; i < HEAP_TAGS; i++) {
+      uint8_t best = i;
+      for (uint8_t j = i + 1; j < HEAP_TAGS; j++) {
+        if (heapRanking[j].allocs > heapRanking[best].allocs) best = j;
+      }
+      HeapTagStats row = heapRanking[best];
+      heapRanking[best] = heapRanking[i];
+      heapRanking[i] = row;
     }
+    out.printf_P(PSTR("Heap by tag, last %lu s (free %u, max block %u, frag %u%%):\n"), (unsigned long)heapRankingSeconds,
+                 ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation());
+    out.printf_P(PSTR("%-20s %8s %8s %8s %8s %8s\n"), "tag", "alloc/s", "allocs", "live", "peak", "bytes/s");
+    return true;
   }
-  yield();
+  if (index > HEAP_TAGS || !heapRanking[index - 1].used) return false;
+  HeapTagStats& row = heapRanking[index - 1];
+  char tag[24];
+  if (row.tag == 0xFFFF) {
+    strlcpy_P(tag, PSTR("(other)"), sizeof(tag));
+  } else {
+    describeCrumb(row.tag, tag, sizeof(tag));
+  }
+  uint32_t seconds = heapRankingSeconds;
+  out.printf_P(PSTR("%-20s %8lu %8lu %8lu %8lu %8lu\n"), tag, (unsigned long)(row.allocs / seconds), (unsigned long)row.allocs,
+               (unsigned long)row.liveBytes, (unsigned long)row.peakBytes, (unsigned long)(row.totalBytes / seconds));
+  return true;
 }
+#endif
 
-void handleUpdatePage() {
-  String html = F("<html><head><meta name='viewport' content='width=device-width, initial-scale=1.0'>");
-  html += F("<style>");
-  html += F("body { font-family: Arial, sans-serif; margin: 0; padding: 20px; background: #f4f4f9; color: #333; }");
-  html += F("h1 { text-align: center; color: #444; }");
-  html += F(".update-container { max-width: 600px; margin: 0 auto; padding: 20px; background: #fff; border-radius: 5px; box-shadow: 0 2px 5px rgba(0,0,0,0.1); }");
-  html += F(".progress { width: 100%; height: 20px; background: #eee; border-radius: 10px; margin: 20px 0; display: none; }");
-  html += F(".progress-bar { width: 0%; height: 100%; background: #28a745; border-radius: 10px; transition: width 0.3s; }");
-  html += F("button { width: 100%; background: #28a745; color: white; border: none; padding: 10px; border-radius: 5px; cursor: pointer; font-size: 16px; }");
-  html += F("button:hover { background: #218838; }");
-  html += F(".status { text-align: center; margin: 10px 0; }");
-  html += F("</style>");
-
-  html += F("<script>");
-  html += F("async function startUpdate() {");
-  html += F("  const status = document.getElementById('status');");
-  html += F("  const progress = document.getElementById('progress');");
-  html += F("  const progressBar = document.getElementById('progressBar');");
-  html += F("  try {");
-  html += F("    status.textContent = 'Downloading firmware...';");
-  html += F("    progress.style.display = 'block';");
-  html += F("    const response = await fetch('https://arjunus1985.github.io/GasDetect/fwroot/firmware.bin');");
-  html += F("    const firmware = await response.arrayBuffer();");
-  html += F("    const formData = new FormData();");
-  html += F("    formData.append('firmware', new Blob([firmware]), 'firmware.bin');");
-  html += F("    status.textContent = 'Uploading firmware to device...';");
-  html += F("    progressBar.style.width = '50%';");
-  html += F("    const updateResponse = await fetch('/do-update', {");
-  html += F("      method: 'POST',");
-  html += F("      body: formData");
-  html += F("    });");
-  html += F("    if (updateResponse.ok) {");
-  html += F("      status.textContent = 'Update successful! Device will restart...';");
-  html += F("      progressBar.style.width = '100%';");
-  html += F("      setTimeout(() => { window.location.href = '/'; }, 5000);");
-  html += F("    } else {");
-  html += F("      throw new Error('Update failed');");
-  html += F("    }");
-  html += F("  } catch (error) {");
-  html += F("    status.textContent = 'Error: ' + error.message;");
-  html += F("    progressBar.style.background = '#dc3545';");
-  html += F("  }");
-  html += F("}");
-  html += F("</script></head><body>");
+// Instruction cache benchmark: GET /cache-bench?n=20
+//
+// Times each per-sample kernel in CPU cycles right after evicting the flash
+// instruction cache (cold) and again straight away (warm). IRAM kernels
+// should show little difference; the flash-resident std::sort median is the
+// reference for what a cold miss costs.
+#define BENCH_MAX_ITERATIONS 50
 
-  html += F("<div class='update-container'>");
-  html += F("<h1>Firmware Update</h1>");
-  html += F("<p>This will download and install the latest firmware from GitHub.</p>");
-  html += F("<button onclick='startUpdate()'>Start Update</button>");
-  html += F("<div id='progress' class='progress'>");
-  html += F("<div id='progressBar' class='progress-bar'></div>");
-  html += F("</div>");
-  html += F("<div id='status' class='status'></div>");
-  html += F("<p><a href='/'>&larr; Back to main page</a></p>");
-  html += F("</div>");
-  html += F("</body></html>");
+uint32_t benchSamples[BENCH_MAX_ITERATIONS];
 
-  server.send(200, F("text/html"), html);
+float medianFlashReference(const float* data, float* sorted, int size) {
+  memcpy(sorted, data, size * sizeof(float));
+  std::sort(sorted, sorted + size);
+  int mid = size / 2;
+  return (size % 2 == 0) ? (sorted[mid - 1] + sorted[mid]) / 2.0f : sorted[mid];
 }
 
-// Callback for when device enters config mode
-void configModeCallback(WiFiManager *myWiFiManager) {
-  printlnBoth(F("Failed to connect to WiFi"));
-  printlnBoth(F("Entered config mode"));
-  printlnBoth(F("AP IP address: ") + WiFi.softAPIP().toString());
-  printlnBoth(F("AP SSID: ") + myWiFiManager->getConfigPortalSSID());
+// Streams 64 KB of mapped flash, twice the cache size, through the cache
+#ifndef FLASH_MAPPED
+#define FLASH_MAPPED ((const volatile uint32_t*)0x40200000)
+#endif
+void evictICache() {
+  const volatile uint32_t* flash = FLASH_MAPPED;
+  uint32_t sink = 0;
+  for (uint32_t i = 0; i < 65536 / 4; i += 4) sink += flash[i];
+  (void)sink;
 }
 
-void printGasDataBuffer() {
-    
-        for (int i = 0; i < BUFFER_SIZE; i++) {
-          if (telnetClient && telnetClient.connected()) {
-            telnetClient.println(F("Gas Data Buffer:"));
-            telnetClient.printf(PSTR("[%.2f]"), gasDataBuffer[i]);
-          }
-            printfBoth(PSTR("[%.2f]"), gasDataBuffer[i]);
-        }
-        if (telnetClient && telnetClient.connected()) {
-        telnetClient.printf(PSTR("\n"));
-        }
-        printfBoth(PSTR("\n"));
-    }
+enum BenchKernel : uint8_t { KERNEL_MEDIAN, KERNEL_MEDIAN_FLASH, KERNEL_STORE, KERNEL_THRESHOLD, KERNEL_BUZZER, KERNEL_COUNT };
+static const char BENCH_KERNEL_NAMES[KERNEL_COUNT][20] PROGMEM = {
+  "median (iram)", "median (flash ref)", "store reading", "threshold", "buzzer"
+};
 
-// Function to set RGB LED color
-void setLedColor(bool r, bool g, bool b) {
-  digitalWrite(redPin, r ? HIGH : LOW);
-  digitalWrite(greenPin, g ? HIGH : LOW);
-  digitalWrite(bluePin, b ? HIGH : LOW);
+// One call of a kernel, in cycles; state it touches is put back afterwards
+uint32_t benchKernel(uint8_t kernel) {
+  float sorted[BUFFER_SIZE];
+  float savedBuffer[BUFFER_SIZE];
+  unsigned long savedBreach = breachStart;
+  unsigned long savedUnder = underThresholdStart;
+  unsigned long savedNotified = lastNotificationTime;
+  bool savedAlert = alertState;
+  bool savedBuzzer = buzzerActive;
+  unsigned long savedToggle = lastBuzzerToggle;
+  memcpy(savedBuffer, gasDataBuffer, sizeof(savedBuffer));
+  unsigned long now = millis();
+
+  uint32_t ps = xt_rsil(15);
+  uint32_t start = ESP.getCycleCount();
+  switch (kernel) {
+    case KERNEL_MEDIAN: medianFilter(gasDataBuffer, sorted, BUFFER_SIZE); break;
+    case KERNEL_MEDIAN_FLASH: medianFlashReference(gasDataBuffer, sorted, BUFFER_SIZE); break;
+    case KERNEL_STORE: storeGasReading(0); break;
+    case KERNEL_THRESHOLD: evaluateThreshold(0, now); break;
+    case KERNEL_BUZZER: updateBuzzer(now); break;
+  }
+  uint32_t cycles = ESP.getCycleCount() - start;
+  xt_wsr_ps(ps);
+
+  memcpy(gasDataBuffer, savedBuffer, sizeof(savedBuffer));
+  breachStart = savedBreach;
+  underThresholdStart = savedUnder;
+  lastNotificationTime = savedNotified;
+  alertState = savedAlert;
+  buzzerActive = savedBuzzer;
+  lastBuzzerToggle = savedToggle;
+  digitalWrite(buzzerPin, savedBuzzer ? HIGH : LOW);  // The pin follows buzzerActive
+  return cycles;
 }
 
-// Function to update LED status
-void updateLedStatus() {
-  unsigned long currentTime = millis();
-  
-  // During alert state
-  if (buzzerActive) {
-    if (currentLedState != LED_ALERT) {
-      priorLedState = currentLedState;
-      currentLedState = LED_ALERT;
-      ledBlinkInterval = redBlinkInterval;
-      currentLedInterval = redBlinkInterval;
-      lastLedToggle = currentTime;
-      ledOn = true;
-      setLedColor(true, false, false); // Red
+void handleCacheBench() {
+  if (alertState) {
+    server.send(409, F("text/plain"), F("Benchmark refused during an alert"));
+    return;
+  }
+  int iterations = server.hasArg("n") ? server.arg("n").toInt() : 20;
+  iterations = constrain(iterations, 2, BENCH_MAX_ITERATIONS);
+  String report = F("Instruction cache benchmark, cycles at ");
+  report += String(F_CPU / 1000000) + F(" MHz, ") + String(iterations) + F(" iterations\n");
+  report += F("kernel               cold p50  cold max  warm p50  warm max\n");
+
+  for (uint8_t kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+    uint32_t coldP50, coldMax;
+    for (int i = 0; i < iterations; i++) {
+      evictICache();
+      benchSamples[i] = benchKernel(kernel);
+      yield();
     }
-  } else if (currentLedState == LED_ALERT) {
-    // Restore previous state
-    currentLedState = priorLedState;
-    ledOn = true;
-    lastLedToggle = currentTime;
-    if (currentLedState == LED_WIFI_ONLY) {
-      currentLedInterval = greenBlinkInterval;
-      ledBlinkInterval = onDuration;
-    } else if (currentLedState == LED_MQTT_ACTIVE) {
-      currentLedInterval = blueBlinkInterval;
-      ledBlinkInterval = onDuration;
+    std::sort(benchSamples, benchSamples + iterations);
+    coldP50 = benchSamples[iterations / 2];
+    coldMax = benchSamples[iterations - 1];
+    benchKernel(kernel);
+    for (int i = 0; i < iterations; i++) {
+      benchSamples[i] = benchKernel(kernel);
     }
+    std::sort(benchSamples, benchSamples + iterations);
+
+    char name[20];
+    char line[96];
+    memcpy_P(name, BENCH_KERNEL_NAMES[kernel], sizeof(name));
+    snprintf_P(line, sizeof(line), PSTR("%-20s %9lu %9lu %9lu %9lu\n"), name, (unsigned long)coldP50, (unsigned long)coldMax,
+               (unsigned long)benchSamples[iterations / 2], (unsigned long)benchSamples[iterations - 1]);
+    report += line;
   }
+  server.send(200, F("text/plain"), report);
+}
 
-  // Update LED state based on connectivity
-  if (!buzzerActive) {
-    // Check WiFi connection first
-    if (WiFi.status() != WL_CONNECTED) {
-      // WiFi disconnected - set constant red
-      if (currentLedState != LED_WIFI_DISCONNECTED) {
-        currentLedState = LED_WIFI_DISCONNECTED;
-        ledOn = true;
-        setLedColor(true, false, false); // Solid red
-      }
-      
-      // Beep once every minute during WiFi disconnection
-      if (currentTime - lastWifiBeepTime >= 60000) { // 60 seconds
-        lastWifiBeepTime = currentTime;
-        // Schedule a short beep
-        buzzerStartTime = currentTime;
-        buzzerDuration = 100; // 100ms beep
-        buzzerActive = true;
-        digitalWrite(buzzerPin, HIGH);
-      }
-    } else if (WiFi.status() == WL_CONNECTED && mqttClient.connected() && config.mqttEnabled) {
-      if (currentLedState != LED_MQTT_ACTIVE) {
-        currentLedState = LED_MQTT_ACTIVE;
-        currentLedInterval = blueBlinkInterval;
-        ledBlinkInterval = onDuration;
-        lastLedToggle = currentTime;
-        ledOn = true;
-        setLedColor(false, false, true); // Blue
+// One line per index, through the reply buffer like the other long replies:
+// the whole summary is bigger than TELNET_REPLY_SIZE
+bool statsLine(uint32_t index, Print& out) {
+  switch (index) {
+    case 0:
+      out.printf_P(PSTR("Firmware %s, up %lu s\n"), FIRMWARE_VERSION, millis() / 1000);
+      break;
+    case 1:
+      out.printf_P(PSTR("Heap: %lu free, %lu largest block, %u%% fragmented (worst %u%%)\n"), (unsigned long)ESP.getFreeHeap(),
+                   (unsigned long)ESP.getMaxFreeBlockSize(), fragTrend.current, fragTrend.worst);
+      break;
+    case 2:
+      out.printf_P(PSTR("Scheduler: %u.%u%% idle, %lu passes/s, %lu deferred\n"), sched.idlePermille / 10, sched.idlePermille % 10,
+                   (unsigned long)sched.passesPerSecond, (unsigned long)sched.deferred);
+      break;
+    case 3:
+      out.printf_P(PSTR("Gas: %.2f (median %.2f), threshold %d, %S\n"), gasDataBuffer[BUFFER_SIZE - 1],
+                   calculateMedian(gasDataBuffer, BUFFER_SIZE), config.thresholdLimit, alertState ? PSTR("ALERT") : PSTR("normal"));
+      break;
+    case 4:
+      if (WiFi.status() == WL_CONNECTED) {
+        out.printf_P(PSTR("WiFi: %s, %d dBm\n"), WiFi.localIP().toString().c_str(), WiFi.RSSI());
+      } else {
+        out.printf_P(PSTR("WiFi: down, %lu failed attempts\n"), wifiRetryCount);
       }
-    } else if (WiFi.status() == WL_CONNECTED) {
-      if (currentLedState != LED_WIFI_ONLY) {
-        currentLedState = LED_WIFI_ONLY;
-        currentLedInterval = greenBlinkInterval;
-        ledBlinkInterval = onDuration;
-        lastLedToggle = currentTime;
-        ledOn = true;
-        setLedColor(false, true, false); // Green
+      break;
+    case 5:
+      out.printf_P(PSTR("MQTT: %S\n"), config.mqttEnabled ? mqttStateName(mqttClient.state()) : PSTR("disabled"));
+      break;
+    case 6: {
+      uint8_t clients = 0;
+      uint32_t telnetDropped = 0;
+      for (uint8_t slot = 0; slot < TELNET_MAX_CLIENTS; slot++) {
+        if (telnetSessions[slot].client.connected()) clients++;
+        telnetDropped += logRing.dropped[LOG_SINK_TELNET + slot];
       }
+      out.printf_P(PSTR("Telnet: %u of %u clients, %lu slow disconnects\n"), clients, TELNET_MAX_CLIENTS, (unsigned long)telnetSlowDisconnects);
+      out.printf_P(PSTR("Log lines dropped: serial %lu, telnet %lu\n"), (unsigned long)logRing.dropped[LOG_SINK_SERIAL], (unsigned long)telnetDropped);
+      break;
     }
+    case 7:
+      if (syslogSink.server.isSet()) {
+        out.printf_P(PSTR("Syslog: %s:%d, %lu sent, %lu rate limited, %lu send failed\n"), syslogSink.server.toString().c_str(), config.syslogPort,
+                     (unsigned long)syslogSink.sent, (unsigned long)syslogSink.rateLimited, (unsigned long)syslogSink.sendFailed);
+      } else {
+        out.println(F("Syslog: off"));
+      }
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+void printGasHistory(Print& out) {
+  out.printf_P(PSTR("Last %d readings, oldest first:\n"), BUFFER_SIZE);
+  for (int i = 0; i < BUFFER_SIZE; i++) {
+    out.printf_P(PSTR("%.2f%c"), gasDataBuffer[i], i == BUFFER_SIZE - 1 ? '\n' : ' ');
+  }
+  out.printf_P(PSTR("Median %.2f\n"), calculateMedian(gasDataBuffer, BUFFER_SIZE));
+}
+
+void printCalibration(Print& out) {
+  if (calibrationRunning) {
+    out.printf_P(PSTR("Calibrating: %lu of %lu s, %d readings, average so far %.2f\n"), (millis() - calibrationStartTime) / 1000,
+                 calibrationDuration / 1000, calibrationReadingCount, calculateCalibrationAverage());
+  } else if (config.baseGasValue == -1) {
+    out.println(F("Not calibrated; calibration starts after warmup"));
+  } else {
+    out.printf_P(PSTR("Base gas value %d\n"), config.baseGasValue);
   }
+}
 
-  // Handle blinking based on current state
-  if (currentTime - lastLedToggle >= ledBlinkInterval) {
-    lastLedToggle = currentTime;
-    
-    switch (currentLedState) {
-      case LED_STARTUP:
-        // For startup, just toggle
-        ledOn = !ledOn;
-        setLedColor(ledOn, false, false); // red 
-        break;
-        
-      case LED_WIFI_DISCONNECTED:
-        // Keep constant red, no toggling needed
-        break;
-        
-      case LED_WIFI_ONLY:
-        if (ledOn) {
-          // Turn off after 500ms ON time
-          ledOn = false;
-          setLedColor(false, false, false); // OFF
-          ledBlinkInterval = greenBlinkInterval - onDuration; // Remaining time until next cycle
-        } else {
-          // Turn on for 500ms
-          ledOn = true;
-          setLedColor(false, true, false); // Green
-          ledBlinkInterval = onDuration;
-        }
-        break;
-        
-      case LED_MQTT_ACTIVE:
-        if (ledOn) {
-          // Turn off after 500ms ON time
-          ledOn = false;
-          setLedColor(false, false, false); // OFF
-          ledBlinkInterval = blueBlinkInterval - onDuration; // Remaining time until next cycle
-        } else {
-          // Turn on for 500ms
-          ledOn = true;
-          setLedColor(false, false, true); // Blue
-          ledBlinkInterval = onDuration;
-        }
-        break;
-        
-      case LED_ALERT:
-        // For alert state, just toggle every interval
-        ledOn = !ledOn;
-        setLedColor(ledOn, false, false); // Red blink
-        break;
+// Telnet commands, one per line
+void handleTelnetCommand(char* line, TelnetSession& session) {
+  Print& out = session;
+  if (strcmp_P(line, PSTR("stats")) == 0) {
+    startTelnetReply(session, statsLine);
+  } else if (strcmp_P(line, PSTR("history")) == 0) {
+    printGasHistory(out);
+  } else if (strcmp_P(line, PSTR("calib")) == 0) {
+    printCalibration(out);
+  } else if (strcmp_P(line, PSTR("hist")) == 0) {
+    startTelnetReply(session, histogramLine);
+  } else if (strcmp_P(line, PSTR("hist reset")) == 0) {
+    resetHistograms();
+    out.println(F("Histograms reset"));
+  } else if (strncmp_P(line, PSTR("profile "), 8) == 0) {
+    unsigned long seconds = constrain(atol(line + 8), 1L, 300L);
+    if (startProfiler(seconds)) {
+      out.printf_P(PSTR("Profiling for %lu s; type 'profile' when done\n"), seconds);
+    } else {
+      out.println(F("Profiler busy or out of memory"));
+    }
+  } else if (strcmp_P(line, PSTR("profile")) == 0) {
+    if (profiler.active || !profiler.table) {
+      out.println(profiler.active ? F("Profile still running") : F("No profile; start one with 'profile <seconds>'"));
+    } else {
+      startTelnetReply(session, profileLine);
+    }
+  } else if (strncmp_P(line, PSTR("trace "), 6) == 0) {
+    unsigned long seconds = constrain(atol(line + 6), 1L, 300L);
+    if (startTracer(seconds)) {
+      out.printf_P(PSTR("Tracing for %lu s; type 'trace' when done\n"), seconds);
+    } else {
+      out.println(F("Tracer busy or out of memory"));
+    }
+  } else if (strcmp_P(line, PSTR("trace")) == 0) {
+    if (tracer.active || !tracer.ring) {
+      out.println(tracer.active ? F("Trace still running") : F("No trace; start one with 'trace <seconds>'"));
+    } else {
+      startTelnetReply(session, traceLine);
     }
+  } else if (strcmp_P(line, PSTR("heap")) == 0) {
+#ifdef HEAP_PROFILE
+    startTelnetReply(session, heapProfileLine);
+#else
+    out.println(F("Heap profiling is not built in; flash env:heap_profile"));
+#endif
+  } else if (strcmp_P(line, PSTR("heap reset")) == 0) {
+#ifdef HEAP_PROFILE
+    resetHeapProfile();
+    out.println(F("Heap counters reset"));
+#else
+    out.println(F("Heap profiling is not built in; flash env:heap_profile"));
+#endif
+  } else if (strcmp_P(line, PSTR("loglevel")) == 0) {
+    printLogLevels(out);
+  } else if (strncmp_P(line, PSTR("loglevel "), 9) == 0) {
+    char* level = strchr(line + 9, ' ');
+    if (level) *level++ = '\0';
+    if (level && setLogLevel(line + 9, level)) {
+      printLogLevels(out);
+    } else {
+      out.println(F("Usage: loglevel <sys|sensor|wifi|mqtt|notify|net> <none|error|warn|info|debug>"));
+    }
+  } else if (line[0] != '\0') {
+    out.println(F("Commands: stats, history, calib, hist, hist reset, profile <seconds>, profile, trace <seconds>, trace, heap, heap reset, loglevel"));
   }
 }
 
 void setup() {
+  endBootStep(STEP_CORE);
+  strlcpy(bootProfile.version, FIRMWARE_VERSION, sizeof(bootProfile.version));
+  bootProfile.resetReason = ESP.getResetInfoPtr()->reason;
   Serial.begin(9600);
+  LOG_I(SYS, "\nFirmware %s", FIRMWARE_VERSION);
+  loadPostMortem();
+  startWatchdog();
 
-  // Initialize LittleFS
+  // Initialize LittleFS. Without it the device still samples and alarms:
+  // config comes from the KV store or the defaults.
   if (!LittleFS.begin()) {
-    printlnBoth(F("Failed to mount file system"));
-    return;
+    LOG_E(SYS, "Failed to mount file system");
   }
+  endBootStep(STEP_FS);
 
-  // Load configuration from LittleFS
+  // Load configuration from the KV store (or LittleFS as a fallback)
+  kvBegin();
+  endBootStep(STEP_KV);
   loadConfig();
-  loadMQTTConfig(); // Only load once at startup
-  if (mqttConfig.isEmpty()) {
+  if (mqttConfigMissing()) {
     config.mqttEnabled = false;
-    printlnBoth(F("MQTT config not found or invalid, MQTT disabled"));
+    LOG_W(SYS, "MQTT config not found or invalid, MQTT disabled");
   }
 
-  // Check if restart counter has reached 3 - if so, calibration reset
-  if (config.restartCounter >= 3) {
-    printlnBoth(F("Restart counter reached 3 - performing calibration reset"));
-    
-    
-    // Reset counter to 0
-    config.baseGasValue = -1;
-    saveConfig();
-    
-    // Wait for WiFi disconnect to complete
-    delay(1000);
-  
-  }
-  if (config.restartCounter >= 5) {
-    printlnBoth(F("Restart counter reached 5 - performing factory reset"));
+  // Quick-restart counter lives in RTC memory so normal boots never write flash
+  loadRtcBootState();
+
+  if (rtcBootState.restartCounter >= 5) {
+    LOG_I(SYS, "Restart counter reached 5 - performing factory reset");
     
     // Clear stored configurations
+    kvWipe();
     LittleFS.remove("/config.json");
     
     // Clear WiFi settings by removing the wifi config file
@@ -1146,9 +4791,9 @@ void setup() {
     // Explicitly clear WiFi settings in memory
     WiFi.disconnect(true);  // disconnect and delete credentials
     
-    // Reset counter to 0
-    //config.restartCounter = 0;
-    //saveConfig();
+    // Reset counter to 0 so the clean boot does not trigger again
+    memset(&rtcBootState, 0, sizeof(rtcBootState));
+    saveRtcBootState();
     
     // Wait for WiFi disconnect to complete
     delay(1000);
@@ -1156,17 +4801,24 @@ void setup() {
     // Reboot the device with clean config
     ESP.eraseConfig();
     delay(1000);
+    logFlush();
     ESP.restart();
     return;
   }
+
+  // Check if restart counter has reached 3 - if so, calibration reset (once)
+  if (rtcBootState.restartCounter >= 3 && !(rtcBootState.flags & BOOT_FLAG_CALIBRATION_RESET)) {
+    LOG_I(SYS, "Restart counter reached 3 - performing calibration reset");
+    saveBaseGasValue(-1);
+    rtcBootState.flags |= BOOT_FLAG_CALIBRATION_RESET;
+  }
   
   // Increment restart counter and save
-  config.restartCounter++;
-  printfBoth(PSTR("Restart counter: %d\n"), config.restartCounter);
-  saveConfig();
-  
+  rtcBootState.restartCounter++;
+  LOG_I(SYS, "Restart counter: %d", rtcBootState.restartCounter);
+  saveRtcBootState();
+  endBootStep(STEP_CONFIG);
   
-  // Initialize serial communication for debugging
   
   // Initialize LED pins
   pinMode(redPin, OUTPUT);
@@ -1176,399 +4828,29 @@ void setup() {
   // Set initial LED state to red
   setLedColor(true, false, false);
   
-  // Initialize buzzer pin
+  // Initialize buzzer pin and start a short startup chirp; loop() turns it off
   pinMode(buzzerPin, OUTPUT);
-  digitalWrite(buzzerPin, LOW);  // Ensure buzzer is off initially
-//buzz the buzzer for 500 MS
-  digitalWrite(buzzerPin, HIGH); // Turn on the buzzer
-  delay(100);                   // Wait for 500 milliseconds
-  digitalWrite(buzzerPin, LOW);  // Turn off the buzzer
-  delay(1000);                   // Wait for 500 milliseconds
-  // WiFiManager setup
-  WiFiManager wifiManager;
-  
-  // Set config mode callback
-  wifiManager.setAPCallback(configModeCallback);
-  
-  // Set connection timeout to 30 seconds
-  wifiManager.setConnectTimeout(30);
-  
-  // Set timeout for AP mode portal
-  wifiManager.setConfigPortalTimeout(300); // 5 minutes (300 seconds) timeout for AP mode
-  
-  // Set custom AP name
-  String apName = F("GasDetector-") + String(ESP.getChipId());
-  
-  // Try to connect to WiFi or start AP mode if needed
-  printlnBoth(F("Attempting to connect to WiFi..."));
-  if (!wifiManager.autoConnect(apName.c_str())) {
-    printlnBoth(F("Failed to connect to WiFi and AP mode timed out"));
-    printlnBoth(F("Continuing in offline mode, will retry WiFi connection later"));
-    // Set flag to indicate we're in offline mode after AP timeout
-    apModeTimedOut = true;
-    lastWifiRetryTime = millis();
-  } else {
-    printlnBoth(F("Connected to WiFi"));
-  }
-
-  // Ensure we are in station mode for mDNS
-  WiFi.mode(WIFI_STA);
-  delay(100);
-  printfBoth(PSTR("WiFi mode: %d (1=STA,2=AP,3=STA+AP)\n"), WiFi.getMode());
-
-  // Format and sanitize hostname
-  String hostname = String(config.deviceName);
-  hostname.replace(' ', '-');
-  for (size_t i = 0; i < hostname.length(); i++) {
-    if (!isalnum(hostname[i]) && hostname[i] != '-') hostname[i] = '-';
-  }
-  hostname.toLowerCase();
-  if (hostname.length() == 0) hostname = F("gas-detector");
-
-  // Set WiFi hostname and start mDNS responder
-  WiFi.hostname(hostname.c_str());  // set DHCP hostname
-  delay(100);
-  printBoth(F("DHCP hostname: "));
-  printlnBoth(WiFi.hostname());
-  
-  if (!MDNS.begin(hostname.c_str())) {
-    printlnBoth(F("Error setting up mDNS responder"));
-    // Debug info
-    printBoth(F("Local IP: ")); printlnBoth(WiFi.localIP().toString());
-    printBoth(F("MAC: ")); printlnBoth(WiFi.macAddress());
-  } else {
-    MDNS.addService(F("http"), F("tcp"), 80);
-    MDNS.addService(F("telnet"), F("tcp"), 23);
-    printfBoth(PSTR("mDNS responder started: %s.local\n"), hostname.c_str());
-    // Debug info
-    printBoth(F("mDNS hostname: ")); printlnBoth(hostname + F(".local"));
-  }
-
-  // Configure OTA with same hostname
-  ArduinoOTA.setHostname(hostname.c_str());
-
-  ArduinoOTA.onStart([]() {
-    String type;
-    if (ArduinoOTA.getCommand() == U_FLASH) {
-      type = F("sketch");
-    } else { // U_SPIFFS
-      type = F("filesystem");
-    }
-    // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
-    printlnBoth(F("Start updating ") + type);
-  });
-  ArduinoOTA.onEnd([]() {
-    printlnBoth(F("\nEnd"));
-  });
-  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    printfBoth(PSTR("Progress: %u%%\r"), (progress / (total / 100)));
-  });
-  ArduinoOTA.onError([](ota_error_t error) {
-    printfBoth(PSTR("Error[%u]: "), error);
-    if (error == OTA_AUTH_ERROR) {
-      printlnBoth(F("Auth Failed"));
-    } else if (error == OTA_BEGIN_ERROR) {
-      printlnBoth(F("Begin Failed"));
-    } else if (error == OTA_CONNECT_ERROR) {
-      printlnBoth(F("Connect Failed"));
-    } else if (error == OTA_RECEIVE_ERROR) {
-      printlnBoth(F("Receive Failed"));
-    } else if (error == OTA_END_ERROR) {
-      printlnBoth(F("End Failed"));
-    }
-  });
-  ArduinoOTA.begin();
-
-  printlnBoth(F("OTA Ready"));
-  printBoth(F("IP address: "));
-  printlnBoth(WiFi.localIP().toString());
-
-  // Send IP address notification after reboot
-  //sendIpAddressNotification();
-
-  // Start Telnet server
-  telnetServer.begin();
-  telnetServer.setNoDelay(true);
-  printlnBoth(F("Telnet server started"));
-
-  
-
-
-  // Start Web Server
-  server.on(F("/"), handleRoot);
-  server.on(F("/save"), HTTP_POST, handleSave);
- 
-  server.on(F("/reset"), HTTP_GET, handleReset); // Add handler for reset
-  server.on(F("/reset-calibration"), HTTP_GET, handleResetCalibration); // Add handler for reset calibration
-  server.on(F("/restart"), HTTP_GET, handleRestart); // Add handler for restart
-  server.on(F("/reset-wifi"), HTTP_GET, handleResetWiFi); // Add handler for resetting only WiFi settings
-  server.on(F("/update"), HTTP_GET, handleUpdatePage);  // New route for update page
-  server.on(F("/do-update"), HTTP_POST, []() {
-    server.sendHeader(F("Connection"), F("close"));
-    server.send(200, F("text/plain"), (Update.hasError()) ? F("FAIL") : F("OK"));
-    ESP.restart();
-  }, handleUpdate);
-  server.begin();
-  printlnBoth(F("Web server started"));
-
-  // Only setup MQTT if enabled in config
-  
-
-  if (WiFi.status() == WL_CONNECTED && config.mqttEnabled)
-  {
-      setupMQTT();
-  }
-  else
-  {
-    printlnBoth(F("WiFi not connected. Skipping MQTT setup."));
+  digitalWrite(buzzerPin, HIGH);
+  buzzerStartTime = millis();
+  buzzerDuration = 100;
+  buzzerActive = true;
+
+  // Only a cold power-on pays the heater warmup
+  warmStart = restoreRtcWarmState();
+  if (warmStart) {
+    warmupTime = 0;
   }
+  loadWifiCache();
+  endBootStep(STEP_SETUP);
 
+  // Sampling and the alarm path run from loop() right away; networking is
+  // brought up alongside by runBootSequence()
   systemStartTime = millis(); // Record the system start time
-  config.restartCounter = 0;
-  saveConfig();
-
-  // At the end of setup, after WiFi/mDNS and config are loaded
-  delay(500); // Small delay to ensure network is ready
-  sendStartupNotification();
+  bootStage = BOOT_WIFI_START;
+  schedulerBegin();
 }
 
 void loop() {
-  // Handle OTA updates
-  ArduinoOTA.handle();
-  unsigned long currentTime = millis();
-  
-  // Check AP mode timeout and WiFi connection
-  if (!apModeTimedOut && WiFi.getMode() == WIFI_AP) {
-    if (currentTime - apModeStartTime >= AP_MODE_TIMEOUT) {
-      printlnBoth(F("AP mode timeout reached. Switching to offline mode."));
-      WiFi.softAPdisconnect(true);
-      WiFi.mode(WIFI_STA);
-      apModeTimedOut = true;
-      lastWifiRetryTime = currentTime;
-    }
-    // While in active AP mode, don't proceed with normal loop execution
-    return;
-  }
-
-  // If we're in offline mode (AP timed out), periodically try to reconnect to WiFi
-  if (apModeTimedOut && WiFi.status() != WL_CONNECTED) {
-    if (currentTime - lastWifiRetryTime >= WIFI_RETRY_INTERVAL) {
-      printlnBoth(F("Trying to reconnect to WiFi..."));
-      // Use WiFi.begin() without parameters to reconnect using stored credentials
-      WiFi.begin();
-      
-      // Wait for connection for a reasonable time (e.g., 10 seconds)
-      unsigned long connectStart = millis();
-      while (WiFi.status() != WL_CONNECTED && millis() - connectStart < 10000) {
-        delay(500);
-        printBoth(F("."));
-      }
-      
-      if (WiFi.status() == WL_CONNECTED) {
-        printlnBoth(F("\nConnected to WiFi!"));
-      } else {
-        printlnBoth(F("\nFailed to connect to WiFi, continuing in offline mode"));
-      }
-      
-      lastWifiRetryTime = currentTime;
-    }
-  }
-  
-  // Accept new Telnet client using accept() instead of available
-  if (telnetServer.hasClient()) {
-    if (!telnetClient || !telnetClient.connected()) {
-      if (telnetClient) telnetClient.stop();
-      telnetClient = telnetServer.accept();
-      printlnBoth(F("New Telnet client connected"));
-    } else {
-      telnetServer.accept().stop(); // Reject new client if already connected
-    }
-  }
-
-  // Non-blocking buzzer control for ongoing beeping during alert
-  if (alertState) {
-    // Toggle buzzer every 1 second
-    if (currentTime - lastBuzzerToggle >= 1000) {
-      lastBuzzerToggle = currentTime;
-      buzzerActive = !buzzerActive;
-      digitalWrite(buzzerPin, buzzerActive ? HIGH : LOW);
-    }
-  } else if (buzzerActive) {
-    // Turn off buzzer when duration elapsed
-    if (currentTime - buzzerStartTime >= buzzerDuration) {
-      digitalWrite(buzzerPin, LOW);
-      buzzerActive = false;
-    }
-  }
-
-  // Only perform MQTT operations if enabled
-  if (config.mqttEnabled) {
-    if (!mqttClient.connected()) {
-      reconnectMQTT();
-    }
-    mqttClient.loop(); // Call loop frequently to maintain connection
-  }
-
-  // Publish discovery config every 5 minutes
-  if (config.mqttEnabled && mqttClient.connected() && millis() - lastDiscoveryPublish > discoveryPublishInterval) {
-    publishDiscoveryConfig();
-    lastDiscoveryPublish = millis();
-  }
-
-  unsigned long now = millis();
-
-  // Check if we need to start calibration after warmup
-  if ((currentTime - systemStartTime > warmupTime) && config.baseGasValue == -1 && !calibrationRunning) {
-    // Start calibration process
-    calibrationRunning = true;
-    calibrationStartTime = currentTime;
-    calibrationReadingCount = 0;
-    printlnBoth(F("Starting calibration process for 5 minutes..."));
-    if (telnetClient && telnetClient.connected()) {
-      telnetClient.println(F("Starting calibration process for 5 minutes..."));
-    }
-  }
-
-  // Handle calibration process
-  if (calibrationRunning) {
-    // Update calibration LED pattern
-    updateCalibrationLed();
-    
-    // Take readings every second for 5 minutes
-    if ((currentTime - calibrationStartTime <= calibrationDuration) && 
-        (currentTime - lastReadingTime >= 1000)) {
-      lastReadingTime = currentTime;
-      
-      // Read gas sensor value
-      float rawGasReading = analogRead(gasSensorPin);
-      
-      // Calculate median from buffer
-      float medianValue = calculateMedian(gasDataBuffer, BUFFER_SIZE);
-      
-      // Store median value for calibration if buffer has data
-      if (calibrationReadingCount < numCalibrationReadings && medianValue > 0) {
-        calibrationReadings[calibrationReadingCount++] = medianValue;
-        
-        if (telnetClient && telnetClient.connected()) {
-          telnetClient.printf(PSTR("Calibration reading %d: %.2f\n"), calibrationReadingCount, medianValue);
-        }
-        printfBoth(PSTR("Calibration reading %d: %.2f\n"), calibrationReadingCount, medianValue);
-      }
-      
-      // Add gas sensor value to buffer
-      addGasReading(rawGasReading);
-      
-    } else if (currentTime - calibrationStartTime > calibrationDuration) {
-      // Calibration complete - calculate average and save
-      config.baseGasValue = (int)calculateCalibrationAverage();
-      saveConfig();
-      calibrationRunning = false;
-      //reset buffer to all zeroes
-      for (int i = 0; i < BUFFER_SIZE; i++) {
-        gasDataBuffer[i] = 0;
-      }
-      printfBoth(PSTR("Calibration complete. Base gas value: %d\n"), config.baseGasValue);
-      if (telnetClient && telnetClient.connected()) {
-        telnetClient.printf(PSTR("Calibration complete. Base gas value: %d\n"), config.baseGasValue);
-      }
-    }
-  } else if((currentTime - systemStartTime > warmupTime)) {
-    // Normal operation after warmup
-    // Update LED status (non-blocking)
-    updateLedStatus();
-    
-    // Read and publish sensor data every second without blocking
-    if (now - lastReadingTime >= 1000) {
-      lastReadingTime = now;
-      
-      // Read gas sensor value
-      float rawGasReading = analogRead(gasSensorPin);
-      
-      // Apply baseline offset if calibrated
-      float gasReading = rawGasReading;
-      if (config.baseGasValue > 0) {
-        gasReading = rawGasReading - config.baseGasValue;
-        if (gasReading < 0) gasReading = 0; // Ensure no negative values
-      }
-      
-      //print on telnet
-      //if (telnetClient && telnetClient.connected()) {
-      //  telnetClient.printf("Gas Sensor Value: %.2f\n", gasReading);
-      //}
-      printfBoth(PSTR("Gas Sensor Value: %.2f (raw: %.2f, base: %d)\n"), gasReading, rawGasReading, config.baseGasValue);
-      if (telnetClient && telnetClient.connected()) {
-        telnetClient.printf(PSTR("Gas Sensor Value: %.2f (raw: %.2f, base: %d)\n"), gasReading, rawGasReading, config.baseGasValue);
-      }
-      // Add gas sensor value to buffer
-      addGasReading(gasReading);
-      printGasDataBuffer();
-
-      // Check threshold breach
-      if (gasReading > config.thresholdLimit ) {
-        // reset under-threshold tracking
-        underThresholdStart = 0;
-        // mark start of breach
-        if (breachStart == 0) {
-          breachStart = now;
-        }
-        // if breach persists long enough, send notification every 10s
-        if (now - breachStart >= (unsigned long)config.thresholdDuration * 1000) {
-          alertState = true;  // Enable alert state with beeping
-          if (lastNotificationTime == 0 || now - lastNotificationTime >= 120000) {
-            sendNotification(true);
-            lastNotificationTime = now;
-          }
-        }
-      } else {
-        // reading back under threshold: start under-threshold timer
-        if (underThresholdStart == 0) {
-          underThresholdStart = now;
-        }
-        // if level stays below threshold long enough, reset breach state and notify
-        if (now - underThresholdStart >= (unsigned long)config.thresholdDuration * 1000) {
-          // send alert cleared notification
-          if (breachStart != 0) {
-            sendNotification(false);
-            alertState = false;  // Disable alert state, stop beeping
-          }
-          breachStart = 0;
-          underThresholdStart = 0;
-          lastNotificationTime = 0;
-        }
-      }
-
-      // Publish median value every 1 second
-      if (now - lastPublishTime >= publishInterval) {
-          float medianValue = calculateMedian(gasDataBuffer, BUFFER_SIZE);
-          
-          // Debug: Always log when we're about to publish
-          printfBoth(PSTR("Publishing MQTT data: %.2f (system uptime: %lu ms)\n"), medianValue, currentTime - systemStartTime);
-          if (telnetClient && telnetClient.connected()) {
-            telnetClient.printf(PSTR("Publishing MQTT data: %.2f (system uptime: %lu ms)\n"), medianValue, currentTime - systemStartTime);
-          }
-          
-          unsigned long currentTime = millis();
-
-          // Reduce startup delay from 60 seconds to 10 seconds
-          if (currentTime - systemStartTime > 10000) {
-            publishMQTTData(medianValue); // Publish median value
-            lastPublishTime = now;
-          } else {
-            printfBoth(PSTR("Skipping MQTT publish - system still warming up (%lu seconds remaining)\n"), (10000 - (currentTime - systemStartTime)) / 1000);
-          }
-      }
-    }
-
-    // Print the gas data buffer to Telnet
-    
-  }
-  // Handle web server requests
-  server.handleClient();
-
-  // Update mDNS once per second
-  static unsigned long _mdnsTimer = 0;
-  if (millis() - _mdnsTimer >= 1000) {
-    MDNS.update();
-    _mdnsTimer = millis();
-  }
-}
\ No newline at end of file
+  runScheduler();
+  powerIdle();
+}
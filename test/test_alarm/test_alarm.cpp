@@ -0,0 +1,125 @@
+// Alarm latency: the buzzer and LED tasks park for up to BUZZER_IDLE_POLL_MS
+// and LED_IDLE_POLL_MS while nothing changes, so an alert must wake them.
+// The sensor reading is moved through HOST_ADC_FILE and loop() is run on
+// the host clock, one millisecond per pass; the buzzer has to sound and the
+// LED show the alert within one wheel slot of taskSample() raising it, with
+// and without a power mode.
+//
+//   pio test -e native -f test_alarm
+#include <unistd.h>
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+const char* adcFile;
+
+void setReading(int value) {
+  FILE* file = fopen(adcFile, "w");
+  fprintf(file, "%d\n", value);
+  fclose(file);
+  hostClockAdvance(100000);  // analogRead() re-reads the file every 100 ms
+}
+
+// Runs loop() one millisecond per pass until done() or the timeout; returns
+// the simulated ms it took, or -1
+template <typename Done>
+long runUntil(Done done, uint32_t timeoutMs) {
+  uint32_t start = millis();
+  while (millis() - start < timeoutMs) {
+    WiFi.serviceEvents();  // Where the SDK would run between passes
+    loop();
+    if (done()) return millis() - start;
+    hostClockAdvance(1000);
+  }
+  return -1;
+}
+
+// Raises an alert and measures from the pass that raised it to the buzzer
+// and LED following
+void checkAlertLatency() {
+  setReading(900);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, runUntil([] { return alertState; }, 5000));
+  long buzzer = runUntil([] { return digitalRead(buzzerPin) == HIGH; }, 2000);
+  long led = runUntil([] { return currentLedState == LED_ALERT; }, 2000);
+  printf("alert: buzzer after %ld ms, LED after %ld ms\n", buzzer, led);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, buzzer);
+  TEST_ASSERT_LESS_THAN(WHEEL_RES_MS, buzzer);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, led);
+  TEST_ASSERT_LESS_THAN(WHEEL_RES_MS, led);
+
+  setReading(100);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, runUntil([] { return !alertState; }, 5000));
+  long quiet = runUntil([] { return digitalRead(buzzerPin) == LOW; }, 2000);
+  printf("clear: buzzer off after %ld ms\n", quiet);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, quiet);
+  TEST_ASSERT_LESS_THAN(WHEEL_RES_MS, quiet);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_alert_latency_awake() {
+  config.powerMode = POWER_OFF;
+  checkAlertLatency();
+}
+
+void test_alert_latency_modem_sleep() {
+  config.powerMode = POWER_MODEM;
+  applyPowerMode();
+  // Let the tasks park and loop() start sleeping first
+  runUntil([] { return false; }, 3000);
+  TEST_ASSERT_EQUAL(BOOT_DONE, bootStage);
+  // Start a fresh stats window so the check cannot straddle a rollover
+  sched.windowStartUs = micros();
+  sched.windowSleepUs = 0;
+  runUntil([] { return false; }, 100);
+  TEST_ASSERT_GREATER_THAN(0, sched.windowSleepUs);
+  checkAlertLatency();
+}
+
+// /cache-bench times the buzzer kernel mid-beep; the beep must carry on as
+// if it never ran
+void test_buzzer_bench_leaves_state() {
+  buzzerStartTime = millis() - 2000;
+  buzzerDuration = 100;
+  buzzerActive = true;
+  digitalWrite(buzzerPin, HIGH);
+  lastBuzzerToggle = 12345;
+  TaskState before = taskState[taskIndex(taskBuzzer)];
+  benchKernel(KERNEL_BUZZER);
+  TEST_ASSERT_TRUE(buzzerActive);
+  TEST_ASSERT_EQUAL(HIGH, digitalRead(buzzerPin));
+  TEST_ASSERT_EQUAL(12345, lastBuzzerToggle);
+  TaskState& after = taskState[taskIndex(taskBuzzer)];
+  TEST_ASSERT_EQUAL(before.idle, after.idle);
+  TEST_ASSERT_EQUAL(before.idleUntil, after.idleUntil);
+  buzzerActive = false;
+  digitalWrite(buzzerPin, LOW);
+}
+
+int main() {
+  static char path[] = "/tmp/test_alarm_adcXXXXXX";
+  close(mkstemp(path));
+  adcFile = path;
+  setenv("HOST_ADC_FILE", adcFile, 1);
+  setenv("HOST_PORT_OFFSET", "19100", 1);           // Clear of a running native build
+  setenv("HOST_RESOLVE", "ntfy.sh=127.0.0.1:1", 1);  // Notifications fail at once
+  unsetenv("HOST_FLASH_FILE");
+  unsetenv("HOST_FS_DIR");
+
+  // Boot past warmup with a calibrated base and a one-second breach window
+  setReading(100);
+  setup();
+  config.baseGasValue = 100;
+  config.thresholdDuration = 1;
+  runUntil([] { return false; }, warmupTime + 2000);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_alert_latency_awake);
+  RUN_TEST(test_alert_latency_modem_sleep);
+  RUN_TEST(test_buzzer_bench_leaves_state);
+  int failures = UNITY_END();
+  unlink(adcFile);
+  return failures;
+}
@@ -0,0 +1,145 @@
+// KV store crash consistency on the emulated flash: every write is cut off
+// after each possible number of programmed bytes, then the store is mounted
+// again and must hold the last committed value of every key.
+//
+//   pio test -e native -f test_kv
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#define VALUE_SIZE 100
+#define REGION_SIZE (2 * KV_SECTOR_SIZE)
+
+uint8_t* region() {
+  return (uint8_t*)hostFlash() + kv.base;
+}
+
+// Mounts the store again, as after a reset
+void reboot() {
+  hostFlashPowerCut(-1);
+  memset(&kv, 0, sizeof(kv));
+  TEST_ASSERT_TRUE(kvBegin());
+}
+
+void fillValue(uint8_t* value, uint16_t key, uint32_t generation) {
+  for (int i = 0; i < VALUE_SIZE; i++) value[i] = (uint8_t)(key * 31 + generation * 7 + i);
+}
+
+// Returns the generation stored for key, or -1 if it is missing or corrupt
+int readGeneration(uint16_t key, uint32_t newest) {
+  uint8_t stored[VALUE_SIZE];
+  if (kvRead(key, stored, sizeof(stored)) != VALUE_SIZE) return -1;
+  for (uint32_t generation = 0; generation <= newest; generation++) {
+    uint8_t expected[VALUE_SIZE];
+    fillValue(expected, key, generation);
+    if (memcmp(stored, expected, VALUE_SIZE) == 0) return generation;
+  }
+  return -1;
+}
+
+void writeGeneration(uint16_t key, uint32_t generation) {
+  uint8_t value[VALUE_SIZE];
+  fillValue(value, key, generation);
+  kvWrite(key, value, VALUE_SIZE);
+}
+
+// Cuts power during write(), at every point from before the first byte until
+// the write completes, and checks after each that the store mounts with key
+// at its old or new generation and every other key untouched
+void tearEverywhere(uint16_t key, uint32_t oldGeneration, const uint32_t* generations, int keys,
+                    void (*write)()) {
+  static uint8_t before[REGION_SIZE];
+  static uint8_t after[REGION_SIZE];
+  reboot();
+  memcpy(before, region(), REGION_SIZE);
+  write();
+  memcpy(after, region(), REGION_SIZE);
+
+  for (long cut = 0;; cut++) {
+    memcpy(region(), before, REGION_SIZE);
+    reboot();
+    hostFlashPowerCut(cut);
+    write();
+    bool complete = memcmp(region(), after, REGION_SIZE) == 0;
+    reboot();
+
+    char message[64];
+    snprintf(message, sizeof(message), "power cut after %ld bytes", cut);
+    int found = readGeneration(key, oldGeneration + 1);
+    if (complete) {
+      TEST_ASSERT_EQUAL_INT_MESSAGE(oldGeneration + 1, found, message);
+    } else {
+      TEST_ASSERT_TRUE_MESSAGE(found == (int)oldGeneration || found == (int)oldGeneration + 1, message);
+    }
+    for (int other = 1; other <= keys; other++) {
+      if (other != key) TEST_ASSERT_EQUAL_INT_MESSAGE(generations[other], readGeneration(other, generations[other]), message);
+    }
+
+    // The store must stay writable after recovering
+    writeGeneration(key, oldGeneration + 2);
+    reboot();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(oldGeneration + 2, readGeneration(key, oldGeneration + 2), message);
+    if (complete) break;
+  }
+}
+
+#define KEYS 3
+uint32_t generations[KEYS + 1];
+
+void writeNext() {
+  writeGeneration(1, generations[1] + 1);
+}
+
+void setUp() {
+  hostFlashPowerCut(-1);
+  memset(&kv, 0, sizeof(kv));
+  kv.base = FLASH_EEPROM_START - KV_SECTOR_SIZE;
+  memset(region(), 0xFF, REGION_SIZE);
+  TEST_ASSERT_TRUE(kvBegin());
+  for (uint16_t key = 1; key <= KEYS; key++) {
+    generations[key] = 0;
+    writeGeneration(key, 0);
+  }
+}
+
+void tearDown() {}
+
+void test_record_write_torn_at_every_offset() {
+  tearEverywhere(1, generations[1], generations, KEYS, writeNext);
+}
+
+void test_compaction_torn_at_every_offset() {
+  // One compaction first, so the spare sector holds stale records that the
+  // next compaction has to erase
+  uint32_t compactions = kv.compactions;
+  while (kv.compactions == compactions) writeGeneration(2, ++generations[2]);
+  uint32_t size = sizeof(KvRecordHeader) + kvAlign(VALUE_SIZE);
+  while (kv.writeOffset + size <= KV_SECTOR_SIZE) writeGeneration(3, ++generations[3]);
+  reboot();
+  TEST_ASSERT_FALSE(kv.spareClean);
+  TEST_ASSERT_TRUE(kv.writeOffset + size > KV_SECTOR_SIZE);
+
+  tearEverywhere(1, generations[1], generations, KEYS, writeNext);
+}
+
+void test_erase_count_survives_reset_after_service() {
+  uint32_t compactions = kv.compactions;
+  while (kv.compactions == compactions) writeGeneration(2, ++generations[2]);
+  reboot();
+  uint8_t spare = kv.active ^ 1;
+  uint32_t erased = kv.eraseCount[spare];
+
+  kvService();
+  TEST_ASSERT_EQUAL_UINT32(erased + 1, kv.eraseCount[spare]);
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(erased + 1, kv.eraseCount[spare]);
+  TEST_ASSERT_EQUAL_INT(generations[2], readGeneration(2, generations[2]));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_record_write_torn_at_every_offset);
+  RUN_TEST(test_compaction_torn_at_every_offset);
+  RUN_TEST(test_erase_count_survives_reset_after_service);
+  return UNITY_END();
+}
@@ -0,0 +1,89 @@
+// Binary log frames (-DLOG_BINARY) in the log ring: float arrays go out as
+// packed values, and a sink that falls behind loses whole frames, even
+// though frames hold '\n' bytes and may have been part sent.
+//
+//   pio test -e native -f test_log_binary
+#define LOG_BINARY
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+// Takes everything, like a sink with room to spare
+class NullPrint : public Print {
+public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t length) override { return length; }
+};
+
+uint8_t ringByte(uint32_t at) {
+  return logRing.data[at % LOG_RING_SIZE];
+}
+
+// Appends frames of newline bytes until the ring has wrapped a few times
+uint32_t appendNewlineFrames() {
+  float values[BUFFER_SIZE];
+  memset(values, '\n', sizeof(values));
+  uint32_t frames = 0;
+  while (logRing.head < 3 * LOG_RING_SIZE) {
+    LOG_D(SENSOR, "%[.2f]", LogFloats{ values, BUFFER_SIZE });
+    frames++;
+  }
+  return frames;
+}
+
+// Walks the serial sink's backlog frame by frame; it must end on head
+uint32_t countBacklogFrames() {
+  uint32_t frames = 0;
+  for (uint32_t at = logRing.tail[LOG_SINK_SERIAL]; at != logRing.head; at = logEntryEnd(at)) {
+    TEST_ASSERT_EQUAL_HEX8(LOG_FRAME_SYNC, ringByte(at));
+    TEST_ASSERT_TRUE((int32_t)(logRing.head - at) > 0);
+    frames++;
+  }
+  return frames;
+}
+
+void setUp() {
+  memset(&logRing, 0, sizeof(logRing));
+}
+
+void tearDown() {}
+
+void test_gas_buffer_is_one_frame_of_floats() {
+  for (int i = 0; i < BUFFER_SIZE; i++) gasDataBuffer[i] = i + 0.25f;
+  printGasDataBuffer();
+
+  TEST_ASSERT_EQUAL_HEX8(LOG_FRAME_SYNC, ringByte(0));
+  TEST_ASSERT_EQUAL(4 + 1 + BUFFER_SIZE * sizeof(float), ringByte(1));
+  TEST_ASSERT_EQUAL(logRing.head, 2 + ringByte(1));
+  uint32_t id;
+  memcpy(&id, logRing.data + 2, sizeof(id));
+  TEST_ASSERT_EQUAL_HEX32(logFormatId("%[.2f]"), id);
+  TEST_ASSERT_EQUAL(BUFFER_SIZE, ringByte(6));
+  TEST_ASSERT_EQUAL_MEMORY(gasDataBuffer, logRing.data + 7, sizeof(gasDataBuffer));
+}
+
+void test_full_ring_drops_whole_frames() {
+  uint32_t frames = appendNewlineFrames();
+  uint32_t backlog = countBacklogFrames();
+  TEST_ASSERT_GREATER_THAN(0, backlog);
+  TEST_ASSERT_EQUAL(frames, backlog + logRing.dropped[LOG_SINK_SERIAL]);
+}
+
+void test_part_sent_frame_is_dropped_whole() {
+  float values[BUFFER_SIZE] = {};
+  LOG_D(SENSOR, "%[.2f]", LogFloats{ values, BUFFER_SIZE });
+  NullPrint out;
+  logDrainTo(LOG_SINK_SERIAL, out, 10);  // Stop inside the first frame
+
+  uint32_t frames = 1 + appendNewlineFrames();
+  uint32_t backlog = countBacklogFrames();
+  TEST_ASSERT_EQUAL(frames, backlog + logRing.dropped[LOG_SINK_SERIAL]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_gas_buffer_is_one_frame_of_floats);
+  RUN_TEST(test_full_ring_drops_whole_frames);
+  RUN_TEST(test_part_sent_frame_is_dropped_whole);
+  return UNITY_END();
+}
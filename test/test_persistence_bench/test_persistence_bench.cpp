@@ -0,0 +1,212 @@
+// Persistence latency benchmark on the emulated flash: p50/p99/max of each
+// KV operation at several fill levels of the active sector, plus the save
+// that compacts and the mount and first save after a power cut torn into a
+// record. The flash is always a scratch image in RAM, whatever
+// HOST_FLASH_FILE says. Chip timings come from HOST_FLASH_ERASE_US and
+// HOST_FLASH_PAGE_US, by default typical values for the ESP-12 flash:
+//
+//   HOST_FLASH_ERASE_US=45000 HOST_FLASH_PAGE_US=700 pio test -e native -f test_persistence_bench -v
+//
+// Covered paths: config save and load, the boot profile history append
+// (read, shift, write back, as finishBootProfile() does) and the mount scan.
+// There is no separate journal: the KV log is the journal, and its fill
+// level is the axis swept here.
+//
+// The JSON config paths are timed too, but the host LittleFS keeps files in
+// memory rather than on the flash image, so those rows are CPU cost only and
+// have no fill axis.
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#define ITERATIONS 200 // Enough that p99 is not the maximum
+#define REGION_SIZE (2 * KV_SECTOR_SIZE)
+#define KV_KEY_SCRATCH 0x7F00
+#define FILLER_SIZE 60
+
+static const uint8_t FILL_PERCENT[] = { 0, 25, 50, 75, 95 };
+
+uint32_t samples[ITERATIONS];
+
+void report(const char* name) {
+  std::sort(samples, samples + ITERATIONS);
+  printf("%-30s p50 %7lu us  p99 %7lu us  max %7lu us\n", name, (unsigned long)samples[ITERATIONS / 2],
+         (unsigned long)samples[(ITERATIONS * 99) / 100], (unsigned long)samples[ITERATIONS - 1]);
+}
+
+uint8_t* region() {
+  return (uint8_t*)hostFlash() + kv.base;
+}
+
+void remount() {
+  hostFlashPowerCut(-1);
+  memset(&kv, 0, sizeof(kv));
+  TEST_ASSERT_TRUE(kvBegin());
+}
+
+uint8_t blob[CONFIG_BLOB_SIZE + 1];
+size_t blobLength;
+
+void setUp() {
+  hostFlashPowerCut(-1);
+  memset(&kv, 0, sizeof(kv));
+  kv.base = FLASH_EEPROM_START - KV_SECTOR_SIZE;
+  memset(region(), 0xFF, REGION_SIZE);
+  TEST_ASSERT_TRUE(kvBegin());
+  blobLength = encodeConfig(config, blob, CONFIG_BLOB_SIZE);
+  TEST_ASSERT_TRUE(kvWrite(KV_KEY_CONFIG, blob, blobLength));
+}
+
+void tearDown() {}
+
+// Appends superseded filler records until the active sector is percent full,
+// with the spare sector erased as loop() would leave it, and saves that
+// state so every iteration starts from it
+uint8_t fillImage[REGION_SIZE];
+KvState fillState;
+
+void fillTo(uint8_t percent) {
+  uint8_t filler[FILLER_SIZE] = {};
+  while (kv.writeOffset * 100 < KV_SECTOR_SIZE * (uint32_t)percent) {
+    filler[0]++;
+    TEST_ASSERT_TRUE(kvWrite(KV_KEY_SCRATCH, filler, sizeof(filler)));
+  }
+  kvService();
+  memcpy(fillImage, region(), REGION_SIZE);
+  fillState = kv;
+}
+
+void restoreFill() {
+  memcpy(region(), fillImage, REGION_SIZE);
+  kv = fillState;
+}
+
+void test_kv_by_fill_level() {
+  Config scratch = config;
+  char name[40];
+  for (uint8_t percent : FILL_PERCENT) {
+    setUp();
+    fillTo(percent);
+    printf("fill %u%%: %lu of %u bytes used\n", percent, (unsigned long)kv.writeOffset, KV_SECTOR_SIZE);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+      restoreFill();
+      blob[blobLength] = i;  // Vary the record so the write is never skipped
+      uint32_t start = micros();
+      TEST_ASSERT_TRUE(kvWrite(KV_KEY_CONFIG, blob, blobLength + 1));
+      samples[i] = micros() - start;
+    }
+    snprintf(name, sizeof(name), "kv config save @%u%%", percent);
+    report(name);
+
+    restoreFill();
+    for (int i = 0; i < ITERATIONS; i++) {
+      uint32_t start = micros();
+      int length = kvRead(KV_KEY_CONFIG, blob, sizeof(blob));
+      decodeConfig(scratch, blob, length);
+      samples[i] = micros() - start;
+      TEST_ASSERT_EQUAL_INT(blobLength, length);
+    }
+    snprintf(name, sizeof(name), "kv config load @%u%%", percent);
+    report(name);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+      restoreFill();
+      bootProfile.totalUs = i;
+      uint32_t start = micros();
+      if (kvRead(KV_KEY_BOOT_PROFILES, &bootProfileLog, sizeof(bootProfileLog)) != sizeof(bootProfileLog)) {
+        memset(&bootProfileLog, 0, sizeof(bootProfileLog));
+      }
+      memmove(&bootProfileLog.profiles[1], &bootProfileLog.profiles[0], sizeof(BootProfile) * (BOOT_PROFILE_HISTORY - 1));
+      bootProfileLog.profiles[0] = bootProfile;
+      TEST_ASSERT_TRUE(kvWrite(KV_KEY_BOOT_PROFILES, &bootProfileLog, sizeof(bootProfileLog)));
+      samples[i] = micros() - start;
+    }
+    snprintf(name, sizeof(name), "kv history append @%u%%", percent);
+    report(name);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+      restoreFill();
+      uint32_t start = micros();
+      remount();
+      samples[i] = micros() - start;
+    }
+    snprintf(name, sizeof(name), "kv mount scan @%u%%", percent);
+    report(name);
+  }
+}
+
+void test_kv_compaction() {
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t size = sizeof(KvRecordHeader) + kvAlign(blobLength + 1);
+    while (kv.writeOffset + size <= KV_SECTOR_SIZE) {
+      blob[blobLength]++;
+      kvWrite(KV_KEY_SCRATCH, blob, blobLength + 1);
+    }
+    if (i % 2) kvService();  // Half with the spare erased ahead of time
+    blob[blobLength]++;
+    uint32_t start = micros();
+    TEST_ASSERT_TRUE(kvWrite(KV_KEY_SCRATCH, blob, blobLength + 1));
+    samples[i] = micros() - start;
+  }
+  report("kv save that compacts");
+}
+
+// Cuts power part way into a save, then times the mount and the first save
+// after it, which compacts when the cut landed in the record header
+void test_kv_after_power_cut() {
+  static uint32_t saves[ITERATIONS];
+  for (int i = 0; i < ITERATIONS; i++) {
+    blob[blobLength]++;
+    hostFlashPowerCut(1 + ESP.random() % (sizeof(KvRecordHeader) + blobLength));
+    kvWrite(KV_KEY_SCRATCH, blob, blobLength + 1);
+
+    uint32_t start = micros();
+    remount();
+    samples[i] = micros() - start;
+    TEST_ASSERT_EQUAL_INT(blobLength, kvRead(KV_KEY_CONFIG, blob, blobLength));
+
+    blob[blobLength]++;
+    start = micros();
+    TEST_ASSERT_TRUE(kvWrite(KV_KEY_SCRATCH, blob, blobLength + 1));
+    saves[i] = micros() - start;
+    kvService();
+  }
+  report("kv mount after power cut");
+  memcpy(samples, saves, sizeof(samples));
+  report("kv save after power cut");
+}
+
+void test_json_config() {
+  LittleFS.begin();
+  Config scratch = config;
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = micros();
+    TEST_ASSERT_TRUE(saveConfigJson(scratch, "/bench_config.json"));
+    samples[i] = micros() - start;
+  }
+  report("json config save (cpu)");
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint32_t start = micros();
+    TEST_ASSERT_TRUE(loadConfigJson(scratch, "/bench_config.json"));
+    samples[i] = micros() - start;
+  }
+  report("json config load (cpu)");
+  LittleFS.remove("/bench_config.json");
+}
+
+int main() {
+  // Never touch a flash file another run keeps its store in
+  unsetenv("HOST_FLASH_FILE");
+  unsetenv("HOST_FS_DIR");
+  setenv("HOST_FLASH_ERASE_US", "45000", 0);
+  setenv("HOST_FLASH_PAGE_US", "700", 0);
+  printf("flash: %s us per sector erase, %s us per page\n", getenv("HOST_FLASH_ERASE_US"), getenv("HOST_FLASH_PAGE_US"));
+
+  UNITY_BEGIN();
+  RUN_TEST(test_kv_by_fill_level);
+  RUN_TEST(test_kv_compaction);
+  RUN_TEST(test_kv_after_power_cut);
+  RUN_TEST(test_json_config);
+  return UNITY_END();
+}
@@ -0,0 +1,72 @@
+// Per-sample cost of logging: cycles for one taskSample() call, read with
+// ESP.getCycleCount() as the task histograms do, at the log levels this
+// build was compiled with and again with the production levels (warn, info
+// for wifi) set at run time. A run-time level still pays a compare per
+// call site; build with env:production's flags to time them compiled out:
+//
+//   pio test -e native -f test_sample_bench -v
+//
+// On the host the counter is wall time scaled to 80 MHz, so the figures
+// show the relative saving, not what the ESP8266 spends; there the
+// soft-float formatting of the debug lines costs far more.
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#define ITERATIONS 2000
+
+uint32_t samples[ITERATIONS];
+
+// Takes everything, like a serial port with room to spare
+class NullPrint : public Print {
+public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t length) override { return length; }
+};
+
+uint32_t benchSample(const char* name) {
+  NullPrint out;
+  for (int i = 0; i < ITERATIONS; i++) {
+    gasDataBuffer[i % BUFFER_SIZE] = 100 + i % 7;
+    uint32_t start = ESP.getCycleCount();
+    taskSample();
+    samples[i] = ESP.getCycleCount() - start;
+    logDrainTo(LOG_SINK_SERIAL, out, LOG_RING_SIZE);
+  }
+  std::sort(samples, samples + ITERATIONS);
+  printf("%-24s p50 %7lu  p99 %7lu cycles\n", name, (unsigned long)samples[ITERATIONS / 2],
+         (unsigned long)samples[(ITERATIONS * 99) / 100]);
+  return samples[ITERATIONS / 2];
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_sample_cost_by_log_level() {
+  uint8_t compiled[LOG_MOD_COUNT];
+  memcpy(compiled, logLevels, sizeof(compiled));
+  uint32_t full = benchSample("compiled levels");
+
+  static const uint8_t production[LOG_MOD_COUNT] = { 2, 2, 3, 2, 2, 2 };
+  for (uint8_t m = 0; m < LOG_MOD_COUNT; m++) logLevels[m] = min(production[m], compiled[m]);
+  uint32_t quiet = benchSample("production levels");
+  memcpy(logLevels, compiled, sizeof(compiled));
+
+  printf("saved per sample: %ld cycles\n", (long)full - (long)quiet);
+  // With the debug lines compiled out both runs cost the same, give or take noise
+  if (LOG_LEVEL_SENSOR >= LOG_LEVEL_DEBUG) TEST_ASSERT_LESS_THAN(full, quiet);
+}
+
+int main() {
+  setenv("HOST_ADC", "300", 0);
+  // Past warmup with a calibrated base, so every call takes the normal path
+  warmupTime = 0;
+  systemStartTime = millis() - 1000;
+  config.baseGasValue = 100;
+  config.thresholdLimit = 1000;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_sample_cost_by_log_level);
+  return UNITY_END();
+}
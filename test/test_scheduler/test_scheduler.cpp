@@ -0,0 +1,180 @@
+// Timer wheel: tasks are driven through wheelInsert()/wheelAdvance() on a
+// simulated clock and must never come due early, never be lost when a level 1
+// slot cascades down, and keep both properties across the 2^32 ms wrap of
+// millis(). The whole scheduler is then run through setup() and loop() on
+// the host clock moved forward by hostClockAdvance(), including a boot whose
+// file system mount fails, taskWake() and taskIdleUntil().
+//
+//   pio test -e native -f test_scheduler
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+// Periods around the level boundaries: within one level 0 slot, within the
+// level 0 span, just past it, and past the level 1 horizon (clamped)
+static const uint32_t PERIODS[] = { 7, 20, 100, 511, 512, 513, 1000, 4095, 40000, 60000 };
+#define TEST_TASKS (sizeof(PERIODS) / sizeof(PERIODS[0]))
+
+uint32_t runs[TEST_TASKS];
+uint32_t maxLateMs;
+
+void startWheel(uint32_t now) {
+  memset(wheel, -1, sizeof(wheel));
+  memset(taskState, 0, sizeof(taskState));
+  memset(runs, 0, sizeof(runs));
+  maxLateMs = 0;
+  wheelTime = now - now % WHEEL_RES_MS;
+  for (uint8_t id = 0; id < TEST_TASKS; id++) {
+    taskState[id].due = now + PERIODS[id];
+    wheelInsert(id);
+  }
+}
+
+// Advances the clock from now to end in steps of up to maxStep ms, running
+// tasks as runScheduler() would and checking none is due in the future.
+// Returns the time reached.
+uint32_t runUntil(uint32_t now, uint32_t end, uint32_t maxStep) {
+  while ((int32_t)(end - now) > 0) {
+    now += 1 + ESP.random() % maxStep;
+    wheelAdvance(now);
+    for (uint8_t id = 0; id < TEST_TASKS; id++) {
+      TaskState& task = taskState[id];
+      while (task.ready) {  // Catches up on every period the step crossed
+        char message[64];
+        snprintf(message, sizeof(message), "task %u (%lu ms) ran %ld ms early", id, (unsigned long)PERIODS[id],
+                 (long)(task.due - now));
+        TEST_ASSERT_TRUE_MESSAGE((int32_t)(now - task.due) >= 0, message);
+        maxLateMs = std::max(maxLateMs, now - task.due);
+        runs[id]++;
+        task.ready = false;
+        task.due += PERIODS[id];
+        wheelInsert(id);
+      }
+    }
+  }
+  return now;
+}
+
+// Every task ran once per elapsed period, allowing for the last ones
+// still waiting out the rounding to the next slot
+void checkRunCounts(uint32_t elapsed) {
+  for (uint8_t id = 0; id < TEST_TASKS; id++) {
+    char message[64];
+    snprintf(message, sizeof(message), "task %u (%lu ms) lost", id, (unsigned long)PERIODS[id]);
+    TEST_ASSERT_TRUE_MESSAGE(runs[id] >= (elapsed - 2 * WHEEL_RES_MS) / PERIODS[id], message);
+    TEST_ASSERT_TRUE_MESSAGE(runs[id] <= elapsed / PERIODS[id], message);
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_no_task_runs_early() {
+  uint32_t start = 123457;
+  startWheel(start);
+  checkRunCounts(runUntil(start, start + 200000, 3) - start);
+  TEST_ASSERT_LESS_THAN(2 * WHEEL_RES_MS, maxLateMs);
+}
+
+void test_nothing_lost_across_level1_cascade() {
+  // Steps longer than a level 0 slot, so cascades and level 0 slots are
+  // crossed several at a time
+  uint32_t start = 5 * WHEEL_SPAN_MS - 1;
+  startWheel(start);
+  checkRunCounts(runUntil(start, start + 300000, WHEEL_RES_MS * 3) - start);
+  for (uint8_t id = 0; id < TEST_TASKS; id++) {
+    TEST_ASSERT_GREATER_THAN(0, runs[id]);
+  }
+}
+
+void test_wraparound_of_millis() {
+  uint32_t start = 0xFFFFFFFFu - 70000;
+  startWheel(start);
+  checkRunCounts(runUntil(start, start + 150000, 5) - start);
+  TEST_ASSERT_LESS_THAN(2 * WHEEL_RES_MS, maxLateMs);
+}
+
+// taskWake() takes a task out of its slot; the tasks linked after it in the
+// same slot must still run
+void test_removed_task_leaves_its_slot_intact() {
+  uint32_t start = 40000;
+  startWheel(start);
+  uint8_t removed[] = { 0, 4, 8 };  // One in level 0, two in level 1
+  for (uint8_t id : removed) wheelRemove(id);
+  uint32_t now = runUntil(start, start + 100000, 4);
+  for (uint8_t id = 0; id < TEST_TASKS; id++) {
+    bool isRemoved = id == 0 || id == 4 || id == 8;
+    if (isRemoved) {
+      TEST_ASSERT_EQUAL_UINT32(0, runs[id]);
+    } else {
+      TEST_ASSERT_GREATER_OR_EQUAL((now - start - 2 * WHEEL_RES_MS) / PERIODS[id], runs[id]);
+    }
+  }
+}
+
+// Runs loop() for ms of simulated time, one millisecond per pass
+void runLoopFor(uint32_t ms) {
+  uint32_t end = millis() + ms;
+  while ((int32_t)(end - millis()) > 0) {
+    WiFi.serviceEvents();  // Where the SDK would run between passes
+    loop();
+    hostClockAdvance(1000);
+  }
+}
+
+// setup() used to return before schedulerBegin() when LittleFS would not
+// mount, leaving every wheel slot pointing at task 0, so loop() never
+// sampled again
+void test_samples_when_file_system_fails() {
+  setup();
+  runLoopFor(warmupTime + 10000);
+  TEST_ASSERT_GREATER_OR_EQUAL((warmupTime + 10000) / 1000 - 1, taskState[taskIndex(taskSample)].runs);
+  TEST_ASSERT_GREATER_THAN(0, taskState[taskIndex(taskBuzzer)].runs);
+  TEST_ASSERT_GREATER_THAN(0, taskState[taskIndex(taskWifi)].runs);
+  TEST_ASSERT_EQUAL_FLOAT(analogRead(gasSensorPin), gasDataBuffer[BUFFER_SIZE - 1]);
+}
+
+// A parked task runs on the very next pass once woken
+void test_task_wake_runs_on_next_pass() {
+  TaskState& buzzer = taskState[taskIndex(taskBuzzer)];
+  uint32_t runs = buzzer.runs;
+  while (buzzer.runs == runs) runLoopFor(1);  // Just parked again
+  runs = buzzer.runs;
+  runLoopFor(BUZZER_IDLE_POLL_MS / 2);
+  TEST_ASSERT_EQUAL_UINT32(runs, buzzer.runs);  // Parked while the buzzer is off
+  taskWake(taskBuzzer);
+  runScheduler();
+  TEST_ASSERT_EQUAL_UINT32(runs + 1, buzzer.runs);
+}
+
+// taskIdleUntil() replaces the next period: one run already due, then none
+// until the given time
+void test_idle_until_skips_runs_until_deadline() {
+  TaskState& wifi = taskState[taskIndex(taskWifi)];
+  runLoopFor(200);
+  uint32_t runs = wifi.runs;
+  taskIdleUntil(taskWifi, millis() + 1000);
+  runLoopFor(900);
+  TEST_ASSERT_LESS_OR_EQUAL(runs + 1, wifi.runs);
+  runLoopFor(300);
+  TEST_ASSERT_GREATER_THAN(runs + 1, wifi.runs);
+}
+
+int main() {
+  setenv("HOST_FS_FAIL", "1", 1);
+  setenv("HOST_ADC", "900", 1);
+  setenv("HOST_PORT_OFFSET", "19000", 1);           // Clear of a running native build
+  setenv("HOST_RESOLVE", "ntfy.sh=127.0.0.1:1", 1);  // Notifications fail at once
+  unsetenv("HOST_FLASH_FILE");
+
+  UNITY_BEGIN();
+  RUN_TEST(test_samples_when_file_system_fails);
+  RUN_TEST(test_task_wake_runs_on_next_pass);
+  RUN_TEST(test_idle_until_skips_runs_until_deadline);
+  RUN_TEST(test_no_task_runs_early);
+  RUN_TEST(test_nothing_lost_across_level1_cascade);
+  RUN_TEST(test_wraparound_of_millis);
+  RUN_TEST(test_removed_task_leaves_its_slot_intact);
+  return UNITY_END();
+}
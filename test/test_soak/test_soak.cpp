@@ -0,0 +1,310 @@
+// Heap soak: 30 days of operation on the host clock, one second per loop()
+// pass, against a local MQTT broker and ntfy server. Every day has a
+// ten-minute alert at noon (ntfy alert, re-notifications and the clear) and
+// a broker disconnect at six in the evening (MQTT reconnect, discovery,
+// subscribe); state publishes, periodic discovery and the heap task run
+// throughout. Prints free heap and fragmentation per day, as the heap task
+// measures them, and fails if either trends the wrong way. On the host,
+// fragmentation counts the free chunks glibc holds between allocations, see
+// EspClass::getMaxFreeBlockSize(). Takes about three minutes:
+//
+//   pio test -e native -f test_soak -v
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#ifndef SOAK_DAYS
+#define SOAK_DAYS 30
+#endif
+const uint32_t ALERT_START_S = 12 * 3600;
+const uint32_t ALERT_SECONDS = 600;
+const uint32_t BROKER_DROP_S = 18 * 3600;
+
+// Listens on 127.0.0.1 at a port the kernel picks
+int listenLocal(uint16_t& port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (bind(fd, (struct sockaddr*)&address, length) != 0 || listen(fd, 4) != 0) return -1;
+  getsockname(fd, (struct sockaddr*)&address, &length);
+  port = ntohs(address.sin_port);
+  return fd;
+}
+
+bool endsWith(const char* text, size_t length, const char* suffix) {
+  size_t suffixLength = strlen(suffix);
+  return length >= suffixLength && memcmp(text + length - suffixLength, suffix, suffixLength) == 0;
+}
+
+// Reads exactly length bytes. Acks at once: a delayed ack holds the device's
+// next small write (a PINGREQ) behind Nagle for ~40 ms of wall time, which
+// is many seconds on the soak's clock.
+bool readFully(int fd, uint8_t* data, size_t length) {
+  while (length) {
+    ssize_t n = recv(fd, data, length, 0);
+    if (n <= 0) return false;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+// MQTT 3.1.1 broker for one client at a time: acknowledges CONNECT,
+// SUBSCRIBE and PINGREQ and counts what arrives. Runs on its own thread,
+// as the client blocks waiting for CONNACK, and keeps off the heap: glibc
+// would give the thread an arena of its own, and mallinfo2() counts it in
+// the device's heap figures.
+struct FakeBroker {
+  int listener = -1;
+  uint16_t port = 0;
+  std::atomic<int> connection{ -1 };
+  std::atomic<bool> busy{ false };
+  std::atomic<bool> drop{ false };
+  std::atomic<bool> stop{ false };
+  std::atomic<uint32_t> connects{ 0 };
+  std::atomic<uint32_t> states{ 0 };
+  std::atomic<uint32_t> discoveries{ 0 };
+  std::atomic<uint32_t> subscribes{ 0 };
+  std::atomic<uint32_t> pings{ 0 };
+
+  // Handles one packet; false once the connection is done
+  bool serve(int fd) {
+    uint8_t header;
+    if (!readFully(fd, &header, 1)) return false;
+    size_t length = 0;
+    uint8_t byte;
+    for (uint8_t shift = 0;; shift += 7) {
+      if (!readFully(fd, &byte, 1)) return false;
+      length |= (size_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    uint8_t body[1024];
+    if (length > sizeof(body) || !readFully(fd, body, length)) return false;
+    switch (header & 0xF0) {
+      case 0x10: {
+        static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        connects++;
+        return send(fd, connack, sizeof(connack), MSG_NOSIGNAL) == sizeof(connack);
+      }
+      case 0x30: {
+        size_t topicLength = min((size_t)((body[0] << 8) | body[1]), length - 2);
+        const char* topic = (const char*)body + 2;
+        if (endsWith(topic, topicLength, "/config")) discoveries++;
+        if (endsWith(topic, topicLength, "/state")) states++;
+        return true;
+      }
+      case 0x80: {
+        uint8_t suback[] = { 0x90, 0x03, body[0], body[1], 0x00 };
+        subscribes++;
+        return send(fd, suback, sizeof(suback), MSG_NOSIGNAL) == sizeof(suback);
+      }
+      case 0xC0: {
+        static const uint8_t pingresp[] = { 0xD0, 0x00 };
+        pings++;
+        return send(fd, pingresp, sizeof(pingresp), MSG_NOSIGNAL) == sizeof(pingresp);
+      }
+      default:
+        return (header & 0xF0) != 0xE0;  // DISCONNECT ends it
+    }
+  }
+
+  void run() {
+    while (!stop) {
+      struct pollfd wait = { listener, POLLIN, 0 };
+      if (poll(&wait, 1, 50) != 1) continue;
+      int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) continue;
+      connection = fd;
+      while (!stop && !drop) {
+        struct pollfd ready = { fd, POLLIN, 0 };
+        if (poll(&ready, 1, 50) != 1) continue;
+        busy = true;
+        bool open = serve(fd);
+        busy = false;
+        if (!open) break;
+      }
+      connection = -1;
+      close(fd);
+      drop = false;
+    }
+  }
+
+  // Waits until everything the device sent has been read and answered
+  void settle() {
+    int fd, pending;
+    while ((fd = connection) >= 0 && (busy || (ioctl(fd, FIONREAD, &pending) == 0 && pending > 0))) sched_yield();
+  }
+};
+
+// ntfy: answers each POST with 200 and counts it by message; off the heap
+// for the same reason as the broker
+struct FakeNtfy {
+  int listener = -1;
+  uint16_t port = 0;
+  std::atomic<bool> stop{ false };
+  std::atomic<uint32_t> startups{ 0 };
+  std::atomic<uint32_t> alerts{ 0 };
+  std::atomic<uint32_t> clears{ 0 };
+
+  void run() {
+    static char request[2048];
+    while (!stop) {
+      struct pollfd wait = { listener, POLLIN, 0 };
+      if (poll(&wait, 1, 50) != 1) continue;
+      int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) continue;
+      size_t size = 0, wanted = sizeof(request) - 1;
+      const char* body = nullptr;
+      while (size < wanted) {
+        ssize_t n = recv(fd, request + size, wanted - size, 0);
+        if (n <= 0) break;
+        size += n;
+        request[size] = '\0';
+        const char* end = body ? nullptr : strstr(request, "\r\n\r\n");
+        if (end) {
+          body = end + 4;
+          const char* length = strstr(request, "Content-Length: ");
+          wanted = min(wanted, (size_t)(body - request) + (length ? strtoul(length + 16, nullptr, 10) : 0));
+        }
+      }
+      if (body && strcmp(body, ALERT_MESSAGE) == 0) {
+        alerts++;
+      } else if (body && strcmp(body, NORMAL_MESSAGE) == 0) {
+        clears++;
+      } else if (body && strncmp(body, "Device started", 14) == 0) {
+        startups++;
+      }
+      static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+      close(fd);
+    }
+  }
+};
+
+FakeBroker broker;
+FakeNtfy ntfy;
+const char* adcFile;
+
+void setReading(int value) {
+  FILE* file = fopen(adcFile, "w");
+  fprintf(file, "%d\n", value);
+  fclose(file);
+}
+
+void runSecond() {
+  WiFi.serviceEvents();  // Where the SDK would run between passes
+  loop();
+  broker.settle();
+  hostClockAdvance(1000000);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+struct SoakDay {
+  uint32_t minFreeHeap;
+  uint8_t worstFrag;
+};
+
+void test_thirty_days() {
+  SoakDay days[SOAK_DAYS];
+  printf("day  min free  worst frag  states  discovery  alerts  reconnects\n");
+  for (uint8_t day = 0; day < SOAK_DAYS; day++) {
+    SoakDay& today = days[day];
+    today = { UINT32_MAX, 0 };
+    uint32_t states = broker.states, discoveries = broker.discoveries, alerts = ntfy.alerts, connects = broker.connects;
+    for (uint32_t second = 0; second < 86400; second++) {
+      if (second == ALERT_START_S) setReading(900);
+      if (second == ALERT_START_S + ALERT_SECONDS) setReading(100);
+      if (second == BROKER_DROP_S) broker.drop = true;
+      runSecond();
+      if (second % 60 == 59) {
+        // taskHeap has just taken its minute sample
+        today.minFreeHeap = min(today.minFreeHeap, ESP.getFreeHeap());
+        today.worstFrag = max(today.worstFrag, fragTrend.current);
+      }
+    }
+    printf("%3u  %8lu  %9u%%  %6lu  %9lu  %6lu  %10lu\n", day + 1, (unsigned long)today.minFreeHeap, today.worstFrag,
+           (unsigned long)(broker.states - states), (unsigned long)(broker.discoveries - discoveries),
+           (unsigned long)(ntfy.alerts - alerts), (unsigned long)(broker.connects - connects));
+    fflush(stdout);
+  }
+
+  // Every path ran every day
+  TEST_ASSERT_EQUAL(1, ntfy.startups);
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_DAYS * 2, ntfy.alerts);  // First and re-notifications
+  TEST_ASSERT_EQUAL(SOAK_DAYS, ntfy.clears);
+  TEST_ASSERT_EQUAL(SOAK_DAYS + 1, broker.connects);
+  TEST_ASSERT_EQUAL(SOAK_DAYS + 1, broker.subscribes);
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_DAYS * 86400 * 9 / 10, broker.states);
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_DAYS * 288, broker.discoveries);
+
+  // No trend: the last week is no worse than the first, once boot has settled
+  uint32_t firstFree = UINT32_MAX, lastFree = UINT32_MAX;
+  uint8_t firstFrag = 0, lastFrag = 0;
+  for (uint8_t day = 1; day < min(8, SOAK_DAYS); day++) {
+    firstFree = min(firstFree, days[day].minFreeHeap);
+    firstFrag = max(firstFrag, days[day].worstFrag);
+  }
+  for (uint8_t day = max(1, SOAK_DAYS - 7); day < SOAK_DAYS; day++) {
+    lastFree = min(lastFree, days[day].minFreeHeap);
+    lastFrag = max(lastFrag, days[day].worstFrag);
+  }
+  printf("first week: min free %lu, worst frag %u%%; last week: min free %lu, worst frag %u%%\n", (unsigned long)firstFree,
+         firstFrag, (unsigned long)lastFree, lastFrag);
+  TEST_ASSERT_GREATER_OR_EQUAL(firstFree - 512, lastFree);
+  TEST_ASSERT_LESS_OR_EQUAL(firstFrag + 5, lastFrag);
+}
+
+int main() {
+  static char path[] = "/tmp/test_soak_adcXXXXXX";
+  close(mkstemp(path));
+  adcFile = path;
+  setReading(100);
+  broker.listener = listenLocal(broker.port);
+  ntfy.listener = listenLocal(ntfy.port);
+  std::thread brokerThread(&FakeBroker::run, &broker);
+  std::thread ntfyThread(&FakeNtfy::run, &ntfy);
+
+  char resolve[40];
+  snprintf(resolve, sizeof(resolve), "ntfy.sh=127.0.0.1:%u", ntfy.port);
+  setenv("HOST_RESOLVE", resolve, 1);
+  setenv("HOST_ADC_FILE", adcFile, 1);
+  setenv("HOST_PORT_OFFSET", "19300", 1);  // Clear of a running native build
+  unsetenv("HOST_FLASH_FILE");
+  unsetenv("HOST_FS_DIR");
+
+  // Calibrated, MQTT pointed at the broker before the boot sequence gets to it
+  setup();
+  config.baseGasValue = 100;
+  config.mqttEnabled = true;
+  config.ntfyEnabled = true;
+  strlcpy(config.mqttServer, "127.0.0.1", sizeof(config.mqttServer));
+  config.mqttPort = broker.port;
+  for (uint8_t m = 0; m < LOG_MOD_COUNT; m++) logLevels[m] = min(logLevels[m], (uint8_t)LOG_LEVEL_WARN);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_thirty_days);
+  int failures = UNITY_END();
+
+  broker.stop = true;
+  ntfy.stop = true;
+  brokerThread.join();
+  ntfyThread.join();
+  unlink(adcFile);
+  return failures;
+}
@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+"""Decode gas detector binary log output.
+
+Firmware built with -DLOG_BINARY (env:binary_log) sends each LOG_E/W/I/D
+call as a frame holding the FNV-1a hash of its format string and the
+packed arguments, instead of formatted text. This rebuilds the text: the
+format table comes from the LOG_ calls in the source, so run it against
+the same revision that was flashed. Anything that is not a frame, such as
+telnet command replies, is passed through unchanged.
+
+    pio device monitor -e binary_log --raw | python3 tools/logdecode.py -
+    python3 tools/logdecode.py gasdetect.local:23
+"""
+
+import argparse
+import os
+import re
+import socket
+import struct
+import sys
+
+FRAME_SYNC = 0xFE
+HEADER = 6  # sync, length, 4-byte ID
+STRING_CUT = 0x80  # In a string's length byte: the device cut it short
+
+LEVELS = {"E": "error", "W": "warn", "I": "info", "D": "debug"}
+CALL = re.compile(r'\bLOG_([EWID])(?:_TELNET)?\(\s*([A-Z]+)\s*,\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+# "%[.2f]" takes a float array and prints "[%.2f]" per value (binary only)
+CONVERSION = re.compile(
+    r"%\[(?P<array>[^\]]+)\]|"
+    r"%(?P<flags>[-+ #0]*)(?P<width>\d+)?(?:\.(?P<precision>\d+))?"
+    r"(?:hh|h|ll|l|z|j|t|L)?(?P<conv>[diouxXeEfFgGcsSp%])")
+ESCAPES = {"n": "\n", "r": "\r", "t": "\t", "\\": "\\", '"': '"', "'": "'", "0": "\0"}
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(literal):
+    return re.sub(r"\\(x[0-9a-fA-F]{2}|.)",
+                  lambda m: chr(int(m.group(1)[1:], 16)) if m.group(1)[0] == "x" else ESCAPES.get(m.group(1), m.group(1)),
+                  literal)
+
+
+def load_formats(paths):
+    """Maps format ID to (format, set of (level, module)) for every LOG_ call.
+
+    The ID is the hash of the format alone, so a format used by several
+    calls carries every level and module it is logged at.
+    """
+    formats = {}
+    for path in paths:
+        with open(path, encoding="utf-8", errors="replace") as f:
+            source = f.read()
+        for match in CALL.finditer(source):
+            level, module, literals = match.groups()
+            fmt = "".join(unescape(s) for s in LITERAL.findall(literals))
+            key = fnv1a(fmt.encode("latin-1"))
+            if key in formats and formats[key][0] != fmt:
+                sys.exit("format ID collision 0x%08x:\n  %r\n  %r" % (key, formats[key][0], fmt))
+            formats.setdefault(key, (fmt, set()))[1].add((LEVELS[level], module.lower()))
+    return formats
+
+
+def tag(sites):
+    """Level and module prefix, left blank when the calls sharing a format differ."""
+    if len(sites) != 1:
+        return "%-5s %-6s" % ("", "")
+    return "%-5s %-6s" % next(iter(sites))
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.at = 0
+
+    def byte(self):
+        if self.at >= len(self.data):
+            raise IndexError
+        self.at += 1
+        return self.data[self.at - 1]
+
+    def varint(self):
+        value = shift = 0
+        while True:
+            byte = self.byte()
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return (value >> 1) ^ -(value & 1)
+
+    def float(self):
+        if self.at + 4 > len(self.data):
+            raise IndexError
+        self.at += 4
+        return struct.unpack_from("<f", self.data, self.at - 4)[0]
+
+    def string(self):
+        length = self.byte()
+        cut = length & STRING_CUT
+        length &= ~STRING_CUT
+        if self.at + length > len(self.data):
+            raise IndexError
+        self.at += length
+        text = self.data[self.at - length:self.at].decode("utf-8", errors="replace")
+        return text + "<...>" if cut else text
+
+
+def render(fmt, payload):
+    """Formats like the device's printf would; marks arguments cut off by a full frame."""
+    reader = Reader(payload)
+    out = []
+    last = 0
+    for match in CONVERSION.finditer(fmt):
+        out.append(fmt[last:match.start()])
+        last = match.end()
+        if match.group("array"):
+            try:
+                count = reader.byte()
+                for _ in range(count):
+                    out.append("[" + ("%" + match.group("array")) % reader.float() + "]")
+            except IndexError:
+                out.append("<truncated>")
+                return "".join(out)
+            continue
+        conv = match.group("conv")
+        if conv == "%":
+            out.append("%")
+            continue
+        spec = "%" + match.group("flags") + (match.group("width") or "")
+        if match.group("precision") is not None:
+            spec += "." + match.group("precision")
+        try:
+            if conv in "eEfFgG":
+                out.append((spec + conv) % reader.float())
+            elif conv in "sS":
+                out.append((spec + "s") % reader.string())
+            elif conv == "c":
+                out.append((spec + "c") % chr(reader.varint() & 0xFF))
+            else:
+                value = reader.varint()
+                if conv in "ouxXp" and value < 0:
+                    value &= 0xFFFFFFFF  # The device printed it as a 32-bit unsigned
+                if conv == "p":
+                    out.append("0x%x" % value)
+                else:
+                    out.append((spec + conv.replace("i", "d").replace("u", "d")) % value)
+        except IndexError:
+            out.append("<truncated>")
+            return "".join(out)
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+class Decoder:
+    def __init__(self, formats, out, tags):
+        self.formats = formats
+        self.out = out
+        self.tags = tags
+        self.pending = b""
+        self.unknown = 0
+
+    def feed(self, data):
+        buf = self.pending + data
+        text_start = 0
+        at = buf.find(FRAME_SYNC)
+        while at >= 0:
+            if len(buf) - at < HEADER:
+                break  # Wait for the rest of the header
+            length = buf[at + 1]
+            key = struct.unpack_from("<I", buf, at + 2)[0]
+            if length < 4 or key not in self.formats:
+                # A 0xFE that is not a frame start: a text byte, or a frame
+                # whose beginning was dropped by the device under backpressure
+                if key not in self.formats and length >= 4:
+                    self.unknown += 1
+                at = buf.find(FRAME_SYNC, at + 1)
+                continue
+            if len(buf) - at < length + 2:
+                break  # Wait for the rest of the frame
+            self.text(buf[text_start:at])
+            fmt, sites = self.formats[key]
+            line = render(fmt, buf[at + HEADER:at + 2 + length])
+            if self.tags:
+                line = tag(sites) + " " + line
+            self.out.write(line + "\n")
+            text_start = at + 2 + length
+            at = buf.find(FRAME_SYNC, text_start)
+        hold = len(buf) if at < 0 else at
+        self.text(buf[text_start:hold])
+        self.pending = buf[hold:]
+        self.out.flush()
+
+    def finish(self):
+        self.text(self.pending)
+        self.pending = b""
+        self.out.flush()
+
+    def text(self, data):
+        if data:
+            self.out.write(data.decode("utf-8", errors="replace"))
+
+
+def chunks(source):
+    if source == "-":
+        fd = sys.stdin.fileno()
+        while True:
+            data = os.read(fd, 4096)
+            if not data:
+                return
+            yield data
+    host, sep, port = source.rpartition(":")
+    if sep and port.isdigit() and not os.path.exists(source):
+        with socket.create_connection((host, int(port))) as sock:
+            while True:
+                data = sock.recv(4096)
+                if not data:
+                    return
+                yield data
+    with open(source, "rb") as f:
+        while True:
+            data = f.read(4096)
+            if not data:
+                return
+            yield data
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("input", nargs="?", default="-", help="capture file, host:port of the telnet server, or - for stdin")
+    parser.add_argument("--source", action="append", help="source files with LOG_ calls (default src/main.cpp)")
+    parser.add_argument("--tags", action="store_true",
+                        help="prefix each decoded line with its level and module, when its format has only one")
+    parser.add_argument("--list", action="store_true", help="print the format table and exit")
+    args = parser.parse_args()
+
+    formats = load_formats(args.source or [os.path.join(here, "..", "src", "main.cpp")])
+    if args.list:
+        for key, (fmt, sites) in sorted(formats.items()):
+            print("%08x %-12s %r" % (key, ",".join("%s/%s" % site for site in sorted(sites)), fmt))
+        return
+
+    decoder = Decoder(formats, sys.stdout, args.tags)
+    try:
+        for data in chunks(args.input):
+            decoder.feed(data)
+    except KeyboardInterrupt:
+        pass
+    decoder.finish()
+    if decoder.unknown:
+        print("note: skipped %d frames with unknown IDs; is the source the flashed revision?" % decoder.unknown,
+              file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
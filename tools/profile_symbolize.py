@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Symbolize a gas detector CPU profile.
+
+Reads the dump served by GET /profile (or printed by the telnet "profile"
+command) and resolves each sampled PC against the firmware ELF with
+addr2line. Prints a flat profile by default, or folded stacks for
+flamegraph.pl / speedscope with --folded. Inlined frames reported by
+addr2line become stack levels, with the scheduler task at the root.
+
+    python3 tools/profile_symbolize.py .pio/build/your_esp8266_board/firmware.elf profile.txt
+    curl -s http://gasdetect.local/profile | python3 tools/profile_symbolize.py firmware.elf - --folded > out.folded
+"""
+
+import argparse
+import collections
+import os
+import shutil
+import subprocess
+import sys
+
+
+def default_addr2line():
+    name = "xtensa-lx106-elf-addr2line"
+    found = shutil.which(name)
+    if found:
+        return found
+    bundled = os.path.expanduser("~/.platformio/packages/toolchain-xtensa/bin/" + name)
+    return bundled if os.path.exists(bundled) else name
+
+
+def read_dump(stream):
+    header = {}
+    samples = []
+    for line in stream:
+        line = line.strip()
+        if not line:
+            continue
+        if line.startswith("#"):
+            words = line[1:].split()
+            if words and words[0] == "firmware":
+                header["firmware"] = " ".join(words[1:])
+                continue
+            # "# period_us 997 seconds 10 ..." pairs up as key/value
+            for key, value in zip(words[0::2], words[1::2]):
+                header[key] = value
+            continue
+        pc, task, count = line.split()
+        samples.append((int(pc, 16), task, int(count)))
+    return header, samples
+
+
+def symbolize(addr2line, elf, addresses):
+    """Maps each address to its frames, outermost first."""
+    if not addresses:
+        return {}
+    proc = subprocess.run(
+        [addr2line, "-e", elf, "-f", "-C", "-i", "-a"],
+        input="".join("0x%08x\n" % a for a in addresses),
+        capture_output=True, text=True, check=True)
+    frames = {}
+    current = None
+    lines = proc.stdout.splitlines()
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        if line.startswith("0x"):
+            current = int(line, 16)
+            frames[current] = []
+            i += 1
+            continue
+        function = line
+        location = lines[i + 1] if i + 1 < len(lines) else "??:0"
+        frames[current].append((function, location))
+        i += 2
+    # addr2line lists the innermost inlined frame first
+    return {a: list(reversed(f)) for a, f in frames.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("elf", help="firmware.elf matching the profiled build")
+    parser.add_argument("dump", help="profile dump, or - for stdin")
+    parser.add_argument("--folded", action="store_true", help="emit folded stacks instead of a flat profile")
+    parser.add_argument("--addr2line", default=default_addr2line(), help="addr2line for the xtensa toolchain")
+    parser.add_argument("--top", type=int, default=40, help="rows in the flat profile")
+    args = parser.parse_args()
+
+    stream = sys.stdin if args.dump == "-" else open(args.dump)
+    header, samples = read_dump(stream)
+    frames = symbolize(args.addr2line, args.elf, sorted({pc for pc, _, _ in samples}))
+
+    if args.folded:
+        folded = collections.Counter()
+        for pc, task, count in samples:
+            stack = [task] + [f for f, _ in frames.get(pc, [("0x%08x" % pc, "")])]
+            folded[";".join(s.replace(";", ":") for s in stack)] += count
+        for stack, count in sorted(folded.items()):
+            print("%s %d" % (stack, count))
+        return
+
+    total = sum(count for _, _, count in samples)
+    flat = collections.Counter()
+    where = {}
+    for pc, _, count in samples:
+        function, location = frames.get(pc, [("0x%08x" % pc, "??")])[-1]
+        flat[function] += count
+        where.setdefault(function, location.split(" ")[0])
+    print("firmware %s, %s samples over %s s, %s dropped" % (
+        header.get("firmware", "?"), header.get("samples", total),
+        header.get("seconds", "?"), header.get("dropped", "0")))
+    print("%8s %6s  %s" % ("samples", "%", "function"))
+    for function, count in flat.most_common(args.top):
+        print("%8d %5.1f%%  %s  (%s)" % (count, 100.0 * count / max(total, 1), function, where[function]))
+
+
+if __name__ == "__main__":
+    main()
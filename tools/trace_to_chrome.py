@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Convert a gas detector event trace to Chrome trace JSON.
+
+Reads the dump served by GET /trace (or printed by the telnet "trace"
+command) and writes Chrome trace-event JSON that Perfetto
+(ui.perfetto.dev) and chrome://tracing open directly. Task runs and the
+sections and calls nested inside them become slices on one track; marks
+such as ADC reads and buzzer toggles become instant events.
+
+    curl -s http://gasdetect.local/trace | python3 tools/trace_to_chrome.py - > trace.json
+"""
+
+import argparse
+import json
+import sys
+
+
+def read_dump(stream):
+    header = {}
+    names = {}
+    records = []
+    for line in stream:
+        line = line.strip()
+        if not line:
+            continue
+        if line.startswith("#"):
+            words = line[1:].split()
+            if not words:
+                continue
+            if words[0] == "firmware":
+                header["firmware"] = " ".join(words[1:])
+            elif words[0] == "event":
+                names[int(words[1], 16)] = (words[2], words[3])
+            else:
+                # "# cpu_mhz 80 seconds 10 ..." pairs up as key/value
+                for key, value in zip(words[0::2], words[1::2]):
+                    header[key] = value
+            continue
+        cycles, event, phase, arg = line.split()
+        records.append((int(cycles, 16), int(event, 16), phase, int(arg)))
+    return header, names, records
+
+
+def unwrap(records):
+    """Extends the 32-bit cycle counter, which wraps every 53 s at 80 MHz.
+
+    Records are written in roughly time order (task pairs land after the
+    records nested inside them), so consecutive records are always far less
+    than half a wrap apart.
+    """
+    out = []
+    last_raw = None
+    now = 0
+    for cycles, event, phase, arg in records:
+        if last_raw is not None:
+            delta = (cycles - last_raw) & 0xFFFFFFFF
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            now += delta
+        last_raw = cycles
+        out.append((now, event, phase, arg))
+    return out
+
+
+def convert(header, names, records):
+    mhz = float(header.get("cpu_mhz", 80))
+    timeline = unwrap(records)
+    origin = min((t for t, _, _, _ in timeline), default=0)
+    events = [
+        {"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "gasdetect " + header.get("firmware", "")}},
+        {"ph": "M", "pid": 1, "tid": 1, "name": "thread_name", "args": {"name": "loop"}},
+    ]
+    open_slices = {}
+    for t, event, phase, arg in sorted(timeline, key=lambda r: r[0]):
+        category, name = names.get(event, ("unknown", "0x%04x" % event))
+        ts = (t - origin) / mhz
+        if phase == "B":
+            open_slices.setdefault(event, []).append(ts)
+        elif phase == "E":
+            starts = open_slices.get(event)
+            if not starts:
+                continue  # Began before the oldest record kept in the ring
+            start = starts.pop()
+            events.append({"ph": "X", "pid": 1, "tid": 1, "cat": category, "name": name, "ts": start, "dur": ts - start})
+        else:
+            events.append({"ph": "i", "s": "t", "pid": 1, "tid": 1, "cat": category, "name": name, "ts": ts, "args": {"arg": arg}})
+    return {"traceEvents": events, "displayTimeUnit": "ms", "otherData": header}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("dump", help="trace dump, or - for stdin")
+    parser.add_argument("-o", "--output", help="output file (default stdout)")
+    args = parser.parse_args()
+
+    stream = sys.stdin if args.dump == "-" else open(args.dump)
+    header, names, records = read_dump(stream)
+    trace = convert(header, names, records)
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(trace, out)
+    out.write("\n")
+    if header.get("overwritten", "0") != "0":
+        print("note: %s older records were overwritten in the ring" % header["overwritten"], file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()